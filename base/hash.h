@@ -0,0 +1,33 @@
+#ifndef BASE_HASH_H_
+#define BASE_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace base {
+
+// the finalizer of MurmurHash3, every input bit affects every output bit
+inline uint64_t mix_u64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// drawn at random once per process. mixed into the hashes of keys chosen
+// by clients, such as query names, so that colliding keys can not be
+// computed offline and replayed against any gateway
+inline uint64_t hash_seed() {
+  static const uint64_t seed = [] {
+    std::random_device rd;
+    return uint64_t(rd()) << 32 | rd();
+  }();
+  return seed;
+}
+
+} // namespace base
+
+#endif
@@ -1,4 +1,5 @@
 #include "base/logging.h"
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include <string>
@@ -9,6 +10,12 @@
 
 namespace base {
 
+namespace {
+
+std::atomic<int> min_log_level = log_level::INFO;
+
+} // namespace
+
 std::vector<std::string_view> tokenize(const char *s) {
   std::vector<std::string_view> tokens;
   int len = strlen(s);
@@ -52,6 +59,29 @@ const char *to_cstr(int level) {
   }
 }
 
+std::optional<int> log_level_from_string(const std::string &s) {
+  if (s == "debug") {
+    return log_level::DEBUG;
+  } else if (s == "info") {
+    return log_level::INFO;
+  } else if (s == "warn") {
+    return log_level::WARN;
+  } else if (s == "error") {
+    return log_level::ERROR;
+  } else if (s == "fatal") {
+    return log_level::FATAL;
+  }
+  return {};
+}
+
+void set_log_level(int level) {
+  min_log_level.store(level, std::memory_order_relaxed);
+}
+
+bool log_enabled(int level) {
+  return level >= min_log_level.load(std::memory_order_relaxed);
+}
+
 void build_args_v_impl(std::vector<std::string> &v) { return; };
 
 void log_inner(int level, const char *s,
@@ -2,6 +2,7 @@
 #define BASE_LOGGING_H_
 
 #include <iostream>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -13,6 +14,14 @@ Example:
   base::log(INFO, "str:{} int:{} double:{} noval:{}", std::string("Hello"), 123,
             123.0);
 
+Messages below the level set by `set_log_level`, INFO by default, are
+dropped before their arguments are formatted. Arguments which are costly to
+build should be guarded by `log_enabled`:
+
+  if (base::log_enabled(DEBUG)) {
+    base::log(DEBUG, "recv from {}", base::to_string(addr));
+  }
+
 */
 namespace base {
 
@@ -22,6 +31,14 @@ enum LogLevel : int { DEBUG = 0, INFO, WARN, ERROR, FATAL };
 
 const char *to_cstr(int level);
 
+// "debug", "info", "warn", "error" or "fatal"
+std::optional<int> log_level_from_string(const std::string &s);
+
+// messages below `level` are dropped
+void set_log_level(int level);
+
+bool log_enabled(int level);
+
 std::vector<std::string_view> tokenize(const char *s);
 
 void build_args_v_impl(std::vector<std::string> &v);
@@ -47,6 +64,9 @@ void log_inner(int level, const char *s,
                const std::vector<std::string> &args_v);
 
 template <typename... Args> void log(int level, const char *s, Args... args) {
+  if (!log_enabled(level)) {
+    return;
+  }
   auto args_v = build_args_v(args...);
   log_inner(level, s, args_v);
 }
@@ -0,0 +1,59 @@
+#include "base/memory/allocation_counter.h"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// trivially initialized, so counting takes no allocation of its own
+thread_local uint64_t thread_allocations = 0;
+
+void *counted_malloc(size_t size) {
+  thread_allocations++;
+  // malloc(0) may return null, `operator new` must not
+  return malloc(size == 0 ? 1 : size);
+}
+
+} // namespace
+
+namespace base {
+
+uint64_t GetThreadAllocationCount() { return thread_allocations; }
+
+} // namespace base
+
+// the aligned forms are left to the runtime, nothing here over-aligns
+
+void *operator new(size_t size) {
+  if (void *p = counted_malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+  if (void *p = counted_malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
@@ -0,0 +1,28 @@
+#ifndef BASE_MEMORY_ALLOCATION_COUNTER_H_
+#define BASE_MEMORY_ALLOCATION_COUNTER_H_
+
+#include <cstdint>
+
+namespace base {
+
+/*
+  The global `operator new` and `operator delete` are replaced by ones which
+  count the allocations made by every thread, on top of `malloc` and `free`.
+  Unlike `PacketBufferPool::GetHeapAllocationCount`, which only counts the
+  blocks of the pool, the count covers every allocation made through
+  `new`, such as those of `std::vector` and `std::string`.
+
+  example:
+
+    uint64_t before = base::GetThreadAllocationCount();
+    gateway.ProcessRawPacket(std::move(buffer), addr, &batch);
+    uint64_t allocations = base::GetThreadAllocationCount() - before;
+
+*/
+
+// number of `operator new` calls made by the calling thread
+uint64_t GetThreadAllocationCount();
+
+} // namespace base
+
+#endif
@@ -0,0 +1,166 @@
+#include "base/memory/packet_buffer.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <span>
+
+namespace base {
+
+struct PacketBufferBlock {
+  PacketBufferBlock *next = nullptr;
+  std::array<uint8_t, PacketBuffer::kCapacity> data;
+};
+
+namespace {
+
+// a thread moves `kTransferSize` blocks to the depot when its freelist grows
+// beyond `kMaxLocalSize`, and takes up to `kTransferSize` blocks from the
+// depot when its freelist is empty
+constexpr const size_t kMaxLocalSize = 512;
+constexpr const size_t kTransferSize = 256;
+
+} // namespace
+
+// per-thread freelist of `PacketBufferPool`
+struct PacketBufferLocalCache {
+  PacketBufferBlock *head = nullptr;
+  size_t size = 0;
+
+  // hands the remaining blocks over to the depot when the thread exits
+  ~PacketBufferLocalCache() {
+    if (head) {
+      PacketBufferBlock *tail = head;
+      while (tail->next) {
+        tail = tail->next;
+      }
+      PacketBufferPool::GetInstance()->GiveToDepot(head, tail, size);
+    }
+  }
+};
+
+namespace {
+
+thread_local PacketBufferLocalCache local_cache;
+
+} // namespace
+
+// static
+PacketBuffer PacketBuffer::Allocate() {
+  return PacketBuffer(PacketBufferPool::GetInstance()->AllocateBlock());
+}
+
+// static
+PacketBuffer PacketBuffer::CopyFrom(std::span<const uint8_t> bytes) {
+  PacketBuffer buffer = Allocate();
+  size_t n = std::min(bytes.size(), kCapacity);
+  memcpy(buffer.data(), bytes.data(), n);
+  buffer.resize(n);
+  return buffer;
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other)
+    : block_(other.block_), size_(other.size_) {
+  other.block_ = nullptr;
+  other.size_ = 0;
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other) {
+  if (this != &other) {
+    if (block_) {
+      PacketBufferPool::GetInstance()->ReleaseBlock(block_);
+    }
+    block_ = other.block_;
+    size_ = other.size_;
+    other.block_ = nullptr;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+PacketBuffer::~PacketBuffer() {
+  if (block_) {
+    PacketBufferPool::GetInstance()->ReleaseBlock(block_);
+  }
+}
+
+uint8_t *PacketBuffer::data() { return block_ ? block_->data.data() : nullptr; }
+
+const uint8_t *PacketBuffer::data() const {
+  return block_ ? block_->data.data() : nullptr;
+}
+
+// static
+PacketBufferPool *PacketBufferPool::GetInstance() {
+  static PacketBufferPool instance;
+  return &instance;
+}
+
+uint64_t PacketBufferPool::GetHeapAllocationCount() const {
+  return heap_allocations_.load(std::memory_order_relaxed);
+}
+
+uint64_t PacketBufferPool::GetAllocationCount() const {
+  return allocations_.load(std::memory_order_relaxed);
+}
+
+PacketBufferBlock *PacketBufferPool::AllocateBlock() {
+  allocations_.fetch_add(1, std::memory_order_relaxed);
+  PacketBufferLocalCache &local = local_cache;
+  if (!local.head) {
+    local.head = TakeFromDepot(kTransferSize, &local.size);
+  }
+  if (PacketBufferBlock *block = local.head) {
+    local.head = block->next;
+    local.size--;
+    block->next = nullptr;
+    return block;
+  }
+  heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+  return new PacketBufferBlock();
+}
+
+void PacketBufferPool::ReleaseBlock(PacketBufferBlock *block) {
+  PacketBufferLocalCache &local = local_cache;
+  block->next = local.head;
+  local.head = block;
+  local.size++;
+  if (local.size > kMaxLocalSize) {
+    PacketBufferBlock *head = local.head;
+    PacketBufferBlock *tail = head;
+    for (size_t i = 1; i < kTransferSize; i++) {
+      tail = tail->next;
+    }
+    local.head = tail->next;
+    local.size -= kTransferSize;
+    GiveToDepot(head, tail, kTransferSize);
+  }
+}
+
+PacketBufferBlock *PacketBufferPool::TakeFromDepot(size_t n, size_t *taken) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  PacketBufferBlock *head = depot_;
+  PacketBufferBlock *tail = nullptr;
+  size_t cnt = 0;
+  for (PacketBufferBlock *curr = depot_; curr && cnt < n; curr = curr->next) {
+    tail = curr;
+    cnt++;
+  }
+  if (tail) {
+    depot_ = tail->next;
+    tail->next = nullptr;
+  }
+  depot_size_ -= cnt;
+  *taken = cnt;
+  return cnt > 0 ? head : nullptr;
+}
+
+void PacketBufferPool::GiveToDepot(PacketBufferBlock *head,
+                                   PacketBufferBlock *tail, size_t n) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  tail->next = depot_;
+  depot_ = head;
+  depot_size_ += n;
+}
+
+} // namespace base
@@ -0,0 +1,114 @@
+#ifndef BASE_MEMORY_PACKET_BUFFER_H_
+#define BASE_MEMORY_PACKET_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+
+namespace base {
+
+struct PacketBufferBlock;
+struct PacketBufferLocalCache;
+
+/*
+  `PacketBuffer` is a move-only handle of a fixed-size buffer taken from
+  `PacketBufferPool`. The buffer goes back to the freelist of the releasing
+  thread when the handle is destructed, so it can be passed between threads
+  freely.
+
+  example:
+
+    auto buffer = base::PacketBuffer::Allocate();
+    buffer.resize(12);
+    memcpy(buffer.data(), header, 12);
+    udp_socket.SendTo(buffer.span(), addr);
+
+*/
+class PacketBuffer {
+public:
+  static constexpr const size_t kCapacity = 2048;
+
+  static PacketBuffer Allocate();
+
+  // allocates a buffer and copies `bytes` into it, `bytes` longer than
+  // `kCapacity` are truncated
+  static PacketBuffer CopyFrom(std::span<const uint8_t> bytes);
+
+  // an empty handle which owns nothing
+  PacketBuffer() = default;
+
+  PacketBuffer(PacketBuffer &&other);
+  PacketBuffer &operator=(PacketBuffer &&other);
+
+  ~PacketBuffer();
+
+  uint8_t *data();
+  const uint8_t *data() const;
+
+  size_t size() const { return size_; }
+  // `size` must not be greater than `kCapacity`
+  void resize(size_t size) { size_ = size; }
+
+  std::span<uint8_t> span() { return {data(), size_}; }
+  std::span<const uint8_t> span() const { return {data(), size_}; }
+
+  bool valid() const { return block_ != nullptr; }
+
+  PacketBuffer(const PacketBuffer &) = delete;
+  PacketBuffer &operator=(const PacketBuffer &) = delete;
+
+private:
+  explicit PacketBuffer(PacketBufferBlock *block) : block_(block) {}
+
+private:
+  PacketBufferBlock *block_ = nullptr;
+  size_t size_ = 0;
+};
+
+/*
+  A slab of `PacketBuffer`s. Every thread keeps its own freelist, so
+  allocating and releasing buffers takes no lock in the common case. A
+  thread holding too many free buffers moves a chunk of them to a shared
+  depot, and a thread running out of buffers refills from the depot before
+  falling back to the heap. Memory is never returned to the heap.
+*/
+class PacketBufferPool {
+private:
+  PacketBufferPool() = default;
+
+public:
+  static PacketBufferPool *GetInstance();
+
+  // number of buffers ever allocated from the heap, it stays flat once the
+  // pool is warmed up. only the blocks of the pool are counted, see
+  // `GetThreadAllocationCount` for every allocation
+  uint64_t GetHeapAllocationCount() const;
+
+  // number of `PacketBuffer::Allocate` calls
+  uint64_t GetAllocationCount() const;
+
+private:
+  friend class PacketBuffer;
+  friend struct PacketBufferLocalCache;
+
+  PacketBufferBlock *AllocateBlock();
+  void ReleaseBlock(PacketBufferBlock *block);
+
+  // move up to `n` blocks from the depot, returns the head of the list
+  PacketBufferBlock *TakeFromDepot(size_t n, size_t *taken);
+  void GiveToDepot(PacketBufferBlock *head, PacketBufferBlock *tail,
+                   size_t n);
+
+private:
+  std::mutex mutex_;
+  PacketBufferBlock *depot_ = nullptr;
+  size_t depot_size_ = 0;
+  std::atomic<uint64_t> heap_allocations_ = 0;
+  std::atomic<uint64_t> allocations_ = 0;
+};
+
+} // namespace base
+
+#endif
@@ -0,0 +1,54 @@
+#include "base/memory/slab_arena.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <memory>
+
+namespace base {
+
+// static
+size_t SlabArena::ClassOf(size_t size) {
+  if (size <= kLinearMax) {
+    return size <= kMinSlotSize ? 0 : (size - 1) / kMinSlotSize;
+  }
+  // 2^(bits - 1) < size <= 2^bits, split into 4 classes
+  size_t bits = std::bit_width(size - 1);
+  size_t base = size_t(1) << (bits - 1);
+  size_t quarter = base / 4;
+  size_t step = (size - base + quarter - 1) / quarter;
+  return kLinearClassCount +
+         (bits - std::bit_width(kLinearMax)) * 4 + step - 1;
+}
+
+uint8_t *SlabArena::Allocate(size_t size) {
+  size_t size_class = ClassOf(size);
+  size_t slot_size = SizeOfClass(size_class);
+  SizeClass &c = classes_[size_class];
+  used_bytes_ += slot_size;
+  if (c.free) {
+    uint8_t *slot = c.free;
+    memcpy(&c.free, slot, sizeof(c.free));
+    return slot;
+  }
+  if (c.unused == c.unused_end) {
+    // a whole number of slots, at least one
+    size_t slab_size = std::max<size_t>(kSlabSize / slot_size, 1) * slot_size;
+    slabs_.push_back(std::make_unique_for_overwrite<uint8_t[]>(slab_size));
+    reserved_bytes_ += slab_size;
+    c.unused = slabs_.back().get();
+    c.unused_end = c.unused + slab_size;
+  }
+  uint8_t *slot = c.unused;
+  c.unused += slot_size;
+  return slot;
+}
+
+void SlabArena::Free(uint8_t *slot, size_t size) {
+  size_t size_class = ClassOf(size);
+  SizeClass &c = classes_[size_class];
+  memcpy(slot, &c.free, sizeof(c.free));
+  c.free = slot;
+  used_bytes_ -= SizeOfClass(size_class);
+}
+
+} // namespace base
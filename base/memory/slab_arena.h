@@ -0,0 +1,93 @@
+#ifndef BASE_MEMORY_SLAB_ARENA_H_
+#define BASE_MEMORY_SLAB_ARENA_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace base {
+
+/*
+  `SlabArena` allocates byte strings of up to `kMaxSlotSize` bytes from size
+  classes 16 bytes apart up to 256 bytes, then four per doubling: 320, 384,
+  448, 512, 640, ... bytes, so a slot wastes less than a fifth of its size
+  beyond the first classes. Every class carves its slots out of slabs of
+  about `kSlabSize` bytes taken from the heap, and threads its freed slots
+  in a freelist, so a freed slot is reused by the next allocation of its
+  class without going back to the heap. Slabs are never returned to the
+  heap.
+
+  not thread safe
+
+  example:
+
+    base::SlabArena arena;
+    uint8_t *slot = arena.Allocate(100); // a slot of 112 bytes
+    memcpy(slot, bytes, 100);
+    ...
+    arena.Free(slot, 100);
+
+*/
+class SlabArena {
+public:
+  static constexpr const size_t kMinSlotSize = 16;
+  static constexpr const size_t kMaxSlotSize = 64 << 10;
+  static constexpr const size_t kSlabSize = 16 << 10;
+
+  SlabArena() = default;
+  SlabArena(SlabArena &&other) = default;
+  SlabArena &operator=(SlabArena &&other) = default;
+
+  // returns a slot of `SlotSize(size)` bytes. `size` must not be greater
+  // than `kMaxSlotSize`
+  uint8_t *Allocate(size_t size);
+  // `size` is the one given to `Allocate`
+  void Free(uint8_t *slot, size_t size);
+
+  // bytes of the slot given for `size` bytes
+  static size_t SlotSize(size_t size) { return SizeOfClass(ClassOf(size)); }
+
+  // bytes of the slabs taken from the heap
+  size_t reserved_bytes() const { return reserved_bytes_; }
+  // bytes of the slots allocated and not freed
+  size_t used_bytes() const { return used_bytes_; }
+
+  SlabArena(const SlabArena &) = delete;
+  SlabArena &operator=(const SlabArena &) = delete;
+
+private:
+  // the classes up to `kLinearMax` bytes are `kMinSlotSize` bytes apart
+  static constexpr const size_t kLinearMax = 256;
+  static constexpr const size_t kLinearClassCount = kLinearMax / kMinSlotSize;
+  // 4 classes per doubling from kLinearMax to kMaxSlotSize
+  static constexpr const size_t kClassCount = kLinearClassCount + 4 * 8;
+
+  static size_t ClassOf(size_t size);
+  static size_t SizeOfClass(size_t size_class) {
+    if (size_class < kLinearClassCount) {
+      return (size_class + 1) * kMinSlotSize;
+    }
+    size_t base = kLinearMax << (size_class - kLinearClassCount) / 4;
+    return base + base / 4 * ((size_class - kLinearClassCount) % 4 + 1);
+  }
+
+  struct SizeClass {
+    // head of the freed slots, each one holds the address of the next
+    uint8_t *free = nullptr;
+    // the part of the last slab never handed out
+    uint8_t *unused = nullptr;
+    uint8_t *unused_end = nullptr;
+  };
+
+private:
+  std::array<SizeClass, kClassCount> classes_;
+  std::vector<std::unique_ptr<uint8_t[]>> slabs_;
+  size_t reserved_bytes_ = 0;
+  size_t used_bytes_ = 0;
+};
+
+} // namespace base
+
+#endif
@@ -0,0 +1,76 @@
+#include "base/net/io_engine.h"
+#include "base/logging.h"
+#include "base/net/io_uring_engine.h"
+#include "base/net/udp_socket.h"
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace base {
+
+using namespace log_level;
+
+BlockingIOEngine::BlockingIOEngine(UDPSocket udp_socket,
+                                   const IOEngineOptions &options)
+    : udp_socket_(udp_socket),
+      buffers_(options.batch_size * options.max_packet_size),
+      datagrams_(options.batch_size) {
+  for (int i = 0; i < options.batch_size; i++) {
+    datagrams_[i].buffer = std::span(buffers_).subspan(
+        i * options.max_packet_size, options.max_packet_size);
+  }
+}
+
+std::optional<std::span<Datagram>> BlockingIOEngine::Recv() {
+  while (true) {
+    uint64_t truncated = 0;
+    auto cnt = udp_socket_.RecvMany(datagrams_, &truncated);
+    if (truncated > 0) {
+      truncated_count_.fetch_add(truncated, std::memory_order_relaxed);
+    }
+    if (!cnt) {
+      return {};
+    }
+    // all of them dropped, wait for more
+    if (*cnt > 0) {
+      return std::span(datagrams_).first(*cnt);
+    }
+  }
+}
+
+std::optional<int> BlockingIOEngine::Send(std::span<const Datagram> datagrams) {
+  return udp_socket_.SendMany(datagrams);
+}
+
+std::unique_ptr<IOEngine> CreateIOEngine(UDPSocket udp_socket,
+                                         const IOEngineOptions &options) {
+  if (options.type == IOEngineType::kIoUring) {
+    if (auto engine = IoUringIOEngine::Create(udp_socket, options)) {
+      return engine;
+    }
+    log(WARN, "io_uring is not supported, fall back to {}",
+        std::string(to_cstr(IOEngineType::kBlocking)));
+  }
+  return std::make_unique<BlockingIOEngine>(udp_socket, options);
+}
+
+const char *to_cstr(IOEngineType type) {
+  if (type == IOEngineType::kIoUring) {
+    return "io_uring";
+  } else {
+    return "blocking";
+  }
+}
+
+std::optional<IOEngineType> io_engine_type_from_string(const std::string &s) {
+  if (s == "io_uring") {
+    return IOEngineType::kIoUring;
+  } else if (s == "blocking") {
+    return IOEngineType::kBlocking;
+  }
+  return {};
+}
+
+} // namespace base
@@ -0,0 +1,97 @@
+#ifndef BASE_NET_IO_ENGINE_H_
+#define BASE_NET_IO_ENGINE_H_
+
+#include "base/net/udp_socket.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace base {
+
+enum class IOEngineType : int {
+  kBlocking = 0, // recvmmsg/sendmmsg on a blocking socket
+  kIoUring,      // multishot recvmsg with a provided buffer ring
+};
+
+struct IOEngineOptions {
+  IOEngineType type = IOEngineType::kBlocking;
+  // max number of datagrams returned by one `Recv`
+  int batch_size = 32;
+  // max size of a received datagram, longer datagrams are dropped
+  int max_packet_size = 1000;
+};
+
+/*
+  `IOEngine` receives and sends datagrams on a bound `UDPSocket`.
+
+  Receive buffers are owned by the engine. The datagrams returned by `Recv`
+  stay valid until the next call of `Recv`, which hands the buffers back to
+  the engine. `Recv` must be called from a single thread, while `Send` is
+  thread safe.
+
+  example:
+
+    auto engine = base::CreateIOEngine(*base::UDPSocket::Bind(addr), {});
+    while (auto datagrams = engine->Recv()) {
+      for (auto &datagram : *datagrams) {
+        engine->Send(std::span(&datagram, 1)); // echo
+      }
+    }
+
+*/
+class IOEngine {
+public:
+  virtual ~IOEngine() = default;
+
+  // blocks until at least one datagram arrives
+  virtual std::optional<std::span<Datagram>> Recv() = 0;
+
+  // returns the number of datagrams sent
+  virtual std::optional<int> Send(std::span<const Datagram> datagrams) = 0;
+
+  virtual IOEngineType type() const = 0;
+
+  // the number of datagrams dropped for being longer than
+  // `IOEngineOptions::max_packet_size`
+  uint64_t truncated_count() const {
+    return truncated_count_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  std::atomic<uint64_t> truncated_count_ = 0;
+};
+
+// engine on top of `UDPSocket::RecvMany` and `UDPSocket::SendMany`
+class BlockingIOEngine : public IOEngine {
+public:
+  BlockingIOEngine(UDPSocket udp_socket, const IOEngineOptions &options);
+
+  std::optional<std::span<Datagram>> Recv() override;
+
+  std::optional<int> Send(std::span<const Datagram> datagrams) override;
+
+  IOEngineType type() const override { return IOEngineType::kBlocking; }
+
+private:
+  UDPSocket udp_socket_;
+  std::vector<uint8_t> buffers_;
+  std::vector<Datagram> datagrams_;
+};
+
+// creates the engine given by `options.type`, falls back to
+// `BlockingIOEngine` if it is not supported by the running kernel
+std::unique_ptr<IOEngine> CreateIOEngine(UDPSocket udp_socket,
+                                         const IOEngineOptions &options);
+
+const char *to_cstr(IOEngineType type);
+
+std::optional<IOEngineType> io_engine_type_from_string(const std::string &s);
+
+} // namespace base
+
+#endif
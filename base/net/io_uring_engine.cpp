@@ -0,0 +1,531 @@
+#include "base/net/io_uring_engine.h"
+#include "base/logging.h"
+#include "base/net/udp_socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace base {
+
+using namespace log_level;
+
+namespace {
+
+// `user_data` of the multishot recvmsg, send completions carry the index of
+// their send slot instead
+constexpr const uint64_t kRecvTag = ~0ULL;
+constexpr const uint16_t kBufferGroup = 0;
+// must be a power of 2
+constexpr const unsigned kRingEntries = 256;
+constexpr const unsigned kRecvBufferCount = 256;
+constexpr const unsigned kSendSlotCount = 256;
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+int sys_io_uring_register(int ring_fd, unsigned opcode, void *arg,
+                          unsigned nr_args) {
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+void *mmap_ring(int ring_fd, size_t size, off_t offset) {
+  void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+template <typename T> T *ring_field(void *ring_ptr, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<uint8_t *>(ring_ptr) + offset);
+}
+
+} // namespace
+
+// static
+std::unique_ptr<IoUringIOEngine>
+IoUringIOEngine::Create(UDPSocket udp_socket, const IOEngineOptions &options) {
+  std::unique_ptr<IoUringIOEngine> engine(
+      new IoUringIOEngine(udp_socket, options));
+  if (!engine->SetupRing()) {
+    log(WARN, "io_uring setup failed, errno:{}", errno);
+    return nullptr;
+  }
+  if (!engine->SetupBufferRing()) {
+    log(WARN, "io_uring provided buffer ring is not supported, errno:{}",
+        errno);
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lg(engine->mutex_);
+  engine->ArmRecv();
+  return engine;
+}
+
+IoUringIOEngine::IoUringIOEngine(UDPSocket udp_socket,
+                                 const IOEngineOptions &options)
+    : udp_socket_(udp_socket), options_(options),
+      datagrams_(options.batch_size), send_slots_(kSendSlotCount),
+      send_buffers_(kSendSlotCount * options.max_packet_size) {
+  bids_in_use_.reserve(options.batch_size);
+  free_send_slots_.reserve(kSendSlotCount);
+  for (unsigned i = 0; i < kSendSlotCount; i++) {
+    free_send_slots_.push_back(kSendSlotCount - 1 - i);
+  }
+}
+
+IoUringIOEngine::~IoUringIOEngine() {
+  if (buf_ring_) {
+    munmap(buf_ring_, buf_ring_size_);
+  }
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ptr_ && cq_ring_ptr_ != sq_ring_ptr_) {
+    munmap(cq_ring_ptr_, cq_ring_size_);
+  }
+  if (sq_ring_ptr_) {
+    munmap(sq_ring_ptr_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+bool IoUringIOEngine::SetupRing() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // a multishot recv produces many completions per submission
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = kRingEntries * 4;
+
+  ring_fd_ = sys_io_uring_setup(kRingEntries, &params);
+  if (ring_fd_ < 0) {
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ptr_ = mmap_ring(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+  if (!sq_ring_ptr_) {
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ptr_ = sq_ring_ptr_;
+  } else {
+    cq_ring_ptr_ = mmap_ring(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+    if (!cq_ring_ptr_) {
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe *>(
+      mmap_ring(ring_fd_, sqes_size_, IORING_OFF_SQES));
+  if (!sqes_) {
+    return false;
+  }
+
+  sq_head_ = ring_field<unsigned>(sq_ring_ptr_, params.sq_off.head);
+  sq_tail_ = ring_field<unsigned>(sq_ring_ptr_, params.sq_off.tail);
+  sq_mask_ = *ring_field<unsigned>(sq_ring_ptr_, params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_array_ = ring_field<unsigned>(sq_ring_ptr_, params.sq_off.array);
+  cq_head_ = ring_field<unsigned>(cq_ring_ptr_, params.cq_off.head);
+  cq_tail_ = ring_field<unsigned>(cq_ring_ptr_, params.cq_off.tail);
+  cq_mask_ = *ring_field<unsigned>(cq_ring_ptr_, params.cq_off.ring_mask);
+  cqes_ = ring_field<struct io_uring_cqe>(cq_ring_ptr_, params.cq_off.cqes);
+  return true;
+}
+
+bool IoUringIOEngine::SetupBufferRing() {
+  buf_ring_entries_ = kRecvBufferCount;
+  buf_ring_size_ = buf_ring_entries_ * sizeof(struct io_uring_buf);
+  void *ptr = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return false;
+  }
+  buf_ring_ = static_cast<struct io_uring_buf_ring *>(ptr);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = buf_ring_entries_;
+  reg.bgid = kBufferGroup;
+  if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) <
+      0) {
+    return false;
+  }
+
+  // every received buffer starts with `io_uring_recvmsg_out`, followed by
+  // the source address and the payload
+  recv_buffer_size_ = sizeof(struct io_uring_recvmsg_out) +
+                      sizeof(struct sockaddr_in) + options_.max_packet_size;
+  recv_buffers_.resize(buf_ring_entries_ * recv_buffer_size_);
+  for (unsigned i = 0; i < buf_ring_entries_; i++) {
+    RecycleBuffer(i);
+  }
+  __atomic_store_n(&buf_ring_->tail, buf_ring_tail_, __ATOMIC_RELEASE);
+
+  memset(&recv_msg_, 0, sizeof(recv_msg_));
+  recv_msg_.msg_namelen = sizeof(struct sockaddr_in);
+  return true;
+}
+
+struct io_uring_sqe *IoUringIOEngine::GetSqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail_;
+  if (tail - head >= sq_entries_) {
+    return nullptr;
+  }
+  unsigned idx = tail & sq_mask_;
+  sq_array_[idx] = idx;
+  struct io_uring_sqe *sqe = &sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  // the kernel only reads SQEs in io_uring_enter, which is called with
+  // `mutex_` held as well, so the entry can be published before it is filled
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return sqe;
+}
+
+void IoUringIOEngine::SubmitPending() {
+  while (to_submit_ > 0) {
+    int ret = sys_io_uring_enter(ring_fd_, to_submit_, 0, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log(WARN, "io_uring_enter submit failed, errno:{}", errno);
+      return;
+    }
+    if (ret == 0) {
+      return;
+    }
+    to_submit_ -= ret;
+  }
+}
+
+void IoUringIOEngine::ArmRecv() {
+  struct io_uring_sqe *sqe = GetSqe();
+  if (!sqe) {
+    SubmitPending();
+    sqe = GetSqe();
+  }
+  if (!sqe) {
+    log(ERROR, "io_uring submission queue is full, recv not armed");
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = udp_socket_.fd();
+  sqe->addr = reinterpret_cast<uint64_t>(&recv_msg_);
+  sqe->len = 1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = kRecvTag;
+  SubmitPending();
+  recv_armed_ = true;
+}
+
+void IoUringIOEngine::RecycleBuffer(uint16_t bid) {
+  // `io_uring_buf_ring::bufs` is misplaced when the header is compiled as
+  // C++ (its empty struct member takes 1 byte), index the ring by hand.
+  // the `resv` field of the first entry is the ring tail, leave it untouched
+  struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf *>(buf_ring_) +
+                             (buf_ring_tail_ & (buf_ring_entries_ - 1));
+  buf->addr = reinterpret_cast<uint64_t>(&recv_buffers_[bid * recv_buffer_size_]);
+  buf->len = recv_buffer_size_;
+  buf->bid = bid;
+  buf_ring_tail_++;
+}
+
+std::optional<std::span<Datagram>> IoUringIOEngine::Recv() {
+  for (uint16_t bid : bids_in_use_) {
+    RecycleBuffer(bid);
+  }
+  bids_in_use_.clear();
+
+  while (true) {
+    int n = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      std::lock_guard<std::mutex> lg(mutex_);
+      while (head != tail && n < options_.batch_size) {
+        const struct io_uring_cqe &cqe = cqes_[head & cq_mask_];
+        head++;
+
+        if (cqe.user_data != kRecvTag) {
+          if (cqe.res < 0) {
+            log(WARN, "io_uring sendmsg failed, errno:{}", -cqe.res);
+          }
+          free_send_slots_.push_back(cqe.user_data);
+          continue;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          recv_armed_ = false;
+        }
+        if (cqe.res < 0) {
+          // -ENOBUFS: all buffers are in use, the recv is re-armed below
+          // after buffers are handed back
+          if (cqe.res != -ENOBUFS) {
+            log(WARN, "io_uring recvmsg failed, errno:{}", -cqe.res);
+          }
+          continue;
+        }
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+          continue;
+        }
+
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *buf = &recv_buffers_[bid * recv_buffer_size_];
+        auto *out = reinterpret_cast<struct io_uring_recvmsg_out *>(buf);
+        size_t payload_offset = sizeof(*out) + recv_msg_.msg_namelen +
+                                recv_msg_.msg_controllen;
+        if (static_cast<size_t>(cqe.res) < payload_offset ||
+            out->namelen < sizeof(struct sockaddr_in)) {
+          RecycleBuffer(bid);
+          continue;
+        }
+        // longer than the buffer, the end of the datagram is lost
+        if ((out->flags & MSG_TRUNC) ||
+            out->payloadlen > cqe.res - payload_offset) {
+          truncated_count_.fetch_add(1, std::memory_order_relaxed);
+          RecycleBuffer(bid);
+          continue;
+        }
+
+        struct sockaddr_in addr;
+        memcpy(&addr, buf + sizeof(*out), sizeof(addr));
+        datagrams_[n].buffer =
+            std::span(buf + payload_offset, options_.max_packet_size);
+        datagrams_[n].length = out->payloadlen;
+        datagrams_[n].addr = from_sockaddr_in(addr);
+        bids_in_use_.push_back(bid);
+        n++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      __atomic_store_n(&buf_ring_->tail, buf_ring_tail_, __ATOMIC_RELEASE);
+
+      if (!recv_armed_) {
+        ArmRecv();
+      }
+    } else {
+      __atomic_store_n(&buf_ring_->tail, buf_ring_tail_, __ATOMIC_RELEASE);
+    }
+
+    if (n > 0) {
+      return std::span(datagrams_).first(n);
+    }
+
+    if (sys_io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR) {
+      return {};
+    }
+  }
+}
+
+std::optional<int> IoUringIOEngine::Send(std::span<const Datagram> datagrams) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  int sent = 0;
+  for (const Datagram &datagram : datagrams) {
+    struct io_uring_sqe *sqe = nullptr;
+    if (datagram.length <= static_cast<uint64_t>(options_.max_packet_size) &&
+        !free_send_slots_.empty()) {
+      sqe = GetSqe();
+      if (!sqe) {
+        SubmitPending();
+        sqe = GetSqe();
+      }
+    }
+    if (!sqe) {
+      if (udp_socket_.SendTo(datagram.buffer.first(datagram.length),
+                             datagram.addr)) {
+        sent++;
+      }
+      continue;
+    }
+
+    uint32_t idx = free_send_slots_.back();
+    free_send_slots_.pop_back();
+    SendSlot &slot = send_slots_[idx];
+    uint8_t *data = &send_buffers_[idx * options_.max_packet_size];
+    memcpy(data, datagram.buffer.data(), datagram.length);
+    slot.iov.iov_base = data;
+    slot.iov.iov_len = datagram.length;
+    slot.addr = to_sockaddr_in(datagram.addr);
+    memset(&slot.msg, 0, sizeof(slot.msg));
+    slot.msg.msg_name = &slot.addr;
+    slot.msg.msg_namelen = sizeof(slot.addr);
+    slot.msg.msg_iov = &slot.iov;
+    slot.msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = udp_socket_.fd();
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+    sqe->len = 1;
+    sqe->user_data = idx;
+    sent++;
+  }
+  SubmitPending();
+  return sent;
+}
+
+bool TestIoUringLoopback() {
+  // more datagrams than the ring has buffers, so that every buffer is
+  // handed back and reused several times
+  constexpr const int kRounds = 32;
+  constexpr const int kWindow = 32;
+  // a burst the ring cannot hold at once, sent while nothing is received,
+  // so that the multishot recv runs out of buffers and is armed again
+  constexpr const int kBurst = kRecvBufferCount + 32;
+  constexpr const int kTotal = kRounds * kWindow + kBurst;
+  SocketAddr engine_addr("127.0.0.1:5341");
+  SocketAddr client_addr("127.0.0.1:5342");
+  auto engine_socket = UDPSocket::Bind(engine_addr);
+  auto client = UDPSocket::Bind(client_addr);
+  if (!engine_socket || !client) {
+    printf("bind failed\n");
+    return false;
+  }
+  // the burst is queued on the sockets, while the ring is full and while
+  // the client is still sending
+  int rcvbuf = 1 << 20;
+  for (const auto &udp_socket : {*engine_socket, *client}) {
+    setsockopt(udp_socket.fd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+               sizeof(rcvbuf));
+  }
+  timeval timeout{1, 0};
+  setsockopt(client->fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+             sizeof(timeout));
+
+  IOEngineOptions options;
+  options.type = IOEngineType::kIoUring;
+  // less than a window, a window is received by several `Recv`
+  options.batch_size = 8;
+  options.max_packet_size = 64;
+  std::shared_ptr<IoUringIOEngine> engine =
+      IoUringIOEngine::Create(*engine_socket, options);
+  if (!engine) {
+    printf("io_uring is not available, skipped\n");
+    return true;
+  }
+
+  // the echo thread sends every datagram back until `kTotal` are echoed.
+  // it is left blocked in `Recv` if the test fails, and shares its state
+  struct State {
+    std::atomic<int> echoed = 0;
+    std::atomic<bool> burst_sent = false;
+    std::atomic<bool> failed = false;
+  };
+  auto state = std::make_shared<State>();
+  std::thread echo([engine, state, client_addr]() {
+    while (state->echoed < kTotal) {
+      while (state->echoed == kRounds * kWindow && !state->burst_sent) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      auto datagrams = engine->Recv();
+      if (!datagrams) {
+        state->failed = true;
+        return;
+      }
+      for (const Datagram &datagram : *datagrams) {
+        if (!(datagram.addr == client_addr)) {
+          state->failed = true;
+        }
+        engine->Send(std::span(&datagram, 1));
+        state->echoed++;
+      }
+    }
+  });
+  auto fail = [&](const char *what, int round) {
+    printf("round %d: %s, %d echoed\n", round, what, state->echoed.load());
+    echo.detach();
+    return false;
+  };
+
+  // dropped for being longer than `max_packet_size`, its buffer is
+  // handed back at once
+  std::vector<uint8_t> too_long(options.max_packet_size + 1, 0xff);
+  client->SendTo(too_long, engine_addr);
+
+  std::vector<uint8_t> reply(2048);
+  for (int round = 0; round <= kRounds; round++) {
+    int count = round < kRounds ? kWindow : kBurst;
+    // datagrams of 4 to 35 bytes, numbered by their first bytes
+    std::vector<std::vector<uint8_t>> sent;
+    for (int i = 0; i < count; i++) {
+      std::vector<uint8_t> payload(4 + i % 32, uint8_t(i));
+      payload[0] = round;
+      payload[1] = i >> 8;
+      payload[2] = i;
+      client->SendTo(payload, engine_addr);
+      sent.push_back(std::move(payload));
+    }
+    state->burst_sent = round == kRounds;
+    std::vector<std::vector<uint8_t>> received;
+    for (int i = 0; i < count; i++) {
+      // `RecvFrom` does not report the timeout
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      ssize_t n = recvfrom(client->fd(), reply.data(), reply.size(), 0,
+                           reinterpret_cast<struct sockaddr *>(&from),
+                           &from_len);
+      if (n < 0) {
+        return fail("echo missing", round);
+      }
+      if (!(from_sockaddr_in(from) == engine_addr)) {
+        return fail("echo from another address", round);
+      }
+      received.emplace_back(reply.begin(), reply.begin() + n);
+    }
+    std::sort(sent.begin(), sent.end());
+    std::sort(received.begin(), received.end());
+    if (sent != received) {
+      return fail("echoes differ from the datagrams sent", round);
+    }
+  }
+  echo.join();
+  if (state->failed) {
+    printf("recv failed or a datagram from another address\n");
+    return false;
+  }
+  if (engine->truncated_count() != 1) {
+    printf("%llu datagram(s) truncated, 1 expected\n",
+           static_cast<unsigned long long>(engine->truncated_count()));
+    return false;
+  }
+  return true;
+}
+
+} // namespace base
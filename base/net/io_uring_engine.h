@@ -0,0 +1,123 @@
+#ifndef BASE_NET_IO_URING_ENGINE_H_
+#define BASE_NET_IO_URING_ENGINE_H_
+
+#include "base/net/io_engine.h"
+#include "base/net/udp_socket.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace base {
+
+/*
+  `IoUringIOEngine` talks to io_uring through raw syscalls.
+
+  Receiving: a single multishot IORING_OP_RECVMSG is kept armed on the
+  socket. The kernel picks receive buffers from a provided buffer ring, and
+  `Recv` reaps the completions in batches. Buffers are put back to the ring
+  on the next `Recv`, nothing is allocated per packet.
+
+  Sending: every datagram is copied into a preallocated send slot and
+  submitted as IORING_OP_SENDMSG. Slots are recycled by `Recv` when their
+  completions are reaped. If no slot is free, the datagram is sent with a
+  plain sendto instead.
+
+  Requires linux 6.0+ (multishot recvmsg, provided buffer rings).
+*/
+class IoUringIOEngine : public IOEngine {
+public:
+  // returns nullptr if io_uring is not available
+  static std::unique_ptr<IoUringIOEngine>
+  Create(UDPSocket udp_socket, const IOEngineOptions &options);
+
+  ~IoUringIOEngine() override;
+
+  std::optional<std::span<Datagram>> Recv() override;
+
+  std::optional<int> Send(std::span<const Datagram> datagrams) override;
+
+  IOEngineType type() const override { return IOEngineType::kIoUring; }
+
+  IoUringIOEngine(const IoUringIOEngine &) = delete;
+  IoUringIOEngine &operator=(const IoUringIOEngine &) = delete;
+
+private:
+  IoUringIOEngine(UDPSocket udp_socket, const IOEngineOptions &options);
+
+  bool SetupRing();
+  bool SetupBufferRing();
+
+  // the caller must hold `mutex_`
+  struct io_uring_sqe *GetSqe();
+  void SubmitPending();
+  void ArmRecv();
+
+  void RecycleBuffer(uint16_t bid);
+
+  struct SendSlot {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in addr;
+  };
+
+private:
+  UDPSocket udp_socket_;
+  IOEngineOptions options_;
+
+  int ring_fd_ = -1;
+  void *sq_ring_ptr_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void *cq_ring_ptr_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  struct io_uring_cqe *cqes_ = nullptr;
+  // SQEs written but not submitted yet
+  unsigned to_submit_ = 0;
+
+  // provided buffer ring for receiving
+  struct io_uring_buf_ring *buf_ring_ = nullptr;
+  size_t buf_ring_size_ = 0;
+  unsigned buf_ring_entries_ = 0;
+  uint16_t buf_ring_tail_ = 0;
+  size_t recv_buffer_size_ = 0;
+  std::vector<uint8_t> recv_buffers_;
+  struct msghdr recv_msg_;
+  bool recv_armed_ = false;
+
+  // buffers returned by the last `Recv`
+  std::vector<Datagram> datagrams_;
+  std::vector<uint16_t> bids_in_use_;
+
+  std::vector<SendSlot> send_slots_;
+  std::vector<uint8_t> send_buffers_;
+  std::vector<uint32_t> free_send_slots_;
+
+  // protects the submission queue and `free_send_slots_`, the completion
+  // queue and the buffer ring are only touched by the thread calling `Recv`
+  std::mutex mutex_;
+};
+
+// echoes datagrams over loopback with an `IoUringIOEngine`, more of them
+// than its ring has buffers. skipped if io_uring is not available
+bool TestIoUringLoopback();
+
+} // namespace base
+
+#endif
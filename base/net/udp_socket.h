@@ -4,6 +4,7 @@
 #include <array>
 #include <cstdint>
 #include <cstdio>
+#include <netinet/in.h>
 #include <optional>
 #include <span>
 #include <string>
@@ -13,9 +14,11 @@ namespace base {
 
 struct IPv4Addr {
   std::array<uint8_t, 4> octets;
+  bool operator==(const IPv4Addr &) const = default;
 };
 
 struct SocketAddrV4 {
+  SocketAddrV4() : ip{}, port(0) {}
   // TODO(lingsong.feng): use string_view
   SocketAddrV4(const char* s) : SocketAddrV4(std::string(s)) {
   }
@@ -26,22 +29,37 @@ struct SocketAddrV4 {
   }
   IPv4Addr ip;
   std::uint16_t port;
+  bool operator==(const SocketAddrV4 &) const = default;
 };
 
 struct IPv6Addr {
   std::array<std::uint8_t, 16> octets;
+  bool operator==(const IPv6Addr &) const = default;
 };
 
 struct SocketAddrV6 {
   IPv6Addr ip;
   std::uint16_t port;
+  bool operator==(const SocketAddrV6 &) const = default;
 };
 
 // TODO
 struct SocketAddr {
+  SocketAddr() : addr(SocketAddrV4()) {}
   SocketAddr(SocketAddrV4 v4) : addr(v4) {}
   //SocketAddr(SocketAddrV6 v6) : addr(v6) {}
   std::variant<SocketAddrV4, SocketAddrV6> addr;
+  bool operator==(const SocketAddr &) const = default;
+};
+
+// one datagram of a batched receive or send.
+// `buffer` is not owned. For receiving, `buffer` is the space to fill and
+// `length` is set to the number of bytes received; for sending, the first
+// `length` bytes of `buffer` are sent to `addr`.
+struct Datagram {
+  std::span<uint8_t> buffer;
+  std::uint64_t length = 0;
+  SocketAddr addr;
 };
 
 // thread safe because the class only holds a fd
@@ -51,12 +69,34 @@ private:
   UDPSocket();
 
 public:
-  static std::optional<UDPSocket> Bind(SocketAddr addr);
+  // upper bound of datagrams handled by one RecvMany/SendMany syscall
+  static constexpr const int kMaxBatchSize = 64;
+
+  // with `reuse_port` set, the socket is created with SO_REUSEPORT, so that
+  // several sockets can be bound to the same address and the kernel spreads
+  // incoming flows among them
+  static std::optional<UDPSocket> Bind(SocketAddr addr,
+                                       bool reuse_port = false);
 
   std::optional<std::pair<std::uint64_t, SocketAddr>> RecvFrom(std::span<uint8_t> buffer);
 
   std::optional<uint64_t> SendTo(std::span<uint8_t> buffer, const SocketAddr& addr);
 
+  // blocks until at least one datagram arrives, then receives as many queued
+  // datagrams as possible (up to `datagrams.size()` and `kMaxBatchSize`)
+  // with a single recvmmsg syscall. datagrams longer than their buffer are
+  // dropped and added to `*truncated`, if given.
+  // returns the number of filled entries at the front of `datagrams`, which
+  // may be 0 if every datagram was dropped
+  std::optional<int> RecvMany(std::span<Datagram> datagrams,
+                              uint64_t *truncated = nullptr);
+
+  // sends `datagrams` with as few sendmmsg syscalls as possible.
+  // returns the number of datagrams sent.
+  std::optional<int> SendMany(std::span<const Datagram> datagrams);
+
+  int fd() const { return socket_fd_; }
+
 private:
   int socket_fd_;
 };
@@ -65,6 +105,20 @@ std::string to_string(const IPv4Addr &addr);
 
 std::string to_string(const SocketAddr& addr);
 
+// parses "a.b.c.d:port". returns nullopt unless the address is a dotted quad
+// and the port is in [1, 65535]
+std::optional<SocketAddr> socket_addr_from_string(const std::string &s);
+
+struct sockaddr_in to_sockaddr_in(const SocketAddr &addr);
+
+SocketAddr from_sockaddr_in(const struct sockaddr_in &addr);
+
+bool TestSocketAddrFromString();
+
+// sends and receives datagrams over loopback one syscall per datagram, then
+// with sendmmsg/recvmmsg, and prints the packets per second of both
+void BenchDatagramIO();
+
 } // namespace base
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,102 @@
+#ifndef BASE_THREADING_TIMER_WHEEL_H_
+#define BASE_THREADING_TIMER_WHEEL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace base {
+
+/*
+  `TimerWheel` is a hashed timing wheel holding a large number of deadlines.
+  Time is cut into ticks, and a deadline is put into the slot of its tick,
+  so `Add` is O(1) no matter how many timers are pending. Timers fire at
+  most one tick late. `Advance` visits
+  only the slots of the ticks elapsed since the last call. Deadlines further
+  than one revolution of the wheel stay in their slot until their own
+  revolution comes.
+
+  Timers can not be cancelled, the owner is expected to ignore the values of
+  timers which became obsolete.
+
+  not thread safe
+
+  example:
+
+    base::TimerWheel<int> wheel(std::chrono::milliseconds(10), 256);
+    wheel.Add(std::chrono::steady_clock::now() + 1s, 42);
+    ...
+    for (int value : wheel.Advance(std::chrono::steady_clock::now())) {
+      ...
+    }
+
+*/
+template <class T> class TimerWheel {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TimerWheel(Clock::duration tick, size_t slots)
+      : tick_(tick), slots_(slots), start_(Clock::now()) {}
+
+  void Add(Clock::time_point deadline, T value) {
+    // a deadline is rounded up to the end of its tick, so that every timer
+    // of the current revolution has expired when its slot is visited. an
+    // expired deadline fires on the next `Advance`
+    int64_t tick = std::max(TickOf(deadline) + 1, current_tick_ + 1);
+    slots_[tick % slots_.size()].push_back({deadline, std::move(value)});
+    size_++;
+  }
+
+  // returns the values of every timer expired at `now`
+  std::vector<T> Advance(Clock::time_point now) {
+    std::vector<T> expired;
+    int64_t now_tick = TickOf(now);
+    // no need to go around the wheel more than once
+    int64_t from = std::max(current_tick_ + 1,
+                            now_tick - static_cast<int64_t>(slots_.size()) + 1);
+    for (int64_t tick = from; tick <= now_tick; tick++) {
+      auto &slot = slots_[tick % slots_.size()];
+      for (size_t i = 0; i < slot.size();) {
+        if (slot[i].deadline <= now) {
+          expired.push_back(std::move(slot[i].value));
+          slot[i] = std::move(slot.back());
+          slot.pop_back();
+          size_--;
+        } else {
+          i++;
+        }
+      }
+    }
+    current_tick_ = std::max(current_tick_, now_tick);
+    return expired;
+  }
+
+  size_t size() const { return size_; }
+
+private:
+  struct Entry {
+    Clock::time_point deadline;
+    T value;
+  };
+
+  int64_t TickOf(Clock::time_point time) const {
+    if (time <= start_) {
+      return 0;
+    }
+    return (time - start_) / tick_;
+  }
+
+private:
+  const Clock::duration tick_;
+  std::vector<std::vector<Entry>> slots_;
+  const Clock::time_point start_;
+  int64_t current_tick_ = 0;
+  size_t size_ = 0;
+};
+
+} // namespace base
+
+#endif
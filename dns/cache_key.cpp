@@ -0,0 +1,80 @@
+#include "dns/cache_key.h"
+#include "base/hash.h"
+#include "dns/dns_packet.h"
+#include "dns/name_kernels.h"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+namespace {
+
+// the size of the uncompressed name at the start of `bytes`, or nullopt if
+// there is none. compression pointers never appear in the question of a
+// query, nor in names uncompressed by `read_uncompressed_name`
+std::optional<size_t> name_size_of(std::span<const uint8_t> bytes) {
+  if (size_t name_size = wire_name_size(bytes)) {
+    return name_size;
+  }
+  return {};
+}
+
+} // namespace
+
+CacheKey::CacheKey(std::span<const uint8_t> name, uint16_t qtype,
+                   uint16_t qclass)
+    : qtype_(qtype), qclass_(qclass), size_(name.size()) {
+  uint8_t *dst = inline_.data();
+  if (name.size() > kInlineSize) {
+    heap_.resize(name.size());
+    dst = heap_.data();
+  }
+  lowercase_name(name.data(), name.size(), dst);
+  hash_ = hash_name(dst, size_) ^
+          base::mix_u64(uint64_t(qtype_) << 16 | qclass_);
+}
+
+std::optional<CacheKey>
+CacheKey::FromQuestion(std::span<const uint8_t> question) {
+  auto name_size = name_size_of(question);
+  if (!name_size || *name_size + 4 != question.size()) {
+    return {};
+  }
+  return CacheKey(question.first(*name_size),
+                  read_u16_from_net(question.data() + *name_size),
+                  read_u16_from_net(question.data() + *name_size + 2));
+}
+
+std::optional<CacheKey>
+CacheKey::FromQuestionAt(std::span<const uint8_t> message, size_t offset,
+                         size_t *question_end) {
+  if (offset > message.size()) {
+    return {};
+  }
+  auto question = message.subspan(offset);
+  // only the length bytes are read to find the end of the name, which is
+  // then lowercased at once
+  auto name_size = name_size_of(question);
+  if (!name_size || question.size() - *name_size < 4) {
+    return {};
+  }
+  *question_end = offset + *name_size + 4;
+  return CacheKey(question.first(*name_size),
+                  read_u16_from_net(question.data() + *name_size),
+                  read_u16_from_net(question.data() + *name_size + 2));
+}
+
+std::optional<CacheKey> CacheKey::FromName(std::span<const uint8_t> name,
+                                           uint16_t qtype, uint16_t qclass) {
+  auto name_size = name_size_of(name);
+  if (!name_size || *name_size != name.size()) {
+    return {};
+  }
+  return CacheKey(name, qtype, qclass);
+}
+
+bool CacheKey::operator==(const CacheKey &other) const {
+  return hash_ == other.hash_ && qtype_ == other.qtype_ &&
+         qclass_ == other.qclass_ && size_ == other.size_ &&
+         memcmp(name().data(), other.name().data(), size_) == 0;
+}
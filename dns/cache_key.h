@@ -0,0 +1,73 @@
+#ifndef DNS_CACHE_KEY_H_
+#define DNS_CACHE_KEY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*
+  `CacheKey` is the canonical form of a question: the name in wire format
+  with ASCII letters lowercased, the qtype and the qclass, plus a hash
+  computed once. Names differing only in case map to the same key. Names
+  up to `kInlineSize` bytes are stored inline, so creating and copying the
+  key of a common name does not allocate.
+
+  example:
+
+    if (auto key = CacheKey::FromQuestion(packet.raw_questions)) {
+      dns_cache->query(*key, answer);
+    }
+
+*/
+class CacheKey {
+public:
+  static constexpr const size_t kInlineSize = 48;
+
+  // `question` must be exactly one uncompressed question, as in queries.
+  // returns nullopt otherwise
+  static std::optional<CacheKey> FromQuestion(std::span<const uint8_t> question);
+  // reads the question at `offset` of `message`, and sets `*question_end`
+  // to the offset past it. returns nullopt if the name is compressed,
+  // malformed or truncated
+  static std::optional<CacheKey>
+  FromQuestionAt(std::span<const uint8_t> message, size_t offset,
+                 size_t *question_end);
+  // `name` must be exactly one uncompressed name in wire format.
+  // returns nullopt otherwise
+  static std::optional<CacheKey> FromName(std::span<const uint8_t> name,
+                                          uint16_t qtype, uint16_t qclass);
+
+  // an empty key, no question maps to it
+  CacheKey() = default;
+
+  std::span<const uint8_t> name() const {
+    return {heap_.empty() ? inline_.data() : heap_.data(), size_};
+  }
+  uint16_t qtype() const { return qtype_; }
+  uint16_t qclass() const { return qclass_; }
+  uint64_t hash() const { return hash_; }
+
+  bool operator==(const CacheKey &other) const;
+
+  struct Hash {
+    size_t operator()(const CacheKey &key) const { return key.hash(); }
+  };
+
+private:
+  CacheKey(std::span<const uint8_t> name, uint16_t qtype, uint16_t qclass);
+
+private:
+  uint64_t hash_ = 0;
+  uint16_t qtype_ = 0;
+  uint16_t qclass_ = 0;
+  uint16_t size_ = 0;
+  std::array<uint8_t, kInlineSize> inline_ = {};
+  // only used by names longer than `kInlineSize`
+  std::vector<uint8_t> heap_;
+};
+
+#endif
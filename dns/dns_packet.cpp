@@ -7,7 +7,6 @@
 #include <span>
 #include <string>
 #include <vector>
-#include <arpa/inet.h>
 
 // TODO(lingsong.feng): bit order is not well organized, which will be optimized
 // in the future
@@ -15,8 +14,8 @@
 inline uint16_t net_u8_to_u16(uint8_t u8_0, uint8_t u8_1) {
   return (u8_0 << 8) | u8_1;
 }
-inline uint16_t net_u8_to_u32(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
-  return (a << 24) | (b << 16) | (c << 8) | d;
+inline uint32_t net_u8_to_u32(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  return (uint32_t(a) << 24) | (b << 16) | (c << 8) | d;
 }
 
 [[nodiscard("result should be used")]] inline std::optional<uint8_t>
@@ -71,10 +70,7 @@ consume_n_u8_to_string(const uint8_t **data, uint32_t *len, uint32_t n) {
   if (*len < n) {
     return {};
   }
-  std::string ret;
-  for (uint32_t i = 0; i < n; i++) {
-    ret.push_back(static_cast<char>((*data)[i]));
-  }
+  std::string ret(reinterpret_cast<const char *>(*data), n);
   (*data) += n;
   (*len) -= n;
   return ret;
@@ -439,9 +435,7 @@ std::optional<DNSPacket> ParseDNSRawPacket(const uint8_t *data, uint32_t len) {
     }
   }
   const uint8_t *end_pos = data;
-  for (const uint8_t *pos = start_pos; pos < end_pos; pos++) {
-    packet.raw_questions.push_back(*pos);
-  }
+  packet.raw_questions.assign(start_pos, end_pos);
 
   start_pos = data;
   for (int i = 0; i < ancount; i++) {
@@ -453,14 +447,18 @@ std::optional<DNSPacket> ParseDNSRawPacket(const uint8_t *data, uint32_t len) {
     }
   }
   end_pos = data;
-  for (const uint8_t *pos = start_pos; pos < end_pos; pos++) {
-    packet.raw_answers.push_back(*pos);
-  }
+  packet.raw_answers.assign(start_pos, end_pos);
 
-  // TODO(lingsong.feng): parse data
   for (int i = 0; i < nscount; i++) {
-    packet.authority_records.emplace_back();
+    if (auto opt_record =
+            ParseDNSRawAnswer(&data, &len, packet_begin, packet_len)) {
+      packet.authority_records.emplace_back(std::move(*opt_record));
+    } else {
+      return {};
+    }
   }
+
+  // TODO(lingsong.feng): parse data
   for (int i = 0; i < arcount; i++) {
     packet.additional_records.emplace_back();
   }
@@ -469,23 +467,13 @@ std::optional<DNSPacket> ParseDNSRawPacket(const uint8_t *data, uint32_t len) {
 }
 
 void append_u16_to_net(std::vector<uint8_t> &v, uint16_t val) {
-  uint16_t net_val = htons(val);
-  v.push_back(0);
-  v.push_back(0);
-  int idx = v.size() - 2;
-  uint16_t *ptr = reinterpret_cast<uint16_t *>(&v[idx]);
-  *ptr = net_val;
+  v.resize(v.size() + 2);
+  write_u16_to_net(v.data() + v.size() - 2, val);
 }
 
 void append_u32_to_net(std::vector<uint8_t> &v, uint32_t val) {
-  uint32_t net_val = htonl(val);
-  v.push_back(0);
-  v.push_back(0);
-  v.push_back(0);
-  v.push_back(0);
-  int idx = v.size() - 4;
-  uint32_t *ptr = reinterpret_cast<uint32_t *>(&v[idx]);
-  *ptr = net_val;
+  v.resize(v.size() + 4);
+  write_u32_to_net(v.data() + v.size() - 4, val);
 }
 
 void append_bytes(std::vector<uint8_t> &v, std::span<const uint8_t> data) {
@@ -542,6 +530,15 @@ std::vector<uint8_t> GenerateDNSRawPacket(const DNSPacket &packet) {
     append_bytes(ret, std::span(ans.rdata.begin(), ans.rdata.size()));
   }
 
+  for (const dns_authority_record &rr : packet.authority_records) {
+    append_dns_name(ret, rr.name);
+    append_u16_to_net(ret, rr.type);
+    append_u16_to_net(ret, rr.ans_class);
+    append_u32_to_net(ret, rr.ttl);
+    append_u16_to_net(ret, rr.get_rdlength());
+    append_bytes(ret, std::span(rr.rdata.begin(), rr.rdata.size()));
+  }
+
   return ret;
 }
 
@@ -570,6 +567,21 @@ void TestParsePacket() {
   }
 }
 
+void decrement_ttls(uint8_t *records, std::span<const uint16_t> ttl_offsets,
+                    uint32_t seconds) {
+  for (uint16_t offset : ttl_offsets) {
+    uint32_t ttl = read_u32_from_net(records + offset);
+    write_u32_to_net(records + offset, ttl > seconds ? ttl - seconds : 0);
+  }
+}
+
+void set_ttls(uint8_t *records, std::span<const uint16_t> ttl_offsets,
+              uint32_t ttl) {
+  for (uint16_t offset : ttl_offsets) {
+    write_u32_to_net(records + offset, ttl);
+  }
+}
+
 void PrintDNSPacket(const DNSPacket &packet) {
   printf("id:0x%04hx\n", packet.header.id);
   printf("qr:%hhu opcode:%hhu aa:%hhu tc:%hhu rd:%hhu ra:%hhu z:%hhu "
@@ -598,21 +610,16 @@ void PrintDNSPacket(const DNSPacket &packet) {
   printf("\n");
 }
 
-std::vector<uint8_t> generate_dns_raw_from_raw_parts(
-    const dns_header &header, const std::vector<uint8_t> &questions,
-    const std::vector<uint8_t> &answers, int qdcount, int ancount) {
-  std::vector<uint8_t> ret;
-  append_u16_to_net(ret, header.id);
-  append_u16_to_net(ret, header.flag.to_host());
-  append_u16_to_net(ret, qdcount);
-  append_u16_to_net(ret, ancount);
-  append_u16_to_net(ret, 0);
-  append_u16_to_net(ret, 0);
-  for (uint8_t byte : questions) {
-    ret.push_back(byte);
-  }
-  for (uint8_t byte : answers) {
-    ret.push_back(byte);
+std::optional<uint32_t> negative_ttl(const DNSPacket &packet) {
+  for (const dns_authority_record &rr : packet.authority_records) {
+    // MNAME and RNAME, at least one byte each, then SERIAL, REFRESH, RETRY,
+    // EXPIRE and MINIMUM. MINIMUM ends the record whether the names are
+    // compressed or not
+    if (rr.type != kTypeSOA || rr.rdata.size() < 22) {
+      continue;
+    }
+    uint32_t minimum = read_u32_from_net(rr.rdata.data() + rr.rdata.size() - 4);
+    return std::min(rr.ttl, minimum);
   }
-  return ret;
+  return {};
 }
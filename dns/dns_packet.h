@@ -6,9 +6,25 @@
 #include <limits>
 #include <string>
 #include <optional>
+#include <span>
+#include <vector>
 
+// the question section starts right after the header
+constexpr const size_t kHeaderSize = 12;
 constexpr const uint16_t kStandardQuery = 0x0100;
 constexpr const uint16_t kStandardResponse = 0x8180;
+constexpr const uint16_t kRcodeServFail = 2;
+constexpr const uint16_t kRcodeNxDomain = 3;
+constexpr const uint16_t kTypeNS = 2;
+constexpr const uint16_t kTypeCNAME = 5;
+constexpr const uint16_t kTypeSOA = 6;
+constexpr const uint16_t kTypePTR = 12;
+constexpr const uint16_t kTypeMX = 15;
+constexpr const uint16_t kTypeANY = 255;
+constexpr const uint16_t kTypeOPT = 41;
+// the largest UDP message without EDNS (RFC 1035 4.2.1), and the least
+// payload size an EDNS requestor may advertise (RFC 6891 6.2.5)
+constexpr const uint16_t kMinUDPPayloadSize = 512;
 
 struct dns_flag {
   // second byte
@@ -52,7 +68,8 @@ struct dns_answer {
   inline uint16_t get_rdlength() const { return rdata.size(); }
 };
 
-struct dns_authority_record {};
+// resource records of the authority section have the layout of answers
+using dns_authority_record = dns_answer;
 struct dns_additional_record {};
 
 class DNSPacket {
@@ -70,12 +87,53 @@ public:
   uint16_t get_arcount() const { return additional_records.size(); }
 };
 
+// writes `val` to `dst` in network byte order, `dst` may be unaligned
+inline void write_u16_to_net(uint8_t *dst, uint16_t val) {
+  dst[0] = static_cast<uint8_t>(val >> 8);
+  dst[1] = static_cast<uint8_t>(val & 0xff);
+}
+
+// reads a u16 in network byte order from `src`, `src` may be unaligned
+inline uint16_t read_u16_from_net(const uint8_t *src) {
+  return static_cast<uint16_t>(src[0] << 8 | src[1]);
+}
+
+inline void write_u32_to_net(uint8_t *dst, uint32_t val) {
+  write_u16_to_net(dst, val >> 16);
+  write_u16_to_net(dst + 2, val & 0xffff);
+}
+
+inline uint32_t read_u32_from_net(const uint8_t *src) {
+  return uint32_t(read_u16_from_net(src)) << 16 | read_u16_from_net(src + 2);
+}
+
+inline void write_u64_to_net(uint8_t *dst, uint64_t val) {
+  write_u32_to_net(dst, val >> 32);
+  write_u32_to_net(dst + 4, val & 0xffffffff);
+}
+
+inline uint64_t read_u64_from_net(const uint8_t *src) {
+  return uint64_t(read_u32_from_net(src)) << 32 | read_u32_from_net(src + 4);
+}
+
 std::optional<DNSPacket> ParseDNSRawPacket(const uint8_t *data, uint32_t len);
 
-[[deprecated("use from raw parts")]]
+[[deprecated("use ResponseWriter")]]
 std::vector<uint8_t> GenerateDNSRawPacket(const DNSPacket &packet);
 
-std::vector<uint8_t> generate_dns_raw_from_raw_parts(const dns_header& header, const std::vector<uint8_t>& questions, const std::vector<uint8_t>& answers, int qdcount, int ancount);
+// the TTL of a negative answer (NXDOMAIN or NODATA) per RFC 2308: the
+// lesser of the TTL and the MINIMUM field of the SOA record of the
+// authority section. negative answers without SOA are not to be cached
+std::optional<uint32_t> negative_ttl(const DNSPacket &packet);
+
+// subtracts `seconds` from the TTL fields found at `ttl_offsets` of
+// `records`, TTLs do not go below 0
+void decrement_ttls(uint8_t *records, std::span<const uint16_t> ttl_offsets,
+                    uint32_t seconds);
+
+// overwrites the TTL fields found at `ttl_offsets` of `records` with `ttl`
+void set_ttls(uint8_t *records, std::span<const uint16_t> ttl_offsets,
+              uint32_t ttl);
 
 void PrintDNSPacket(const DNSPacket &packet);
 
@@ -0,0 +1,389 @@
+#include "dns/dns_packet_view.h"
+#include "base/memory/allocation_counter.h"
+#include "dns/cache_key.h"
+#include "dns/dns_packet.h"
+#include "dns/query_classifier.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace {
+
+// including the length bytes and the root label
+constexpr const size_t kMaxNameSize = 255;
+// a name of 255 bytes has at most 127 labels, each reached by at most one
+// pointer. pointers only go back, this bounds the hops all the same
+constexpr const int kMaxPointers = 127;
+// type, class, TTL and RDLENGTH
+constexpr const size_t kRecordFieldsSize = 10;
+
+// checks the name at `*pos` of `message` and moves `*pos` past it
+bool skip_name(std::span<const uint8_t> message, size_t *pos) {
+  size_t p = *pos;
+  size_t name_size = 0;
+  bool jumped = false;
+  for (int pointers = 0; pointers <= kMaxPointers;) {
+    if (p >= message.size()) {
+      return false;
+    }
+    uint8_t label_size = message[p];
+    if ((label_size & 0xc0) == 0xc0) {
+      if (p + 1 >= message.size()) {
+        return false;
+      }
+      // a pointer only goes back to a prior name (RFC 1035 4.1.4), so that
+      // names cannot loop
+      size_t target = read_u16_from_net(message.data() + p) & 0x3fff;
+      if (target >= p) {
+        return false;
+      }
+      if (!jumped) {
+        *pos = p + 2;
+        jumped = true;
+      }
+      p = target;
+      pointers++;
+      continue;
+    }
+    // the extended label types are obsolete
+    if (label_size & 0xc0) {
+      return false;
+    }
+    name_size += 1 + label_size;
+    p += 1 + label_size;
+    if (p > message.size() || name_size > kMaxNameSize) {
+      return false;
+    }
+    if (label_size == 0) {
+      if (!jumped) {
+        *pos = p;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// the end of the name at `pos`, which has been checked
+const uint8_t *name_end(const uint8_t *pos) {
+  while (*pos != 0) {
+    if ((*pos & 0xc0) == 0xc0) {
+      return pos + 2;
+    }
+    pos += 1 + *pos;
+  }
+  return pos + 1;
+}
+
+} // namespace
+
+size_t DNSNameView::size() const {
+  size_t size = 1;
+  for (std::span<const uint8_t> label : *this) {
+    size += 1 + label.size();
+  }
+  return size;
+}
+
+void DNSNameView::AppendTo(std::vector<uint8_t> &out) const {
+  for (std::span<const uint8_t> label : *this) {
+    out.push_back(label.size());
+    out.insert(out.end(), label.begin(), label.end());
+  }
+  out.push_back(0);
+}
+
+// static
+const uint8_t *DNSPacketView::Question::Read(const uint8_t *message,
+                                             const uint8_t *pos,
+                                             Question *out) {
+  out->name = DNSNameView(message, pos);
+  pos = name_end(pos);
+  out->qtype = read_u16_from_net(pos);
+  out->qclass = read_u16_from_net(pos + 2);
+  return pos + 4;
+}
+
+// static
+const uint8_t *DNSPacketView::Record::Read(const uint8_t *message,
+                                           const uint8_t *pos, Record *out) {
+  out->name = DNSNameView(message, pos);
+  pos = name_end(pos);
+  out->type = read_u16_from_net(pos);
+  out->rr_class = read_u16_from_net(pos + 2);
+  out->ttl = read_u32_from_net(pos + 4);
+  out->ttl_offset = pos + 4 - message;
+  out->rdata = {pos + kRecordFieldsSize, read_u16_from_net(pos + 8)};
+  return out->rdata.data() + out->rdata.size();
+}
+
+// static
+std::optional<DNSPacketView>
+DNSPacketView::Parse(std::span<const uint8_t> message) {
+  if (message.size() < kHeaderSize) {
+    return {};
+  }
+  DNSPacketView view(message);
+  size_t pos = kHeaderSize;
+  view.offsets_[0] = pos;
+  for (int i = 0; i < view.get_qdcount(); i++) {
+    if (!skip_name(message, &pos) || message.size() - pos < 4) {
+      return {};
+    }
+    pos += 4;
+  }
+  for (int section = 1; section < 4; section++) {
+    view.offsets_[section] = pos;
+    for (int i = 0; i < view.Count(section); i++) {
+      if (!skip_name(message, &pos) ||
+          message.size() - pos < kRecordFieldsSize) {
+        return {};
+      }
+      size_t rdlength = read_u16_from_net(message.data() + pos + 8);
+      pos += kRecordFieldsSize;
+      if (message.size() - pos < rdlength) {
+        return {};
+      }
+      pos += rdlength;
+    }
+  }
+  view.offsets_[4] = pos;
+  return view;
+}
+
+dns_header DNSPacketView::header() const {
+  dns_header header;
+  header.id = id();
+  header.flag.from_host(read_u16_from_net(message_.data() + 2));
+  return header;
+}
+
+uint16_t DNSPacketView::udp_payload_size() const {
+  for (const Record &record : additional_records()) {
+    if (record.type == kTypeOPT) {
+      // the CLASS of OPT holds the payload size
+      return std::max(record.rr_class, kMinUDPPayloadSize);
+    }
+  }
+  return kMinUDPPayloadSize;
+}
+
+bool TestMalformedPackets() {
+  // www.example.test A, answered by a CNAME to cdn.example.test and its A
+  // record, the names compressed
+  const std::vector<uint8_t> response{
+      0x42, 0x42, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00,
+      0x00, 0x03, 'w',  'w',  'w',  0x07, 'e',  'x',  'a',  'm',  'p',
+      'l',  'e',  0x04, 't',  'e',  's',  't',  0x00, 0x00, 0x01, 0x00,
+      0x01, 0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c,
+      0x00, 0x06, 0x03, 'c',  'd',  'n',  0xc0, 0x10, 0xc0, 0x2e, 0x00,
+      0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 192,  0,
+      2,    1};
+  // a header of one question, followed by `name`, type A and class IN
+  auto query = [](std::vector<uint8_t> name) {
+    std::vector<uint8_t> message{0x42, 0x42, 0x01, 0x00, 0x00, 0x01,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    message.insert(message.end(), name.begin(), name.end());
+    message.insert(message.end(), {0x00, 0x01, 0x00, 0x01});
+    return message;
+  };
+  // `labels` labels of `size` bytes, then the root
+  auto long_name = [](int labels, uint8_t size) {
+    std::vector<uint8_t> name;
+    for (int i = 0; i < labels; i++) {
+      name.push_back(size);
+      name.insert(name.end(), size, 'a');
+    }
+    name.push_back(0);
+    return name;
+  };
+  // `message` with the answer at offset 34 owned by `pointer`
+  auto answer_owner = [&](uint16_t pointer) {
+    std::vector<uint8_t> message = response;
+    write_u16_to_net(message.data() + 34, 0xc000 | pointer);
+    return message;
+  };
+
+  // the well-formed ones first, so that the malformed ones fail for the
+  // flaw they were made with
+  std::vector<uint8_t> longest = long_name(3, 63);
+  longest.insert(longest.end() - 1, {61});
+  longest.insert(longest.end() - 1, 61, 'a');
+  const std::pair<const char *, std::vector<uint8_t>> kWellFormed[] = {
+      {"the response", response},
+      {"a name of 255 bytes", query(longest)},
+  };
+  for (const auto &[name, message] : kWellFormed) {
+    auto view = DNSPacketView::Parse(message);
+    if (!view || view->message().size() != message.size()) {
+      printf("%s: not parsed\n", name);
+      return false;
+    }
+  }
+  if (auto view = DNSPacketView::Parse(response)) {
+    // every name of a parsed message can be walked
+    size_t labels = 0;
+    for (const auto &record : view->answers()) {
+      for (auto label : record.name) {
+        labels += !label.empty();
+      }
+    }
+    if (labels != 6) {
+      printf("%zu labels in the answers, 6 expected\n", labels);
+      return false;
+    }
+  }
+
+  std::vector<uint8_t> too_long = longest;
+  too_long[too_long.size() - 63] = 62;
+  too_long.insert(too_long.end() - 1, 'a');
+  std::vector<uint8_t> rdlength_past_end = response;
+  rdlength_past_end[rdlength_past_end.size() - 5] = 5;
+  std::vector<uint8_t> rdlength_max = response;
+  write_u16_to_net(rdlength_max.data() + rdlength_max.size() - 6, 0xffff);
+  std::vector<uint8_t> extra_answer = response;
+  extra_answer[7] = 3;
+  std::vector<uint8_t> label_past_end = query({0x03, 'w', 'w', 'w', 0x07});
+  label_past_end.resize(kHeaderSize + 8);
+  std::vector<uint8_t> pointer_past_end = query({0xc0, 0x0c});
+  pointer_past_end.resize(kHeaderSize + 1);
+  // the owners of the two answers pointing to each other
+  std::vector<uint8_t> loop = answer_owner(52);
+  write_u16_to_net(loop.data() + 52, 0xc000 | 34);
+  // answers owned by a label and a pointer to the owner before, the third
+  // one is 257 bytes long
+  std::vector<uint8_t> pointer_chain = query(long_name(1, 63));
+  write_u16_to_net(pointer_chain.data() + 6, 3);
+  uint16_t previous = kHeaderSize;
+  for (int i = 0; i < 3; i++) {
+    size_t owner = pointer_chain.size();
+    std::vector<uint8_t> label = long_name(1, 63);
+    label.pop_back();
+    pointer_chain.insert(pointer_chain.end(), label.begin(), label.end());
+    pointer_chain.insert(pointer_chain.end(),
+                         {uint8_t(0xc0 | previous >> 8), uint8_t(previous),
+                          0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+                          0x00, 0x00});
+    previous = owner;
+  }
+
+  const std::pair<const char *, std::vector<uint8_t>> kMalformed[] = {
+      {"an empty message", {}},
+      {"a label past the end", label_past_end},
+      {"a pointer past the end", pointer_past_end},
+      {"an extended label type", query({0x41, 'a', 0x00})},
+      {"a pointer to itself", query({0xc0, 0x0c})},
+      {"a pointer to the next byte", query({0xc0, 0x0d, 0x00})},
+      {"a pointer loop", loop},
+      {"a forward pointer", answer_owner(52 + 2)},
+      {"a pointer past the end of the message", answer_owner(0x3fff)},
+      {"a name of 256 bytes", query(too_long)},
+      {"a name of 5 labels of 63 bytes", query(long_name(5, 63))},
+      {"a name of 128 labels", query(long_name(128, 1))},
+      {"a name over 255 bytes through pointers", pointer_chain},
+      {"an rdlength past the end", rdlength_past_end},
+      {"an rdlength of 65535", rdlength_max},
+      {"an answer more than counted", extra_answer},
+  };
+  for (const auto &[name, message] : kMalformed) {
+    // copied to a buffer of its exact size, so that AddressSanitizer
+    // catches a read past it
+    auto copy = std::make_unique<uint8_t[]>(message.size());
+    std::copy(message.begin(), message.end(), copy.get());
+    if (DNSPacketView::Parse({copy.get(), message.size()})) {
+      printf("%s: parsed\n", name);
+      return false;
+    }
+  }
+  // the response cut anywhere, the header, a name, the fields or rdata
+  auto copy = std::make_unique<uint8_t[]>(response.size());
+  std::copy(response.begin(), response.end(), copy.get());
+  for (size_t size = 0; size < response.size(); size++) {
+    std::span<const uint8_t> cut(copy.get() + response.size() - size, size);
+    std::copy(response.begin(), response.begin() + size,
+              copy.get() + response.size() - size);
+    if (DNSPacketView::Parse(cut)) {
+      printf("the response cut to %zu bytes: parsed\n", size);
+      return false;
+    }
+  }
+  return true;
+}
+
+void BenchPacketParse() {
+  constexpr const int kIterations = 2000000;
+  // www.example.com A, with an EDNS OPT record of 4096 bytes
+  const std::vector<uint8_t> query{
+      0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x01, 0x03, 'w',  'w',  'w',  0x07, 'e',  'x',  'a',  'm',  'p',
+      'l',  'e',  0x03, 'c',  'o',  'm',  0x00, 0x00, 0x01, 0x00, 0x01,
+      0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  // www.sohu.com A, three CNAMEs then an A record
+  const std::vector<uint8_t> response{
+      0x77, 0x92, 0x81, 0x80, 0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00,
+      0x03, 0x77, 0x77, 0x77, 0x04, 0x73, 0x6f, 0x68, 0x75, 0x03, 0x63, 0x6f,
+      0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01,
+      0x00, 0x00, 0x02, 0xed, 0x00, 0x19, 0x03, 0x77, 0x77, 0x77, 0x04, 0x73,
+      0x6f, 0x68, 0x75, 0x03, 0x63, 0x6f, 0x6d, 0x03, 0x64, 0x73, 0x61, 0x05,
+      0x64, 0x6e, 0x73, 0x76, 0x31, 0xc0, 0x15, 0xc0, 0x2a, 0x00, 0x05, 0x00,
+      0x01, 0x00, 0x00, 0x00, 0x65, 0x00, 0x1d, 0x04, 0x62, 0x65, 0x73, 0x74,
+      0x05, 0x73, 0x63, 0x68, 0x65, 0x64, 0x05, 0x64, 0x30, 0x2d, 0x64, 0x6b,
+      0x07, 0x74, 0x64, 0x6e, 0x73, 0x64, 0x70, 0x31, 0x02, 0x63, 0x6e, 0x00,
+      0xc0, 0x4f, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x21, 0x00, 0x28,
+      0x04, 0x62, 0x65, 0x73, 0x74, 0x05, 0x35, 0x31, 0x2d, 0x36, 0x35, 0x03,
+      0x63, 0x6a, 0x74, 0x08, 0x73, 0x64, 0x79, 0x74, 0x75, 0x6e, 0x74, 0x78,
+      0x0a, 0x64, 0x69, 0x61, 0x6e, 0x73, 0x75, 0x2d, 0x63, 0x64, 0x6e, 0x03,
+      0x6e, 0x65, 0x74, 0x00, 0xc0, 0x78, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+      0x00, 0x2d, 0x00, 0x04, 0x7b, 0x7d, 0xf4, 0x6b};
+
+  // keeps the results alive, so that the parsing is not optimized out
+  volatile size_t sink = 0;
+  auto measure = [&](const char *name, auto parse) {
+    uint64_t allocations = base::GetThreadAllocationCount();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; i++) {
+      sink = sink + parse();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    allocations = base::GetThreadAllocationCount() - allocations;
+    printf("    %-32s %8.0f ns %6.1f allocs\n", name,
+           elapsed.count() / kIterations, double(allocations) / kIterations);
+  };
+
+  printf("parsing, %d iterations each\n", kIterations);
+  printf("  query, %zu bytes with an EDNS OPT record\n", query.size());
+  measure("ParseDNSRawPacket", [&]() -> size_t {
+    auto packet = ParseDNSRawPacket(query.data(), query.size());
+    return packet ? packet->questions.size() : 0;
+  });
+  measure("DNSPacketView::Parse", [&]() -> size_t {
+    auto view = DNSPacketView::Parse(query);
+    return view ? view->get_qdcount() : 0;
+  });
+  measure("... + CacheKey::FromQuestion", [&]() -> size_t {
+    auto view = DNSPacketView::Parse(query);
+    auto key = view ? CacheKey::FromQuestion(view->raw_questions())
+                    : std::nullopt;
+    return key ? key->qtype() : 0;
+  });
+  measure("classify_query", [&]() -> size_t {
+    auto classified = classify_query(query);
+    return classified ? classified->udp_payload_size : 0;
+  });
+  printf("  response, %zu bytes, three CNAMEs and an A\n", response.size());
+  measure("ParseDNSRawPacket", [&]() -> size_t {
+    auto packet = ParseDNSRawPacket(response.data(), response.size());
+    return packet ? packet->answers.size() : 0;
+  });
+  measure("DNSPacketView::Parse", [&]() -> size_t {
+    auto view = DNSPacketView::Parse(response);
+    return view ? view->get_ancount() : 0;
+  });
+}
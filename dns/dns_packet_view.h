@@ -0,0 +1,242 @@
+#ifndef DNS_DNS_PACKET_VIEW_H_
+#define DNS_DNS_PACKET_VIEW_H_
+
+#include "dns/dns_packet.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*
+  `DNSPacketView` reads a message in place, without copying it. `Parse`
+  checks the header, every name and the bounds of every record in one pass
+  and remembers where the sections start, so the accessors need no checks
+  of their own and never allocate. Names are read label by label, following
+  compression pointers. The view does not own the message, which must
+  outlive it.
+
+  example:
+
+    if (auto view = DNSPacketView::Parse(buffer.span())) {
+      auto key = CacheKey::FromQuestion(view->raw_questions());
+      for (const DNSPacketView::Record &record : view->answers()) {
+        for (std::span<const uint8_t> label : record.name) {
+          ...
+        }
+      }
+    }
+
+*/
+
+// a name of a message checked by `DNSPacketView::Parse`
+class DNSNameView {
+public:
+  // yields the labels of the name without their length byte, the root label
+  // excluded
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::span<const uint8_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+
+    Iterator() = default;
+    value_type operator*() const { return {pos_ + 1, *pos_}; }
+    Iterator &operator++() {
+      pos_ += 1 + *pos_;
+      Settle();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const Iterator &other) const { return pos_ == other.pos_; }
+
+  private:
+    friend class DNSNameView;
+    Iterator(const uint8_t *message, const uint8_t *pos)
+        : message_(message), pos_(pos) {
+      Settle();
+    }
+    // follows the pointers at `pos_`, the end is null
+    void Settle() {
+      while ((*pos_ & 0xc0) == 0xc0) {
+        pos_ = message_ + (read_u16_from_net(pos_) & 0x3fff);
+      }
+      if (*pos_ == 0) {
+        pos_ = nullptr;
+      }
+    }
+
+    const uint8_t *message_ = nullptr;
+    const uint8_t *pos_ = nullptr;
+  };
+
+  DNSNameView() = default;
+  DNSNameView(const uint8_t *message, const uint8_t *pos)
+      : message_(message), pos_(pos) {}
+
+  Iterator begin() const { return {message_, pos_}; }
+  Iterator end() const { return {}; }
+
+  // bytes of the name uncompressed, the root label included
+  size_t size() const;
+  // appends the name uncompressed, in wire format
+  void AppendTo(std::vector<uint8_t> &out) const;
+
+private:
+  const uint8_t *message_ = nullptr;
+  const uint8_t *pos_ = nullptr;
+};
+
+class DNSPacketView {
+public:
+  struct Question {
+    DNSNameView name;
+    uint16_t qtype;
+    uint16_t qclass;
+
+    // reads the question at `pos` into `out`, returns the end of it
+    static const uint8_t *Read(const uint8_t *message, const uint8_t *pos,
+                               Question *out);
+  };
+
+  struct Record {
+    DNSNameView name;
+    uint16_t type;
+    uint16_t rr_class;
+    uint32_t ttl;
+    std::span<const uint8_t> rdata;
+    // of the TTL field, from the start of the message
+    size_t ttl_offset;
+
+    // reads the record at `pos` into `out`, returns the end of it
+    static const uint8_t *Read(const uint8_t *message, const uint8_t *pos,
+                               Record *out);
+  };
+
+  // the questions or the records of one section, `T` is `Question` or
+  // `Record`
+  template <typename T> class Section {
+  public:
+    class Iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const T *;
+      using reference = const T &;
+
+      Iterator() = default;
+      const T &operator*() const { return item_; }
+      const T *operator->() const { return &item_; }
+      Iterator &operator++() {
+        if (--left_ > 0) {
+          next_ = T::Read(message_, next_, &item_);
+        }
+        return *this;
+      }
+      Iterator operator++(int) {
+        Iterator old = *this;
+        ++*this;
+        return old;
+      }
+      bool operator==(const Iterator &other) const {
+        return left_ == other.left_;
+      }
+
+    private:
+      friend class Section;
+      Iterator(const uint8_t *message, const uint8_t *pos, uint16_t count)
+          : message_(message), next_(pos), left_(count) {
+        if (left_ > 0) {
+          next_ = T::Read(message_, next_, &item_);
+        }
+      }
+
+      const uint8_t *message_ = nullptr;
+      const uint8_t *next_ = nullptr;
+      uint16_t left_ = 0;
+      T item_{};
+    };
+
+    Section(const uint8_t *message, std::span<const uint8_t> raw,
+            uint16_t count)
+        : message_(message), raw_(raw), count_(count) {}
+
+    Iterator begin() const { return {message_, raw_.data(), count_}; }
+    Iterator end() const { return {}; }
+    uint16_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    // the section as is, names may point outside of it
+    std::span<const uint8_t> raw() const { return raw_; }
+
+  private:
+    const uint8_t *message_;
+    std::span<const uint8_t> raw_;
+    uint16_t count_;
+  };
+
+  // returns nullopt if `message` is truncated or a name is malformed
+  static std::optional<DNSPacketView> Parse(std::span<const uint8_t> message);
+
+  dns_header header() const;
+  uint16_t id() const { return read_u16_from_net(message_.data()); }
+  uint16_t get_qdcount() const { return Count(0); }
+  uint16_t get_ancount() const { return Count(1); }
+  uint16_t get_nscount() const { return Count(2); }
+  uint16_t get_arcount() const { return Count(3); }
+
+  Section<Question> questions() const {
+    return {message_.data(), Raw(0), Count(0)};
+  }
+  Section<Record> answers() const {
+    return {message_.data(), Raw(1), Count(1)};
+  }
+  Section<Record> authority_records() const {
+    return {message_.data(), Raw(2), Count(2)};
+  }
+  Section<Record> additional_records() const {
+    return {message_.data(), Raw(3), Count(3)};
+  }
+  std::span<const uint8_t> raw_questions() const { return Raw(0); }
+  std::span<const uint8_t> raw_answers() const { return Raw(1); }
+
+  // the UDP payload size advertised by the OPT record of the additional
+  // records, `kMinUDPPayloadSize` without one
+  uint16_t udp_payload_size() const;
+
+  std::span<const uint8_t> message() const { return message_; }
+
+private:
+  explicit DNSPacketView(std::span<const uint8_t> message)
+      : message_(message) {}
+
+  uint16_t Count(int section) const {
+    return read_u16_from_net(message_.data() + 4 + 2 * section);
+  }
+  std::span<const uint8_t> Raw(int section) const {
+    return message_.subspan(offsets_[section],
+                            offsets_[section + 1] - offsets_[section]);
+  }
+
+private:
+  std::span<const uint8_t> message_;
+  // where the questions, answers, authority and additional records start,
+  // then where the last section ends
+  std::array<size_t, 5> offsets_ = {};
+};
+
+bool TestMalformedPackets();
+
+// parses a query and a response with `ParseDNSRawPacket`, `DNSPacketView`
+// and `classify_query`, and prints the time and the allocations per parse
+void BenchPacketParse();
+
+#endif
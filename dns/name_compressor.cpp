@@ -0,0 +1,686 @@
+#include "dns/name_compressor.h"
+#include "dns/dns_packet.h"
+#include "dns/dns_packet_view.h"
+#include "dns/name_kernels.h"
+#include "dns/rrset.h"
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// pointers hold 14 bits of offset
+constexpr const size_t kMaxPointerOffset = 0x3fff;
+constexpr const size_t kMaxNameSize = 255;
+constexpr const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+// sets the bit which tells lowercase from uppercase letters. other bytes
+// may collide, which `Matches` sorts out
+constexpr const uint64_t kCaseBits = 0x2020202020202020ULL;
+
+inline uint8_t ascii_to_lower(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// one multiplication per 8 bytes of the label, most labels are shorter.
+// `label` is followed by at least 8 readable bytes
+inline uint64_t hash_label(uint64_t hash, const uint8_t *label) {
+  size_t size = label[0];
+  hash = (hash ^ size) * kMul;
+  for (size_t i = 1; i <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, label + i, 8);
+    size_t tail = size + 1 - i;
+    if (tail < 8) {
+      word &= ~uint64_t(0) >> (64 - 8 * tail);
+    }
+    hash = (hash ^ (word | kCaseBits)) * kMul;
+  }
+  return hash;
+}
+
+bool equal_ignoring_case(const uint8_t *a, const uint8_t *b, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (ascii_to_lower(a[i]) != ascii_to_lower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+// static
+void NameCompressor::HashSuffixes(const uint8_t *name, Suffixes &suffixes) {
+  suffixes.count = 0;
+  size_t pos = 0;
+  for (; name[pos] != 0; pos += 1 + name[pos]) {
+    suffixes.starts[suffixes.count++] = pos;
+  }
+  // padded, so that labels are read 8 bytes at a time
+  uint8_t padded[kMaxNameSize + 8];
+  memcpy(padded, name, pos);
+  memset(padded + pos, 0, 8);
+  // a suffix hashes its first label into the hash of the rest of it
+  uint64_t hash = 0;
+  for (size_t i = suffixes.count; i-- > 0;) {
+    hash = hash_label(hash, padded + suffixes.starts[i]);
+    suffixes.hashes[i] = hash >> 32;
+  }
+}
+
+bool NameCompressor::Matches(size_t offset, const uint8_t *name) const {
+  // the names of the message were written by this compressor, their
+  // pointers all point backwards to valid names
+  const uint8_t *p = message_.data() + offset;
+  while (true) {
+    while ((*p & 0xc0) == 0xc0) {
+      p = message_.data() + (read_u16_from_net(p) & kMaxPointerOffset);
+    }
+    if (*p != *name) {
+      return false;
+    }
+    if (*p == 0) {
+      return true;
+    }
+    // names are mostly written in the same case
+    if (memcmp(p + 1, name + 1, *p) != 0 &&
+        !equal_ignoring_case(p + 1, name + 1, *p)) {
+      return false;
+    }
+    name += 1 + *name;
+    p += 1 + *p;
+  }
+}
+
+std::optional<uint16_t> NameCompressor::Find(uint32_t hash,
+                                             const uint8_t *name) const {
+  for (size_t i = SlotOf(hash);; i = (i + 1) % kSlotCount) {
+    if (offsets_[i] == 0) {
+      return {};
+    }
+    if (hashes_[i] == hash && Matches(offsets_[i], name)) {
+      return offsets_[i];
+    }
+  }
+}
+
+void NameCompressor::Insert(uint32_t hash, size_t offset) {
+  if (size_ == kMaxSuffixes || offset > kMaxPointerOffset) {
+    return;
+  }
+  size_t i = SlotOf(hash);
+  while (offsets_[i] != 0) {
+    i = (i + 1) % kSlotCount;
+  }
+  hashes_[i] = hash;
+  offsets_[i] = offset;
+  size_++;
+}
+
+void NameCompressor::Remember(size_t offset) {
+  if (offset >= message_.size() ||
+      wire_name_size(message_.subspan(offset)) == 0) {
+    return;
+  }
+  const uint8_t *name = message_.data() + offset;
+  Suffixes suffixes;
+  HashSuffixes(name, suffixes);
+  for (size_t i = 0; i < suffixes.count; i++) {
+    // a name written twice is remembered once
+    if (!Find(suffixes.hashes[i], name + suffixes.starts[i])) {
+      Insert(suffixes.hashes[i], offset + suffixes.starts[i]);
+    }
+  }
+}
+
+size_t NameCompressor::WriteName(size_t offset,
+                                 std::span<const uint8_t> name) {
+  Suffixes suffixes;
+  HashSuffixes(name.data(), suffixes);
+  // the longest suffix already written, the root label is never replaced
+  size_t matched = 0;
+  std::optional<uint16_t> target;
+  for (; matched < suffixes.count; matched++) {
+    target = Find(suffixes.hashes[matched],
+                  name.data() + suffixes.starts[matched]);
+    if (target) {
+      break;
+    }
+  }
+  size_t prefix_size = target ? suffixes.starts[matched] : name.size() - 1;
+  uint8_t *dst = message_.data() + offset;
+  memcpy(dst, name.data(), prefix_size);
+  for (size_t i = 0; i < matched; i++) {
+    Insert(suffixes.hashes[i], offset + suffixes.starts[i]);
+  }
+  if (target) {
+    write_u16_to_net(dst + prefix_size, 0xc000 | *target);
+    return prefix_size + 2;
+  }
+  dst[prefix_size] = 0;
+  return prefix_size + 1;
+}
+
+std::optional<size_t>
+write_compressed_records(NameCompressor &compressor, size_t offset,
+                         std::span<const uint8_t> records, int count,
+                         CompressedRecordsLayout *layout) {
+  std::span<uint8_t> message = compressor.message();
+  if (offset > message.size()) {
+    return {};
+  }
+  if (layout) {
+    layout->ttl_offsets.clear();
+    layout->pointer_offsets.clear();
+  }
+  // writes `name` at `out` and moves `out` past it
+  size_t out = offset;
+  auto write_name = [&](std::span<const uint8_t> name) {
+    size_t size = compressor.WriteName(out, name);
+    // a pointer is shorter than any suffix it replaces
+    if (layout && size < name.size()) {
+      layout->pointer_offsets.push_back(out + size - 2 - offset);
+    }
+    out += size;
+  };
+  // the records of an RRset share their owner name, which is written once
+  // and then pointed to
+  std::span<const uint8_t> last_owner;
+  size_t last_owner_offset = 0;
+  size_t in = 0;
+  for (int i = 0; i < count; i++) {
+    auto record = records.subspan(in);
+    size_t owner_size = wire_name_size(record);
+    if (owner_size == 0 || record.size() - owner_size < 10) {
+      return {};
+    }
+    // type, class, TTL and RDLENGTH
+    const uint8_t *fields = record.data() + owner_size;
+    uint16_t type = read_u16_from_net(fields);
+    size_t rdlength = read_u16_from_net(fields + 8);
+    if (record.size() - owner_size - 10 < rdlength) {
+      return {};
+    }
+    record = record.first(owner_size + 10 + rdlength);
+    in += record.size();
+    // nothing written is larger than what it was read from
+    if (message.size() - out < record.size()) {
+      return {};
+    }
+
+    auto owner = record.first(owner_size);
+    if (owner.size() == last_owner.size() &&
+        memcmp(owner.data(), last_owner.data(), owner.size()) == 0) {
+      write_u16_to_net(message.data() + out, 0xc000 | last_owner_offset);
+      if (layout) {
+        layout->pointer_offsets.push_back(out - offset);
+      }
+      out += 2;
+    } else {
+      size_t owner_offset = out;
+      write_name(owner);
+      last_owner = owner;
+      // the owner name may have been written as a pointer only
+      last_owner_offset = message[owner_offset] & 0xc0
+                              ? read_u16_from_net(&message[owner_offset]) &
+                                    kMaxPointerOffset
+                              : owner_offset;
+      // the root name is shorter than a pointer
+      if (owner.size() < 2 || last_owner_offset > kMaxPointerOffset) {
+        last_owner = {};
+      }
+    }
+    memcpy(message.data() + out, fields, 8);
+    if (layout) {
+      layout->ttl_offsets.push_back(out + 4 - offset);
+    }
+    uint8_t *rdlength_field = message.data() + out + 8;
+    out += 10;
+
+    auto rdata = record.subspan(owner_size + 10);
+    auto layout = rdata_names(type);
+    if (!layout) {
+      memcpy(message.data() + out, rdata.data(), rdlength);
+      out += rdlength;
+      write_u16_to_net(rdlength_field, rdlength);
+      continue;
+    }
+    auto [prefix_size, names, suffix_size] = *layout;
+    if (prefix_size > rdlength) {
+      return {};
+    }
+    size_t rdata_offset = out;
+    memcpy(message.data() + out, rdata.data(), prefix_size);
+    out += prefix_size;
+    size_t pos = prefix_size;
+    for (int j = 0; j < names; j++) {
+      size_t name_size = wire_name_size(rdata.subspan(pos));
+      if (name_size == 0) {
+        return {};
+      }
+      write_name(rdata.subspan(pos, name_size));
+      pos += name_size;
+    }
+    if (rdlength - pos != suffix_size) {
+      return {};
+    }
+    memcpy(message.data() + out, rdata.data() + pos, suffix_size);
+    out += suffix_size;
+    write_u16_to_net(rdlength_field, out - rdata_offset);
+  }
+  return out - offset;
+}
+
+namespace {
+
+constexpr const uint16_t kTypeA = 1;
+constexpr const uint16_t kTypeTXT = 16;
+constexpr const uint16_t kTypeAAAA = 28;
+constexpr const uint16_t kClassIN = 1;
+
+void append_u16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+void append_u32(std::vector<uint8_t> &out, uint32_t value) {
+  append_u16(out, value >> 16);
+  append_u16(out, value);
+}
+
+// "" is the root name
+std::vector<uint8_t> wire_name(std::string_view text) {
+  std::vector<uint8_t> name;
+  while (!text.empty()) {
+    size_t dot = std::min(text.find('.'), text.size());
+    name.push_back(dot);
+    name.insert(name.end(), text.begin(), text.begin() + dot);
+    text.remove_prefix(std::min(dot + 1, text.size()));
+  }
+  name.push_back(0);
+  return name;
+}
+
+// as `ParseDNSRawPacket` spells names, lowercased
+std::string name_text(std::span<const uint8_t> name) {
+  std::string text;
+  for (size_t pos = 0; name[pos] != 0; pos += 1 + name[pos]) {
+    if (!text.empty()) {
+      text.push_back('.');
+    }
+    for (size_t i = 1; i <= name[pos]; i++) {
+      text.push_back(ascii_to_lower(name[pos + i]));
+    }
+  }
+  return text;
+}
+
+std::vector<uint8_t> make_record(std::string_view owner, uint16_t type,
+                                 std::span<const uint8_t> rdata) {
+  std::vector<uint8_t> record = wire_name(owner);
+  append_u16(record, type);
+  append_u16(record, kClassIN);
+  append_u32(record, 300);
+  append_u16(record, rdata.size());
+  record.insert(record.end(), rdata.begin(), rdata.end());
+  return record;
+}
+
+std::vector<uint8_t> name_rdata(uint16_t preference, std::string_view name) {
+  std::vector<uint8_t> rdata;
+  append_u16(rdata, preference);
+  std::vector<uint8_t> wire = wire_name(name);
+  rdata.insert(rdata.end(), wire.begin(), wire.end());
+  return rdata;
+}
+
+std::vector<uint8_t> soa_rdata(std::string_view mname, std::string_view rname) {
+  std::vector<uint8_t> rdata = wire_name(mname);
+  std::vector<uint8_t> wire = wire_name(rname);
+  rdata.insert(rdata.end(), wire.begin(), wire.end());
+  // serial, refresh, retry, expire and minimum, with a byte of each case
+  for (int i = 0; i < 20; i++) {
+    rdata.push_back(i % 2 ? 'A' + i : 'a' + i);
+  }
+  return rdata;
+}
+
+// the uncompressed `record` with its owner name and the names of its data
+// lowercased, as compression may change their case
+std::vector<uint8_t> canonical_record(std::vector<uint8_t> record) {
+  size_t owner_size = wire_name_size(record);
+  // the length bytes of labels are never letters
+  for (size_t i = 0; i < owner_size; i++) {
+    record[i] = ascii_to_lower(record[i]);
+  }
+  auto layout = rdata_names(read_u16_from_net(&record[owner_size]));
+  if (!layout) {
+    return record;
+  }
+  size_t pos = owner_size + 10 + layout->prefix_size;
+  for (int i = 0; i < layout->count && pos < record.size(); i++) {
+    size_t end = pos + wire_name_size(std::span(record).subspan(pos));
+    for (; pos < end; pos++) {
+      record[pos] = ascii_to_lower(record[pos]);
+    }
+  }
+  return record;
+}
+
+// the record read by `DNSPacketView` from `message`, uncompressed
+std::optional<std::vector<uint8_t>>
+uncompressed_record(std::span<const uint8_t> message,
+                    const DNSPacketView::Record &record) {
+  std::vector<uint8_t> out;
+  record.name.AppendTo(out);
+  append_u16(out, record.type);
+  append_u16(out, record.rr_class);
+  append_u32(out, record.ttl);
+  size_t rdlength_offset = out.size();
+  append_u16(out, 0);
+  size_t pos = record.rdata.data() - message.data();
+  size_t end = pos + record.rdata.size();
+  auto layout = rdata_names(record.type);
+  if (layout) {
+    if (layout->prefix_size > record.rdata.size()) {
+      return {};
+    }
+    out.insert(out.end(), message.begin() + pos,
+               message.begin() + pos + layout->prefix_size);
+    pos += layout->prefix_size;
+    for (int i = 0; i < layout->count; i++) {
+      if (!read_uncompressed_name(message.first(end), &pos, out)) {
+        return {};
+      }
+    }
+  }
+  out.insert(out.end(), message.begin() + pos, message.begin() + end);
+  write_u16_to_net(&out[rdlength_offset], out.size() - rdlength_offset - 2);
+  return out;
+}
+
+// the offsets of the compression pointers of the `count` compressed
+// records at the start of `records`, found by walking them
+std::vector<uint16_t> pointer_offsets(std::span<const uint8_t> records,
+                                      int count) {
+  std::vector<uint16_t> offsets;
+  size_t pos = 0;
+  // moves `pos` past the name at it, which ends with a pointer or the root
+  auto skip_name = [&]() {
+    while (records[pos] != 0 && (records[pos] & 0xc0) != 0xc0) {
+      pos += 1 + records[pos];
+    }
+    if (records[pos] == 0) {
+      pos++;
+      return;
+    }
+    offsets.push_back(pos);
+    pos += 2;
+  };
+  for (int i = 0; i < count; i++) {
+    skip_name();
+    uint16_t type = read_u16_from_net(&records[pos]);
+    size_t rdlength = read_u16_from_net(&records[pos + 8]);
+    pos += 10;
+    size_t end = pos + rdlength;
+    if (auto layout = rdata_names(type)) {
+      pos += layout->prefix_size;
+      for (int j = 0; j < layout->count; j++) {
+        skip_name();
+      }
+    }
+    pos = end;
+  }
+  return offsets;
+}
+
+// compresses `records` into the answers of a message asking for
+// `question`, parses the message back with both parsers and compares the
+// records read with those written
+bool check_round_trip(const char *what, std::span<const uint8_t> question,
+                      const std::vector<std::vector<uint8_t>> &records,
+                      std::optional<uint32_t> ttl) {
+  std::vector<uint8_t> message(kHeaderSize);
+  write_u16_to_net(&message[2], kStandardResponse);
+  write_u16_to_net(&message[4], 1);
+  write_u16_to_net(&message[6], records.size());
+  message.insert(message.end(), question.begin(), question.end());
+  append_u16(message, kTypeA);
+  append_u16(message, kClassIN);
+  size_t records_offset = message.size();
+  std::vector<uint8_t> uncompressed;
+  std::vector<std::vector<uint8_t>> expected;
+  for (std::vector<uint8_t> record : records) {
+    uncompressed.insert(uncompressed.end(), record.begin(), record.end());
+    if (ttl) {
+      write_u32_to_net(&record[wire_name_size(record) + 4], *ttl);
+    }
+    expected.push_back(canonical_record(std::move(record)));
+  }
+  std::vector<uint8_t> original = message;
+  original.insert(original.end(), uncompressed.begin(), uncompressed.end());
+
+  message.resize(records_offset + uncompressed.size());
+  NameCompressor compressor(message);
+  compressor.Remember(kHeaderSize);
+  CompressedRecordsLayout layout;
+  auto size = write_compressed_records(compressor, records_offset,
+                                       uncompressed, records.size(), &layout);
+  if (!size) {
+    printf("%s: records not written\n", what);
+    return false;
+  }
+  message.resize(records_offset + *size);
+
+  auto view = DNSPacketView::Parse(message);
+  if (!view) {
+    printf("%s: DNSPacketView rejects the message\n", what);
+    return false;
+  }
+  // the message is well formed, its records can be walked
+  if (pointer_offsets(std::span(message).subspan(records_offset),
+                      records.size()) != layout.pointer_offsets ||
+      layout.ttl_offsets.size() != records.size()) {
+    printf("%s: wrong layout\n", what);
+    return false;
+  }
+  // the TTLs are found where the layout says
+  if (ttl) {
+    set_ttls(message.data() + records_offset, layout.ttl_offsets, *ttl);
+  }
+  size_t i = 0;
+  for (const DNSPacketView::Record &record : view->answers()) {
+    auto read = uncompressed_record(message, record);
+    if (i == expected.size() || !read ||
+        canonical_record(std::move(*read)) != expected[i]) {
+      printf("%s: DNSPacketView reads record %zu differently\n", what, i);
+      return false;
+    }
+    i++;
+  }
+  if (i != expected.size()) {
+    printf("%s: DNSPacketView reads %zu of %zu records\n", what, i,
+           expected.size());
+    return false;
+  }
+
+  auto packet = ParseDNSRawPacket(message.data(), message.size());
+  if (!packet) {
+    // it rejects names longer than 75 characters, compressed or not
+    if (ParseDNSRawPacket(original.data(), original.size())) {
+      printf("%s: ParseDNSRawPacket rejects the message\n", what);
+      return false;
+    }
+    return true;
+  }
+  if (packet->answers.size() != expected.size()) {
+    printf("%s: ParseDNSRawPacket reads %zu of %zu records\n", what,
+           packet->answers.size(), expected.size());
+    return false;
+  }
+  for (i = 0; i < expected.size(); i++) {
+    const dns_answer &answer = packet->answers[i];
+    std::span<const uint8_t> record = expected[i];
+    size_t owner_size = wire_name_size(record);
+    std::string name = answer.name;
+    for (char &c : name) {
+      c = ascii_to_lower(c);
+    }
+    bool same = name == name_text(record) &&
+                answer.type == read_u16_from_net(&record[owner_size]) &&
+                answer.ttl == read_u32_from_net(&record[owner_size + 4]);
+    // it leaves the names of the data compressed, `DNSPacketView` checked
+    // them
+    auto rdata = record.subspan(owner_size + 10);
+    if (!rdata_names(answer.type)) {
+      same = same && std::equal(rdata.begin(), rdata.end(),
+                                answer.rdata.begin(), answer.rdata.end());
+    }
+    if (!same) {
+      printf("%s: ParseDNSRawPacket reads record %zu differently\n", what, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool TestCompressedRecords() {
+  const uint8_t kAddress[] = {192, 0, 2, 1};
+  const uint8_t kOtherAddress[] = {192, 0, 2, 2};
+  auto question = wire_name("www.example.com");
+
+  std::vector<std::vector<uint8_t>> chain = {
+      make_record("www.example.com", kTypeCNAME,
+                  wire_name("www.example.com.cdn.net")),
+      make_record("WWW.Example.COM.cdn.net", kTypeCNAME,
+                  wire_name("edge.cdn.net")),
+      make_record("edge.cdn.net", kTypeA, kAddress),
+      make_record("edge.cdn.net", kTypeA, kOtherAddress),
+  };
+  if (!check_round_trip("CNAME chain", question, chain, std::nullopt) ||
+      !check_round_trip("CNAME chain, TTL set", question, chain, 60)) {
+    return false;
+  }
+
+  std::vector<std::vector<uint8_t>> names = {
+      make_record("example.com", kTypeSOA,
+                  soa_rdata("ns1.example.com", "hostmaster.example.com")),
+      make_record("example.com", kTypeMX, name_rdata(10, "mail.example.com")),
+      make_record("example.com", kTypeMX, name_rdata(20, "MAIL.Example.COM")),
+      make_record("example.com", kTypeNS, wire_name("ns1.example.com")),
+      make_record("example.com", kTypeNS, wire_name("ns2.example.org")),
+      make_record("mail.example.com", kTypeA, kAddress),
+      make_record("ns1.example.com", kTypePTR, wire_name("example.com")),
+  };
+  if (!check_round_trip("SOA, MX and NS", question, names, std::nullopt)) {
+    return false;
+  }
+
+  std::vector<std::vector<uint8_t>> root = {
+      make_record("", kTypeNS, wire_name("a.root-servers.net")),
+      make_record("", kTypeNS, wire_name("b.root-servers.net")),
+      make_record("", kTypeSOA,
+                  soa_rdata("a.root-servers.net", "nstld.verisign-grs.com")),
+  };
+  if (!check_round_trip("root owner", wire_name(""), root, std::nullopt)) {
+    return false;
+  }
+
+  // a TXT record pads the message, so that the names after it are written
+  // around the last offset a pointer reaches
+  for (int delta = -24; delta <= 24; delta++) {
+    auto pad_owner = wire_name("pad.example");
+    size_t records_offset = kHeaderSize + question.size() + 4;
+    size_t pad_size = kMaxPointerOffset + delta - records_offset -
+                      pad_owner.size() - 10;
+    std::vector<uint8_t> pad(pad_size, 'x');
+    std::vector<std::vector<uint8_t>> near_limit = {
+        make_record("pad.example", kTypeTXT, pad),
+        make_record("a.b.near.example", kTypeA, kAddress),
+        make_record("a.b.near.example", kTypeA, kOtherAddress),
+        make_record("c.b.near.example", kTypeCNAME,
+                    wire_name("a.b.near.example")),
+        make_record("near.example", kTypeMX, name_rdata(10, "d.b.near.example")),
+        make_record("www.example.com", kTypeAAAA, std::vector<uint8_t>(16, 1)),
+    };
+    std::string what = "near the pointer limit, " + std::to_string(delta);
+    if (!check_round_trip(what.c_str(), question, near_limit, std::nullopt)) {
+      return false;
+    }
+  }
+
+  // random records, with names sharing labels in both cases, and data of
+  // types whose names are compressed and of types whose bytes only look
+  // like names
+  std::mt19937 rng(20240704);
+  const std::string_view kLabels[] = {"www",  "mail", "a",   "b",   "example",
+                                      "Test", "cdn",  "EDGE", "net", "com"};
+  auto random_name = [&]() {
+    std::string text;
+    int labels = rng() % 8 == 0 ? 20 + rng() % 30 : rng() % 5;
+    for (int i = 0; i < labels; i++) {
+      std::string label(kLabels[rng() % std::size(kLabels)]);
+      if (rng() % 10 == 0) {
+        label.assign(1 + rng() % 63, 'q');
+      }
+      if (text.size() + label.size() + 2 > kMaxNameSize - 1) {
+        break;
+      }
+      text += (text.empty() ? "" : ".") + label;
+    }
+    return text;
+  };
+  const uint16_t kTypes[] = {kTypeA,  kTypeCNAME, kTypeNS,  kTypePTR,
+                             kTypeMX, kTypeSOA,   kTypeTXT, kTypeAAAA};
+  for (int round = 0; round < 3000; round++) {
+    std::vector<std::vector<uint8_t>> records;
+    int count = 1 + rng() % 12;
+    for (int i = 0; i < count; i++) {
+      uint16_t type = kTypes[rng() % std::size(kTypes)];
+      std::vector<uint8_t> rdata;
+      switch (type) {
+      case kTypeCNAME:
+      case kTypeNS:
+      case kTypePTR:
+      case kTypeTXT:
+        rdata = wire_name(random_name());
+        break;
+      case kTypeMX:
+        rdata = name_rdata(rng(), random_name());
+        break;
+      case kTypeSOA:
+        rdata = soa_rdata(random_name(), random_name());
+        break;
+      default:
+        for (int j = 0; j < (type == kTypeA ? 4 : 16); j++) {
+          rdata.push_back(rng());
+        }
+      }
+      // the records of an RRset follow each other
+      std::string owner = i > 0 && rng() % 3 == 0
+                              ? name_text(records.back())
+                              : random_name();
+      records.push_back(make_record(owner, type, rdata));
+    }
+    std::optional<uint32_t> ttl;
+    if (round % 3 == 0) {
+      ttl = rng();
+    }
+    std::string what = "random records, round " + std::to_string(round);
+    if (!check_round_trip(what.c_str(), wire_name(random_name()), records,
+                          ttl)) {
+      return false;
+    }
+  }
+  return true;
+}
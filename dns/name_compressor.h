@@ -0,0 +1,106 @@
+#ifndef DNS_NAME_COMPRESSOR_H_
+#define DNS_NAME_COMPRESSOR_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*
+  `NameCompressor` writes names into a message being built, replacing the
+  longest suffix of a name already in the message by a pointer to it
+  (RFC 1035 4.1.4). The suffixes written, or shown with `Remember`, are
+  kept in a small open addressing table of their offsets keyed by a hash
+  of the suffix, so compressing a name costs one hash per label, computed
+  from the last label backwards, and one comparison per candidate found.
+
+  Names compare ignoring the case of ASCII letters, as DNS names do, so a
+  suffix replaced by a pointer takes the case of the name pointed to. Only
+  the first 16 KiB of a message can be pointed to, and only the first
+  `kMaxSuffixes` suffixes are remembered.
+
+  The compressor writes into `message` in place, which must not move while
+  the message is built.
+
+  example:
+
+    // header and question already written, the records are uncompressed
+    NameCompressor compressor(reply);
+    compressor.Remember(kHeaderSize);
+    auto size = write_compressed_records(compressor, records_offset,
+                                         records, count, nullptr);
+
+*/
+class NameCompressor {
+public:
+  static constexpr const size_t kMaxSuffixes = 48;
+
+  explicit NameCompressor(std::span<uint8_t> message) : message_(message) {}
+
+  // remembers the suffixes of the uncompressed name at `offset`, if there
+  // is one
+  void Remember(size_t offset);
+
+  // writes the uncompressed `name` at `offset`, compressed, and returns the
+  // bytes written, never more than `name.size()`. the message must have
+  // room for `name.size()` bytes at `offset`
+  size_t WriteName(size_t offset, std::span<const uint8_t> name);
+
+  std::span<uint8_t> message() const { return message_; }
+
+private:
+  // a power of 2. `kMaxSuffixes` fill it up to 3/8, so probes stay short
+  static constexpr const size_t kSlotBits = 7;
+  static constexpr const size_t kSlotCount = 1 << kSlotBits;
+  // a name of 255 bytes has at most 127 labels, the root label excluded
+  static constexpr const size_t kMaxLabels = 127;
+
+  // the labels of a name, where they start and the hashes of the suffixes
+  // starting with them
+  struct Suffixes {
+    std::array<uint8_t, kMaxLabels> starts;
+    std::array<uint32_t, kMaxLabels> hashes;
+    size_t count = 0;
+  };
+
+  static void HashSuffixes(const uint8_t *name, Suffixes &suffixes);
+  // the high bits of the hashes are the best mixed
+  static size_t SlotOf(uint32_t hash) { return hash >> (32 - kSlotBits); }
+  // returns the offset of a suffix equal to the one of `name`
+  std::optional<uint16_t> Find(uint32_t hash, const uint8_t *name) const;
+  bool Matches(size_t offset, const uint8_t *name) const;
+  void Insert(uint32_t hash, size_t offset);
+
+private:
+  std::span<uint8_t> message_;
+  // of the suffixes, from the start of the message. 0 for an empty slot,
+  // the header is never pointed to
+  std::array<uint16_t, kSlotCount> offsets_ = {};
+  std::array<uint32_t, kSlotCount> hashes_;
+  size_t size_ = 0;
+};
+
+// where the TTL fields and the compression pointers of the records written
+// by `write_compressed_records` are, from the offset they were written at
+struct CompressedRecordsLayout {
+  std::vector<uint16_t> ttl_offsets;
+  std::vector<uint16_t> pointer_offsets;
+};
+
+// writes `count` records of `records`, whose names are uncompressed, at
+// `offset` of the message of `compressor`, compressing the owner names and
+// the names in the data of NS, CNAME, SOA, PTR and MX records. `layout`, if
+// not null, is replaced by the layout of the records written.
+// returns the bytes written, never more than `records.size()`, or nullopt
+// if a record is malformed or the message has no room for it. every record
+// is checked against the room left for its uncompressed size
+std::optional<size_t>
+write_compressed_records(NameCompressor &compressor, size_t offset,
+                         std::span<const uint8_t> records, int count,
+                         CompressedRecordsLayout *layout);
+
+bool TestCompressedRecords();
+
+#endif
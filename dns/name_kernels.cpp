@@ -0,0 +1,398 @@
+#include "dns/name_kernels.h"
+#include "base/hash.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DNS_NAME_KERNELS_X86 1
+#endif
+
+namespace {
+
+// including the length bytes and the root label
+constexpr const size_t kMaxNameSize = 255;
+constexpr const size_t kStripeSize = 32;
+constexpr const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+// mixed into the words of a stripe before they are multiplied, so that
+// zero words do not zero the products. xored with the per-process seed,
+// see `lane_keys`
+constexpr const uint64_t kLaneKeys[4] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL,
+    0x1f67b3b7a4a44072ULL};
+constexpr const uint64_t kLaneSeeds[4] = {
+    0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+    0x85ebca77c2b2ae63ULL};
+
+// the keys of the lanes, the same for every set of kernels. the products
+// of keyed words are what collisions have to cancel out, so it is the keys
+// which are seeded rather than the lane sums
+const uint64_t *lane_keys() {
+  struct Keys {
+    alignas(32) uint64_t values[4];
+  };
+  static const Keys keys = [] {
+    Keys keys;
+    for (int lane = 0; lane < 4; lane++) {
+      keys.values[lane] =
+          kLaneKeys[lane] ^ base::mix_u64(base::hash_seed() + lane);
+    }
+    return keys;
+  }();
+  return keys.values;
+}
+
+inline uint8_t ascii_to_lower(uint8_t c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// folds the lanes and the size of the name into the hash
+uint64_t finish_hash(const uint64_t acc[4], size_t size) {
+  uint64_t h = size * kMul;
+  for (int lane = 0; lane < 4; lane++) {
+    h = (h ^ acc[lane]) * kMul;
+  }
+  return base::mix_u64(h);
+}
+
+void lowercase_scalar(const uint8_t *src, size_t size, uint8_t *dst) {
+  for (size_t i = 0; i < size; i++) {
+    dst[i] = ascii_to_lower(src[i]);
+  }
+}
+
+// every lane adds the product of the halves of its keyed word, and the
+// word of its neighbor so that no input bit is lost by a product
+void accumulate_scalar(uint64_t acc[4], const uint8_t *stripe,
+                       const uint64_t *keys) {
+  uint64_t words[4];
+  memcpy(words, stripe, kStripeSize);
+  for (int lane = 0; lane < 4; lane++) {
+    uint64_t keyed = words[lane] ^ keys[lane];
+    acc[lane] += (keyed & 0xffffffff) * (keyed >> 32) + words[lane ^ 1];
+  }
+}
+
+uint64_t hash_scalar(const uint8_t *name, size_t size) {
+  const uint64_t *keys = lane_keys();
+  uint64_t acc[4] = {kLaneSeeds[0], kLaneSeeds[1], kLaneSeeds[2],
+                     kLaneSeeds[3]};
+  size_t i = 0;
+  for (; i + kStripeSize <= size; i += kStripeSize) {
+    accumulate_scalar(acc, name + i, keys);
+  }
+  // the last stripe is padded with zeros
+  if (i < size) {
+    uint8_t tail[kStripeSize] = {};
+    memcpy(tail, name + i, size - i);
+    accumulate_scalar(acc, tail, keys);
+  }
+  return finish_hash(acc, size);
+}
+
+#ifdef DNS_NAME_KERNELS_X86
+
+// 'A'..'Z' are moved to the lowest signed bytes, so one signed comparison
+// finds them
+inline __m128i lowercase_16(__m128i bytes) {
+  __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8(char(0x80 - 'A')));
+  __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(char(0x80 + 26)), shifted);
+  return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+void lowercase_sse2(const uint8_t *src, size_t size, uint8_t *dst) {
+  if (size < 16) {
+    lowercase_scalar(src, size, dst);
+    return;
+  }
+  auto lowercase_at = [&](size_t i) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     lowercase_16(bytes));
+  };
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    lowercase_at(i);
+  }
+  // the last chunk overlaps the previous one, which is harmless
+  if (i < size) {
+    lowercase_at(size - 16);
+  }
+}
+
+inline __m128i accumulate_16(__m128i acc, __m128i words, __m128i keys) {
+  __m128i keyed = _mm_xor_si128(words, keys);
+  __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+  __m128i neighbors = _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+  return _mm_add_epi64(acc, _mm_add_epi64(product, neighbors));
+}
+
+uint64_t hash_sse2(const uint8_t *name, size_t size) {
+  auto lanes = [](const uint64_t *words) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(words));
+  };
+  const __m128i keys_lo = lanes(lane_keys());
+  const __m128i keys_hi = lanes(lane_keys() + 2);
+  __m128i acc_lo = lanes(kLaneSeeds);
+  __m128i acc_hi = lanes(kLaneSeeds + 2);
+  auto accumulate = [&](const uint8_t *stripe) {
+    auto words = reinterpret_cast<const __m128i *>(stripe);
+    acc_lo = accumulate_16(acc_lo, _mm_loadu_si128(words), keys_lo);
+    acc_hi = accumulate_16(acc_hi, _mm_loadu_si128(words + 1), keys_hi);
+  };
+  size_t i = 0;
+  for (; i + kStripeSize <= size; i += kStripeSize) {
+    accumulate(name + i);
+  }
+  if (i < size) {
+    alignas(16) uint8_t tail[kStripeSize] = {};
+    memcpy(tail, name + i, size - i);
+    accumulate(tail);
+  }
+  uint64_t acc[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), acc_lo);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + 2), acc_hi);
+  return finish_hash(acc, size);
+}
+
+__attribute__((target("avx2"))) inline __m256i lowercase_32(__m256i bytes) {
+  __m256i shifted =
+      _mm256_add_epi8(bytes, _mm256_set1_epi8(char(0x80 - 'A')));
+  __m256i upper =
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(char(0x80 + 26)), shifted);
+  return _mm256_or_si256(bytes,
+                         _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) inline void
+lowercase_32_at(const uint8_t *src, uint8_t *dst, size_t i) {
+  __m256i bytes =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                      lowercase_32(bytes));
+}
+
+__attribute__((target("avx2"))) void
+lowercase_avx2(const uint8_t *src, size_t size, uint8_t *dst) {
+  if (size < 32) {
+    lowercase_sse2(src, size, dst);
+    return;
+  }
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    lowercase_32_at(src, dst, i);
+  }
+  if (i < size) {
+    lowercase_32_at(src, dst, size - 32);
+  }
+}
+
+__attribute__((target("avx2"))) inline __m256i
+accumulate_32(__m256i acc, const uint8_t *stripe, __m256i keys) {
+  __m256i words =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(stripe));
+  __m256i keyed = _mm256_xor_si256(words, keys);
+  __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+  __m256i neighbors = _mm256_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+  return _mm256_add_epi64(acc, _mm256_add_epi64(product, neighbors));
+}
+
+__attribute__((target("avx2"))) uint64_t hash_avx2(const uint8_t *name,
+                                                    size_t size) {
+  const __m256i keys =
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(lane_keys()));
+  __m256i acc =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kLaneSeeds));
+  size_t i = 0;
+  for (; i + kStripeSize <= size; i += kStripeSize) {
+    acc = accumulate_32(acc, name + i, keys);
+  }
+  if (i < size) {
+    alignas(32) uint8_t tail[kStripeSize] = {};
+    memcpy(tail, name + i, size - i);
+    acc = accumulate_32(acc, tail, keys);
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+  return finish_hash(lanes, size);
+}
+
+#endif // DNS_NAME_KERNELS_X86
+
+std::vector<NameKernels> detect_name_kernels() {
+  std::vector<NameKernels> kernels{{"scalar", lowercase_scalar, hash_scalar}};
+#ifdef DNS_NAME_KERNELS_X86
+  // SSE2 is part of x86-64
+  kernels.push_back({"sse2", lowercase_sse2, hash_sse2});
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back({"avx2", lowercase_avx2, hash_avx2});
+  }
+#endif
+  return kernels;
+}
+
+} // namespace
+
+std::span<const NameKernels> supported_name_kernels() {
+  static const std::vector<NameKernels> kernels = detect_name_kernels();
+  return kernels;
+}
+
+const NameKernels &name_kernels() {
+  static const NameKernels &fastest = supported_name_kernels().back();
+  return fastest;
+}
+
+size_t wire_name_size(std::span<const uint8_t> bytes) {
+  size_t name_size = 0;
+  while (name_size < bytes.size()) {
+    uint8_t label_size = bytes[name_size];
+    name_size++;
+    if (label_size == 0) {
+      return name_size <= kMaxNameSize ? name_size : 0;
+    }
+    // compression pointers and the obsolete extended label types
+    if (label_size & 0xc0) {
+      return 0;
+    }
+    name_size += label_size;
+    if (name_size >= kMaxNameSize) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+bool TestNameKernels() {
+  constexpr const size_t kEdgeSizes[] = {0, 1, 15, 16, 17, 31, 32, 33, 63, 255};
+  constexpr const size_t kGuard = 32;
+  std::mt19937 rng(20240611);
+  const NameKernels &scalar = supported_name_kernels().front();
+  // unaligned sources, and bytes past the name which must not matter
+  alignas(32) uint8_t src[kMaxNameSize + 3 + kGuard];
+  uint8_t expected[kMaxNameSize + kGuard];
+  uint8_t dst[kMaxNameSize + kGuard];
+  for (int round = 0; round < 20000; round++) {
+    size_t size = round < 2000 ? kEdgeSizes[round % std::size(kEdgeSizes)]
+                               : rng() % (kMaxNameSize + 1);
+    size_t offset = rng() % 4;
+    uint8_t *name = src + offset;
+    for (size_t i = 0; i < sizeof(src); i++) {
+      // every other round mostly letters of both cases, where lowercasing
+      // has work to do
+      src[i] = round % 2 ? 'A' + rng() % 58 : rng();
+    }
+    memset(expected, 0xa5, sizeof(expected));
+    scalar.lowercase(name, size, expected);
+    uint64_t expected_hash = scalar.hash(name, size);
+    for (size_t i = 0; i < size; i++) {
+      uint8_t c = name[i];
+      if (expected[i] != (c >= 'A' && c <= 'Z' ? c + 32 : c)) {
+        printf("scalar lowercase wrong at %zu of %zu\n", i, size);
+        return false;
+      }
+    }
+    for (const NameKernels &kernels : supported_name_kernels()) {
+      memset(dst, 0xa5, sizeof(dst));
+      kernels.lowercase(name, size, dst);
+      // the bytes past `size` are left as they were
+      if (memcmp(dst, expected, sizeof(dst)) != 0) {
+        printf("%s lowercase differs, size %zu\n", kernels.isa, size);
+        return false;
+      }
+      if (kernels.hash(name, size) != expected_hash) {
+        printf("%s hash differs, size %zu\n", kernels.isa, size);
+        return false;
+      }
+    }
+    name[size] ^= 0xff;
+    for (const NameKernels &kernels : supported_name_kernels()) {
+      if (kernels.hash(name, size) != expected_hash) {
+        printf("%s hash reads past the name, size %zu\n", kernels.isa, size);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void BenchNameKernels() {
+  constexpr const int kNames = 100000;
+  constexpr const int kRounds = 20;
+  // sizes of query names: 30% of 10-20 bytes, 45% of 20-35, 20% of 35-60
+  // and 5% of 60-120
+  std::mt19937 rng(20240612);
+  auto random_size = [&rng]() -> size_t {
+    int percentile = rng() % 100;
+    auto between = [&rng](size_t low, size_t high) {
+      return low + rng() % (high - low + 1);
+    };
+    return percentile < 30   ? between(10, 20)
+           : percentile < 75 ? between(20, 35)
+           : percentile < 95 ? between(35, 60)
+                             : between(60, 120);
+  };
+  // letters of both cases, digits and dashes. the kernels do not look at
+  // the length bytes, so the names are random bytes of these
+  constexpr const std::string_view kChars =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+  // the names packed one after the other, as in messages
+  std::vector<uint8_t> bytes;
+  std::vector<std::pair<size_t, size_t>> names;
+  size_t total_size = 0;
+  for (int i = 0; i < kNames; i++) {
+    size_t size = random_size();
+    names.emplace_back(bytes.size(), size);
+    for (size_t j = 0; j < size; j++) {
+      bytes.push_back(kChars[rng() % kChars.size()]);
+    }
+    total_size += size;
+  }
+  uint8_t dst[kMaxNameSize];
+
+  // keeps the results alive, so that the kernels are not optimized out
+  volatile uint64_t sink = 0;
+  auto measure = [&](auto run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+      for (auto [offset, size] : names) {
+        sink = sink + run(bytes.data() + offset, size);
+      }
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (kRounds * kNames);
+  };
+
+  printf("name kernels, %d names of %.1f bytes on average, %d rounds\n",
+         kNames, double(total_size) / kNames, kRounds);
+  printf("  %-10s %12s %12s\n", "isa", "lowercase", "hash");
+  for (const NameKernels &kernels : supported_name_kernels()) {
+    double lowercase = measure([&](const uint8_t *name, size_t size) {
+      kernels.lowercase(name, size, dst);
+      return dst[size / 2];
+    });
+    double hash = measure([&](const uint8_t *name, size_t size) {
+      return kernels.hash(name, size);
+    });
+    printf("  %-10s %9.1f ns %9.1f ns\n", kernels.isa, lowercase, hash);
+  }
+  // the byte loop the kernels replaced
+  double byte_loop = measure([&](const uint8_t *name, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      dst[i] = ascii_to_lower(name[i]);
+    }
+    return dst[size / 2];
+  });
+  printf("  %-10s %9.1f ns\n", "byte loop", byte_loop);
+}
@@ -0,0 +1,62 @@
+#ifndef DNS_NAME_KERNELS_H_
+#define DNS_NAME_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/*
+  Kernels for names in wire format, the hot part of building cache keys.
+  `lowercase_name` works on 32 or 16 bytes at a time, and `hash_name` on
+  stripes of 32 bytes kept in four independent 64-bit lanes, so the
+  multiplications of a stripe do not wait on each other. Every set of
+  kernels gives the same results. The fastest set the CPU supports, AVX2,
+  SSE2 or plain C++, is chosen once at startup.
+
+  Finding the end of a name hops from length byte to length byte. The
+  hops depend on each other, and a name has a handful of labels, so
+  `wire_name_size` stays scalar.
+
+  example:
+
+    size_t size = wire_name_size(question);
+    lowercase_name(question.data(), size, key_bytes);
+    uint64_t hash = hash_name(key_bytes, size);
+
+*/
+
+// one implementation of the kernels
+struct NameKernels {
+  const char *isa;
+  // copies `size` bytes from `src` to `dst` with ASCII letters lowercased.
+  // length bytes are never capital letters, so a whole wire-format name
+  // can be lowercased at once
+  void (*lowercase)(const uint8_t *src, size_t size, uint8_t *dst);
+  uint64_t (*hash)(const uint8_t *name, size_t size);
+};
+
+// the kernels this CPU supports, the slowest first
+std::span<const NameKernels> supported_name_kernels();
+// the fastest of them
+const NameKernels &name_kernels();
+
+inline void lowercase_name(const uint8_t *src, size_t size, uint8_t *dst) {
+  name_kernels().lowercase(src, size, dst);
+}
+
+inline uint64_t hash_name(const uint8_t *name, size_t size) {
+  return name_kernels().hash(name, size);
+}
+
+// the size of the uncompressed name at the start of `bytes`, root label
+// included, or 0 if there is none: truncated, compressed or longer than
+// 255 bytes
+size_t wire_name_size(std::span<const uint8_t> bytes);
+
+bool TestNameKernels();
+
+// lowercases and hashes names of common sizes with every set of kernels,
+// and prints the time per name of each
+void BenchNameKernels();
+
+#endif
@@ -0,0 +1,171 @@
+#include "dns/query_classifier.h"
+#include "dns/cache_key.h"
+#include "dns/dns_packet.h"
+#include "dns/dns_packet_view.h"
+#include "dns/name_kernels.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace {
+
+// reads the `count` additional records at `pos` of `message` for the
+// payload size of an OPT record, nullopt if they are malformed
+std::optional<uint16_t> read_udp_payload_size(std::span<const uint8_t> message,
+                                              size_t pos, int count) {
+  uint16_t payload_size = kMinUDPPayloadSize;
+  for (int i = 0; i < count; i++) {
+    // OPT is owned by the root name, other records may point to the
+    // question
+    size_t name_size = pos < message.size() && (message[pos] & 0xc0) == 0xc0
+                           ? 2
+                           : wire_name_size(message.subspan(pos));
+    if (name_size == 0 || message.size() - pos < name_size + 10) {
+      return {};
+    }
+    const uint8_t *fields = message.data() + pos + name_size;
+    if (read_u16_from_net(fields) == kTypeOPT) {
+      payload_size =
+          std::max(read_u16_from_net(fields + 2), kMinUDPPayloadSize);
+    }
+    pos += name_size + 10 + read_u16_from_net(fields + 8);
+    if (pos > message.size()) {
+      return {};
+    }
+  }
+  return payload_size;
+}
+
+} // namespace
+
+std::optional<ClassifiedQuery>
+classify_query(std::span<const uint8_t> message) {
+  if (message.size() < kHeaderSize) {
+    return {};
+  }
+  const uint8_t *header = message.data();
+  // QR, opcode and TC are in the third byte
+  constexpr const uint8_t kQrOpcodeTc = 0xfa;
+  if ((header[2] & kQrOpcodeTc) != 0 || read_u16_from_net(header + 4) != 1 ||
+      read_u16_from_net(header + 6) != 0 ||
+      read_u16_from_net(header + 8) != 0) {
+    return {};
+  }
+  size_t question_end = 0;
+  auto key = CacheKey::FromQuestionAt(message, kHeaderSize, &question_end);
+  if (!key) {
+    return {};
+  }
+  auto payload_size = read_udp_payload_size(message, question_end,
+                                            read_u16_from_net(header + 10));
+  if (!payload_size) {
+    return {};
+  }
+  ClassifiedQuery query{{}, std::move(*key), question_end, *payload_size};
+  query.header.id = read_u16_from_net(header);
+  query.header.flag.from_host(read_u16_from_net(header + 2));
+  return query;
+}
+
+bool TestQueryClassifier() {
+  // www.example.test A
+  const std::vector<uint8_t> question{
+      0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l',
+      'e',  0x04, 't', 'e', 's',  't', 0x00, 0x00, 0x01, 0x00, 0x01};
+  // an A record owned by the question name
+  const std::vector<uint8_t> record{0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+                                    0x00, 0x00, 0x01, 0x2c, 0x00, 0x04,
+                                    192,  0,    2,    1};
+  auto opt = [](uint16_t payload_size) {
+    return std::vector<uint8_t>{0x00, 0x00, 0x29, uint8_t(payload_size >> 8),
+                                uint8_t(payload_size), 0x00, 0x00, 0x00,
+                                0x00, 0x00, 0x00};
+  };
+  struct Case {
+    const char *name;
+    uint16_t flags;
+    std::vector<std::vector<uint8_t>> sections[4];
+  };
+  const Case kCases[] = {
+      {"query", kStandardQuery, {{question}, {}, {}, {}}},
+      {"response", kStandardResponse, {{question}, {}, {}, {}}},
+      {"QR alone", 0x8000, {{question}, {}, {}, {}}},
+      {"opcode STATUS", 0x1100, {{question}, {}, {}, {}}},
+      {"opcode IQUERY", 0x0900, {{question}, {}, {}, {}}},
+      {"TC", 0x0300, {{question}, {}, {}, {}}},
+      {"AA and RA", 0x0580, {{question}, {}, {}, {}}},
+      {"no question", kStandardQuery, {{}, {}, {}, {}}},
+      {"two questions", kStandardQuery, {{question, question}, {}, {}, {}}},
+      {"an answer", kStandardQuery, {{question}, {record}, {}, {}}},
+      {"an authority record", kStandardQuery, {{question}, {}, {record}, {}}},
+      {"OPT 4096", kStandardQuery, {{question}, {}, {}, {opt(4096)}}},
+      {"OPT 1232", kStandardQuery, {{question}, {}, {}, {opt(1232)}}},
+      {"OPT 256", kStandardQuery, {{question}, {}, {}, {opt(256)}}},
+      {"OPT after a record",
+       kStandardQuery,
+       {{question}, {}, {}, {record, opt(4096)}}},
+      {"a record after OPT",
+       kStandardQuery,
+       {{question}, {}, {}, {opt(1400), record}}},
+  };
+
+  int accepted = 0;
+  for (const Case &c : kCases) {
+    std::vector<uint8_t> message(kHeaderSize);
+    write_u16_to_net(message.data(), 0x4242);
+    write_u16_to_net(message.data() + 2, c.flags);
+    for (int section = 0; section < 4; section++) {
+      write_u16_to_net(message.data() + 4 + 2 * section,
+                       c.sections[section].size());
+      for (const auto &part : c.sections[section]) {
+        message.insert(message.end(), part.begin(), part.end());
+      }
+    }
+    // cut at every length, which truncates the header, the question and
+    // each of the records in turn
+    for (size_t size = 0; size <= message.size(); size++) {
+      std::span<const uint8_t> cut(message.data(), size);
+      auto view = DNSPacketView::Parse(cut);
+      bool expected = false;
+      if (view) {
+        dns_header header = view->header();
+        expected = header.flag.qr == 0 && header.flag.opcode == 0 &&
+                   header.flag.tc == 0 && view->get_qdcount() == 1 &&
+                   view->get_ancount() == 0 && view->get_nscount() == 0;
+      }
+      auto query = classify_query(cut);
+      if (query.has_value() != expected) {
+        printf("%s, %zu of %zu bytes: %s by the classifier only\n", c.name,
+               size, message.size(), query ? "accepted" : "rejected");
+        return false;
+      }
+      if (!query) {
+        continue;
+      }
+      accepted++;
+      auto key = CacheKey::FromQuestion(view->raw_questions());
+      if (!key || !(query->key == *key) ||
+          query->question_end != kHeaderSize + view->raw_questions().size() ||
+          query->header.id != view->id() ||
+          query->header.flag.to_host() != view->header().flag.to_host()) {
+        printf("%s, %zu bytes: question classified wrong\n", c.name, size);
+        return false;
+      }
+      if (query->udp_payload_size != view->udp_payload_size()) {
+        printf("%s, %zu bytes: payload size %u, %u by the view\n", c.name,
+               size, query->udp_payload_size, view->udp_payload_size());
+        return false;
+      }
+    }
+  }
+  // the complete query, AA and RA, and the five with additional records
+  if (accepted != 7) {
+    printf("%d cuts accepted, 7 expected\n", accepted);
+    return false;
+  }
+  return true;
+}
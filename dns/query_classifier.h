@@ -0,0 +1,49 @@
+#ifndef DNS_QUERY_CLASSIFIER_H_
+#define DNS_QUERY_CLASSIFIER_H_
+
+#include "dns/cache_key.h"
+#include "dns/dns_packet.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+/*
+  The gateway only needs the header, the question and its cache key to
+  answer a query from the cache. `classify_query` reads exactly these: the
+  12 bytes of the header, then the question, whose name is checked by
+  hopping over its length bytes and copied lowercased into the key. Of the
+  additional records after the question, only the type and class are read,
+  for the UDP payload size of an EDNS OPT record.
+
+  example:
+
+    if (auto query = classify_query(buffer.span())) {
+      if (dns_cache->query(query->key, answer)) {
+        ReplyFromCache(query->header.id, query->question(buffer.span()), ...);
+      }
+    }
+
+*/
+struct ClassifiedQuery {
+  dns_header header;
+  CacheKey key;
+  // offset of the end of the question, from the start of the message
+  size_t question_end;
+  // the largest reply the client accepts over UDP, see
+  // `DNSPacketView::udp_payload_size`
+  uint16_t udp_payload_size;
+
+  std::span<const uint8_t> question(std::span<const uint8_t> message) const {
+    return message.subspan(kHeaderSize, question_end - kHeaderSize);
+  }
+};
+
+// returns nullopt unless `message` is a query (QR 0, opcode QUERY, TC 0)
+// of exactly one uncompressed question, without answer or authority
+// records, and with well-formed additional records
+std::optional<ClassifiedQuery> classify_query(std::span<const uint8_t> message);
+
+bool TestQueryClassifier();
+
+#endif
@@ -0,0 +1,184 @@
+#include "dns/response_writer.h"
+#include "dns/dns_packet.h"
+#include "dns/name_compressor.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+bool ResponseWriter::Reserve(size_t size) {
+  if (failed_ || buffer_.size() - size_ < size) {
+    failed_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool ResponseWriter::WriteHeader(const dns_header &header, uint16_t qdcount,
+                                 uint16_t ancount, uint16_t nscount) {
+  if (size_ != 0 || !Reserve(kHeaderSize)) {
+    failed_ = true;
+    return false;
+  }
+  uint8_t *p = buffer_.data();
+  write_u16_to_net(p, header.id);
+  write_u16_to_net(p + 2, header.flag.to_host());
+  write_u16_to_net(p + 4, qdcount);
+  write_u16_to_net(p + 6, ancount);
+  write_u16_to_net(p + 8, nscount);
+  write_u16_to_net(p + 10, 0);
+  size_ = kHeaderSize;
+  return true;
+}
+
+bool ResponseWriter::WriteQuestion(std::span<const uint8_t> question) {
+  if (size_ != kHeaderSize || !Reserve(question.size())) {
+    failed_ = true;
+    return false;
+  }
+  memcpy(buffer_.data() + size_, question.data(), question.size());
+  size_ += question.size();
+  return true;
+}
+
+bool ResponseWriter::WriteCompressedRecords(std::span<const uint8_t> records,
+                                            size_t records_offset) {
+  if (size_ != records_offset || !Reserve(records.size())) {
+    failed_ = true;
+    return false;
+  }
+  memcpy(buffer_.data() + size_, records.data(), records.size());
+  size_ += records.size();
+  return true;
+}
+
+std::optional<std::span<uint8_t>> ResponseWriter::Finish() const {
+  if (failed_) {
+    return {};
+  }
+  return buffer_.first(size_);
+}
+
+bool TestResponseWriterCapacity() {
+  constexpr const size_t kGuard = 16;
+  constexpr const uint8_t kGuardByte = 0xa5;
+  std::mt19937 rng(20240709);
+  const std::string_view kLabels[] = {"www",  "mail", "a",   "example",
+                                      "test", "cdn",  "net", "com"};
+  auto append_name = [&](std::vector<uint8_t> &out) {
+    for (int labels = rng() % 4; labels > 0; labels--) {
+      std::string_view label = kLabels[rng() % std::size(kLabels)];
+      out.push_back(label.size());
+      out.insert(out.end(), label.begin(), label.end());
+    }
+    out.push_back(0);
+  };
+  auto append_u16 = [](std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value);
+  };
+
+  dns_header header{};
+  header.id = 0x4242;
+  header.flag.from_host(kStandardResponse);
+  for (int round = 0; round < 2000; round++) {
+    // A and CNAME records, whose names share labels with the question
+    int count = 1 + rng() % 6;
+    std::vector<uint8_t> records;
+    for (int i = 0; i < count; i++) {
+      append_name(records);
+      uint16_t type = rng() % 2 ? kTypeCNAME : 1;
+      append_u16(records, type);
+      append_u16(records, 1);
+      append_u16(records, 0);
+      append_u16(records, 300);
+      std::vector<uint8_t> rdata = {192, 0, 2, 1};
+      if (type == kTypeCNAME) {
+        rdata.clear();
+        append_name(rdata);
+      }
+      append_u16(records, rdata.size());
+      records.insert(records.end(), rdata.begin(), rdata.end());
+    }
+    std::vector<uint8_t> question;
+    append_name(question);
+    append_u16(question, 1);
+    append_u16(question, 1);
+
+    // the records compressed after the question, as the cache stores them
+    size_t records_offset = kHeaderSize + question.size();
+    std::vector<uint8_t> message(records_offset + records.size());
+    std::copy(question.begin(), question.end(),
+              message.begin() + kHeaderSize);
+    NameCompressor compressor(message);
+    compressor.Remember(kHeaderSize);
+    auto compressed_size = write_compressed_records(
+        compressor, records_offset, records, count, nullptr);
+    if (!compressed_size) {
+      printf("round %d: records not compressed\n", round);
+      return false;
+    }
+    std::span<const uint8_t> compressed(message.data() + records_offset,
+                                        *compressed_size);
+
+    std::vector<uint8_t> buffer(records_offset + records.size() + kGuard);
+    std::vector<uint8_t> full;
+    {
+      ResponseWriter writer(buffer);
+      writer.WriteHeader(header, 1, count, 0);
+      writer.WriteQuestion(question);
+      writer.WriteCompressedRecords(compressed, records_offset);
+      auto reply = writer.Finish();
+      if (!reply || !std::equal(reply->begin() + kHeaderSize, reply->end(),
+                                message.begin() + kHeaderSize,
+                                message.begin() + records_offset +
+                                    *compressed_size)) {
+        printf("round %d: wrong reply with room for it\n", round);
+        return false;
+      }
+      full.assign(reply->begin(), reply->end());
+    }
+    // records compressed for another question are refused
+    {
+      ResponseWriter writer(buffer);
+      writer.WriteHeader(header, 1, count, 0);
+      writer.WriteQuestion(question);
+      if (writer.WriteCompressedRecords(compressed, records_offset + 1) ||
+          writer.Finish()) {
+        printf("round %d: records written at the wrong offset\n", round);
+        return false;
+      }
+    }
+    // every capacity up to the uncompressed size: a reply is the same at
+    // every capacity it is written at, one is written whenever it fits, and
+    // nothing is written past the capacity
+    size_t uncompressed_size = records_offset + records.size();
+    for (size_t capacity = 0; capacity <= uncompressed_size; capacity++) {
+      std::fill(buffer.begin(), buffer.end(), kGuardByte);
+      auto room = std::span<uint8_t>(buffer).first(capacity);
+      ResponseWriter writer(room);
+      writer.WriteHeader(header, 1, count, 0);
+      writer.WriteQuestion(question);
+      writer.WriteCompressedRecords(compressed, records_offset);
+      auto reply = writer.Finish();
+      if (reply ? !std::equal(reply->begin(), reply->end(), full.begin(),
+                              full.end())
+                : capacity >= full.size()) {
+        printf("round %d: wrong reply with capacity %zu\n", round, capacity);
+        return false;
+      }
+      if (std::any_of(buffer.begin() + capacity, buffer.end(),
+                      [](uint8_t b) { return b != kGuardByte; })) {
+        printf("round %d: written past capacity %zu\n", round, capacity);
+        return false;
+      }
+    }
+  }
+  return true;
+}
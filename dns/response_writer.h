@@ -0,0 +1,71 @@
+#ifndef DNS_RESPONSE_WRITER_H_
+#define DNS_RESPONSE_WRITER_H_
+
+#include "dns/dns_packet.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+/*
+  `ResponseWriter` builds a response in place, in a buffer of fixed
+  capacity owned by the caller such as a `base::PacketBuffer`. The header
+  is written field by field, and the question and the records are copied
+  straight into the buffer. The records come compressed already, by
+  `write_compressed_records` when they were cached, for a reply whose
+  question is as long as the one written. Every write is checked against
+  the capacity, so building a reply allocates nothing and copies every
+  part once. A failed write leaves the writer failed, and `Finish` then
+  returns nullopt.
+
+  example:
+
+    auto buffer = base::PacketBuffer::Allocate();
+    ResponseWriter writer({buffer.data(), base::PacketBuffer::kCapacity});
+    writer.WriteHeader(header, 1, ancount, nscount);
+    writer.WriteQuestion(question);
+    writer.WriteCompressedRecords(answer.raw_answers, answer.answers_offset);
+    if (auto reply = writer.Finish()) {
+      buffer.resize(reply->size());
+      udp_socket.SendTo(*reply, addr);
+    }
+
+*/
+class ResponseWriter {
+public:
+  explicit ResponseWriter(std::span<uint8_t> buffer) : buffer_(buffer) {}
+
+  // the first write of a response, there are no additional records
+  bool WriteHeader(const dns_header &header, uint16_t qdcount,
+                   uint16_t ancount, uint16_t nscount);
+
+  // `question` is one or more questions in wire format
+  bool WriteQuestion(std::span<const uint8_t> question);
+
+  // copies `records`, compressed for a response in which they start at
+  // `records_offset`. fails unless the header and the question written
+  // end there
+  bool WriteCompressedRecords(std::span<const uint8_t> records,
+                              size_t records_offset);
+
+  // the response written so far, nullopt if a write failed
+  std::optional<std::span<uint8_t>> Finish() const;
+
+  size_t size() const { return size_; }
+
+  ResponseWriter(const ResponseWriter &) = delete;
+  ResponseWriter &operator=(const ResponseWriter &) = delete;
+
+private:
+  // returns false, and fails the writer, unless `size` bytes fit
+  bool Reserve(size_t size);
+
+private:
+  std::span<uint8_t> buffer_;
+  size_t size_ = 0;
+  bool failed_ = false;
+};
+
+bool TestResponseWriterCapacity();
+
+#endif
@@ -0,0 +1,182 @@
+#include "dns/rrset.h"
+#include "dns/cache_key.h"
+#include "dns/dns_packet.h"
+#include "dns/name_kernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// including the length bytes and the root label
+constexpr const size_t kMaxNameSize = 255;
+// a name of 255 bytes has at most 127 labels, each reached by at most one
+// pointer
+constexpr const int kMaxPointers = 127;
+
+// uncompresses the names of the data of `type` found at `*pos` of `message`,
+// appending them and the other fields to `rdata`
+bool read_uncompressed_rdata(std::span<const uint8_t> message, size_t *pos,
+                             size_t rdlength, uint16_t type,
+                             std::vector<uint8_t> &rdata) {
+  size_t end = *pos + rdlength;
+  auto layout = rdata_names(type);
+  if (!layout) {
+    rdata.assign(message.begin() + *pos, message.begin() + end);
+    *pos = end;
+    return true;
+  }
+  auto [prefix_size, names, suffix_size] = *layout;
+  if (prefix_size > rdlength) {
+    return false;
+  }
+  rdata.assign(message.begin() + *pos, message.begin() + *pos + prefix_size);
+  *pos += prefix_size;
+  for (int i = 0; i < names; i++) {
+    if (!read_uncompressed_name(message.first(end), pos, rdata)) {
+      return false;
+    }
+  }
+  if (end - *pos != suffix_size) {
+    return false;
+  }
+  rdata.insert(rdata.end(), message.begin() + *pos, message.begin() + end);
+  *pos = end;
+  return true;
+}
+
+} // namespace
+
+std::optional<RdataNames> rdata_names(uint16_t type) {
+  switch (type) {
+  case kTypeNS:
+  case kTypeCNAME:
+  case kTypePTR:
+    return RdataNames{0, 1, 0};
+  case kTypeMX:
+    return RdataNames{2, 1, 0};
+  case kTypeSOA:
+    return RdataNames{0, 2, 20};
+  default:
+    return {};
+  }
+}
+
+bool read_uncompressed_name(std::span<const uint8_t> message, size_t *pos,
+                            std::vector<uint8_t> &name) {
+  size_t p = *pos;
+  size_t name_size = 0;
+  bool jumped = false;
+  for (int pointers = 0; pointers <= kMaxPointers;) {
+    if (p >= message.size()) {
+      return false;
+    }
+    uint8_t label_size = message[p];
+    if ((label_size & 0xc0) == 0xc0) {
+      if (p + 1 >= message.size()) {
+        return false;
+      }
+      if (!jumped) {
+        *pos = p + 2;
+        jumped = true;
+      }
+      p = (label_size & 0x3f) << 8 | message[p + 1];
+      pointers++;
+      continue;
+    }
+    // the extended label types are obsolete
+    if (label_size & 0xc0) {
+      return false;
+    }
+    name_size += 1 + label_size;
+    if (p + 1 + label_size > message.size() || name_size > kMaxNameSize) {
+      return false;
+    }
+    name.insert(name.end(), message.begin() + p,
+                message.begin() + p + 1 + label_size);
+    p += 1 + label_size;
+    if (label_size == 0) {
+      if (!jumped) {
+        *pos = p;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+std::optional<std::vector<UncompressedRecord>>
+read_uncompressed_records(std::span<const uint8_t> message, size_t *pos,
+                          int count) {
+  std::vector<UncompressedRecord> records;
+  records.reserve(count);
+  std::vector<uint8_t> rdata;
+  for (int i = 0; i < count; i++) {
+    UncompressedRecord record;
+    if (!read_uncompressed_name(message, pos, record.wire) ||
+        message.size() - *pos < 10) {
+      return {};
+    }
+    size_t owner_size = record.wire.size();
+    const uint8_t *fields = message.data() + *pos;
+    uint16_t type = read_u16_from_net(fields);
+    uint16_t rr_class = read_u16_from_net(fields + 2);
+    record.ttl = read_u32_from_net(fields + 4);
+    size_t rdlength = read_u16_from_net(fields + 8);
+    *pos += 10;
+    if (message.size() - *pos < rdlength ||
+        !read_uncompressed_rdata(message, pos, rdlength, type, rdata) ||
+        rdata.size() > UINT16_MAX) {
+      return {};
+    }
+    auto key = CacheKey::FromName(record.wire, type, rr_class);
+    if (!key) {
+      return {};
+    }
+    record.key = std::move(*key);
+    record.ttl_offset = owner_size + 4;
+    record.wire.insert(record.wire.end(), fields, fields + 8);
+    record.wire.resize(record.wire.size() + 2);
+    write_u16_to_net(record.wire.data() + owner_size + 8, rdata.size());
+    record.wire.insert(record.wire.end(), rdata.begin(), rdata.end());
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+std::vector<RRset> group_rrsets(std::vector<UncompressedRecord> records) {
+  std::vector<RRset> rrsets;
+  for (UncompressedRecord &record : records) {
+    // answers hold a few RRsets, a linear search is fine
+    auto iter = std::find_if(
+        rrsets.begin(), rrsets.end(),
+        [&](const RRset &rrset) { return rrset.key == record.key; });
+    if (iter == rrsets.end()) {
+      iter = rrsets.insert(rrsets.end(), RRset{std::move(record.key), {}, {}});
+    }
+    iter->ttl_offsets.push_back(iter->records.size() + record.ttl_offset);
+    iter->records.insert(iter->records.end(), record.wire.begin(),
+                         record.wire.end());
+    iter->count++;
+    iter->ttl = std::min(iter->ttl, record.ttl);
+  }
+  return rrsets;
+}
+
+std::optional<std::span<const uint8_t>>
+cname_target(std::span<const uint8_t> records) {
+  // owner name, then type, class, TTL and RDLENGTH
+  size_t owner_size = wire_name_size(records);
+  if (owner_size == 0 || records.size() < owner_size + 10) {
+    return {};
+  }
+  auto rdata = records.subspan(owner_size + 10);
+  size_t target_size = wire_name_size(rdata);
+  if (target_size == 0) {
+    return {};
+  }
+  return rdata.first(target_size);
+}
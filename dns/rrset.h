@@ -0,0 +1,84 @@
+#ifndef DNS_RRSET_H_
+#define DNS_RRSET_H_
+
+#include "dns/cache_key.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/*
+  Answers are cached as RRsets, the records of a message sharing the same
+  owner name, type and class. Names in messages may be compressed into
+  pointers to other names of the same message, so the records of an RRset
+  are copied out with their names uncompressed, and can be copied into any
+  other message as is.
+
+  example:
+
+    size_t pos = answers_offset;
+    if (auto records = read_uncompressed_records(message, &pos, ancount)) {
+      for (RRset &rrset : group_rrsets(*records)) {
+        ...
+      }
+    }
+
+*/
+
+// a resource record with its names uncompressed
+struct UncompressedRecord {
+  // owner name, type and class
+  CacheKey key;
+  uint32_t ttl;
+  // the record in wire format: owner name, type, class, TTL, RDLENGTH, RDATA
+  std::vector<uint8_t> wire;
+  uint16_t ttl_offset;
+};
+
+// the records of one owner name, type and class
+struct RRset {
+  CacheKey key;
+  // concatenated in wire format
+  std::vector<uint8_t> records;
+  std::vector<uint16_t> ttl_offsets;
+  uint16_t count = 0;
+  // the lowest TTL of the records
+  uint32_t ttl = UINT32_MAX;
+};
+
+// where the names are in the data of a type whose names may be compressed
+struct RdataNames {
+  // bytes of the fields of fixed size before and after the names
+  size_t prefix_size;
+  int count;
+  size_t suffix_size;
+};
+
+// the names of the data of NS, CNAME, SOA, PTR and MX records, nullopt for
+// the other types, which never compress them (RFC 3597)
+std::optional<RdataNames> rdata_names(uint16_t type);
+
+// appends the name at `*pos` of `message` to `name`, following compression
+// pointers, and moves `*pos` past the name.
+// returns false if the name is malformed
+bool read_uncompressed_name(std::span<const uint8_t> message, size_t *pos,
+                            std::vector<uint8_t> &name);
+
+// reads `count` records from `*pos` of `message` and moves `*pos` past them.
+// the names in the data of NS, CNAME, SOA, PTR and MX records are
+// uncompressed as well, other types never compress them (RFC 3597).
+// returns nullopt if a record is malformed
+std::optional<std::vector<UncompressedRecord>>
+read_uncompressed_records(std::span<const uint8_t> message, size_t *pos,
+                          int count);
+
+// groups `records` by owner name, type and class, in order of appearance
+std::vector<RRset> group_rrsets(std::vector<UncompressedRecord> records);
+
+// the target name of the first record of the CNAME records in `records`,
+// as found in `RRset::records`
+std::optional<std::span<const uint8_t>>
+cname_target(std::span<const uint8_t> records);
+
+#endif
@@ -1,21 +1,38 @@
 #include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
 #include <set>
 #include <string>
-#include <tuple>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "base/logging.h"
+#include "base/memory/packet_buffer.h"
 #include "base/mpsc.h"
 #include "base/threading/thread_pool.h"
 #include "dns/dns_packet.h"
+#include "dns/dns_packet_view.h"
+#include "dns/name_compressor.h"
+#include "dns/name_kernels.h"
+#include "dns/response_writer.h"
+#include "dns/rrset.h"
 #include "dns_cache.h"
 #include "gateway.h"
 
@@ -23,83 +40,1994 @@ using namespace base::log_level;
 
 namespace {
 
+constexpr const size_t kInitialSlots = 16;
+// max number of expiration records popped by `clean` under one lock of a
+// shard
+constexpr const size_t kCleanSliceSize = 128;
+constexpr const std::chrono::seconds kCleanInterval(1);
+// S3-FIFO: share of the budget of a shard given to the small queue, in
+// percent
+constexpr const size_t kSmallQueuePercent = 10;
+// the counter of hits of an entry saturates at this value
+constexpr const uint8_t kMaxFreq = 3;
+// CNAME chains longer than this are neither cached nor served
+constexpr const int kMaxChainLength = 8;
+
 inline bool
 is_expired(const std::chrono::time_point<std::chrono::system_clock> &t) {
   return t < std::chrono::system_clock::now();
 }
 
+/*
+  Snapshot format, integers in network byte order:
+
+    "DNSCSNAP" version(u32)
+    then records until the end of the file:
+      expire_time(i64 ms since epoch) store_time(i64 ms since epoch)
+      question size(u16) ancount(u16) nscount(u16) rcode(u8)
+      target size(u8) number of TTL offsets(u16) number of pointer
+      offsets(u16) target offset(u16) size of the records(u32)
+      question(wire format) TTL offsets(u16 each) pointer offsets(u16 each)
+      target(wire format) records
+
+  The question is the canonical name of the key, its qtype and qclass. The
+  records are compressed as they are cached, the target is the name a
+  CNAME entry aliases.
+*/
+constexpr const char kSnapshotMagic[8] = {'D', 'N', 'S', 'C',
+                                          'S', 'N', 'A', 'P'};
+constexpr const uint32_t kSnapshotVersion = 3;
+constexpr const size_t kSnapshotHeaderSize = sizeof(kSnapshotMagic) + 4;
+constexpr const size_t kSnapshotRecordHeaderSize = 34;
+
+int64_t to_unix_ms(std::chrono::time_point<std::chrono::system_clock> t) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+std::chrono::time_point<std::chrono::system_clock> from_unix_ms(int64_t ms) {
+  return std::chrono::time_point<std::chrono::system_clock>(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::milliseconds(ms)));
+}
+
+// the offset of the data of the first of the compressed `records`, which
+// are well formed
+size_t first_rdata_offset(std::span<const uint8_t> records) {
+  size_t pos = 0;
+  while (records[pos] != 0 && (records[pos] & 0xc0) != 0xc0) {
+    pos += 1 + records[pos];
+  }
+  // the root label, or a pointer ending the name
+  pos += records[pos] == 0 ? 1 : 2;
+  // type, class, TTL and RDLENGTH
+  return pos + 10;
+}
+
 }; // namespace
 
 using namespace std::chrono_literals;
-DNSCache::DNSCache(std::weak_ptr<Gateway> gateway)
-    : gateway_(gateway), clean_timer_([] {}, 100s) {}
-
-std::optional<std::pair<int, std::vector<uint8_t>>>
-DNSCache::query(const Key &key) {
-  std::lock_guard<std::mutex> lg(mutex_);
-
-  if (auto iter = mp_.find(key);
-      iter != mp_.end() && std::get<3>(iter->second).empty()) {
-    auto expire_time = std::get<2>(iter->second);
-    if (!is_expired(expire_time)) {
-      return {{std::get<0>(iter->second), std::get<1>(iter->second)}};
+DNSCache::DNSCache(std::weak_ptr<Gateway> gateway, DNSCacheOptions options)
+    : options_(options), gateway_(gateway) {
+  for (Shard &shard : shards_) {
+    shard.budget = options_.memory_budget / kShardCount;
+  }
+}
+
+void DNSCache::Initialize() {
+  if (!options_.snapshot_path.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    if (auto loaded = load_snapshot(options_.snapshot_path)) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start);
+      base::log(INFO, "{} record(s) loaded from snapshot in {} ms",
+                static_cast<int>(*loaded),
+                static_cast<int64_t>(elapsed.count()));
+    }
+    snapshot_timer_.emplace(
+        [cache_weak = weak_from_this()]() {
+          if (auto cache = cache_weak.lock();
+              cache && cache->dirty_.exchange(false) &&
+              !cache->save_snapshot(cache->options_.snapshot_path)) {
+            cache->dirty_ = true;
+          }
+        },
+        options_.snapshot_interval);
+    snapshot_timer_->Start();
+  }
+  clean_timer_.emplace(
+      [cache_weak = weak_from_this()]() {
+        if (auto cache = cache_weak.lock()) {
+          cache->clean();
+        }
+      },
+      kCleanInterval);
+  clean_timer_->Start();
+}
+
+void DNSCache::Answer::Clear() {
+  ancount = 0;
+  raw_answers.clear();
+  ttl_offsets.clear();
+  answers_offset = 0;
+  refresh = false;
+  stale_ttl.reset();
+  nscount = 0;
+  rcode = 0;
+}
+
+bool DNSCache::Entry::Matches(const Key &key) const {
+  return hash == key.hash() && qtype == key.qtype() &&
+         qclass == key.qclass() && name_size == key.name().size() &&
+         memcmp(name().data(), key.name().data(), name_size) == 0;
+}
+
+bool DNSCache::AppendAnswer(const Entry &entry, TimePoint now, bool stale,
+                            Answer &answer) {
+  auto expire_time = entry.expire_time;
+  if (expire_time < now) {
+    if (!stale || expire_time + options_.stale_window < now) {
+      return false;
+    }
+    answer.stale_ttl = options_.stale_ttl;
+  }
+  auto records = entry.records();
+  size_t base = answer.raw_answers.size();
+  answer.raw_answers.insert(answer.raw_answers.end(), records.begin(),
+                            records.end());
+  // the TTLs count down while the records are cached
+  auto age =
+      std::chrono::duration_cast<std::chrono::seconds>(now - entry.store_time);
+  decrement_ttls(answer.raw_answers.data() + base, entry.ttl_offsets(),
+                 static_cast<uint32_t>(std::max<int64_t>(age.count(), 0)));
+  for (uint16_t offset : entry.ttl_offsets()) {
+    answer.ttl_offsets.push_back(base + offset);
+  }
+  answer.ancount += entry.ancount;
+  answer.nscount = entry.nscount;
+  answer.rcode = entry.rcode;
+  return true;
+}
+
+// static
+bool DNSCache::Relocate(const Entry &entry, const Key &key, size_t name_offset,
+                        size_t base, Answer &answer) {
+  // the records were compressed after a question of the name of `entry`,
+  // whose labels are found where the name is in the reply. indexed by the
+  // offsets of the labels in the name, 0 elsewhere
+  std::array<uint16_t, 256> labels = {};
+  size_t question_end = kHeaderSize + key.name().size();
+  size_t records_end = answer.answers_offset + base;
+  size_t pos = name_offset;
+  for (size_t in_name = 0;;) {
+    const uint8_t *p;
+    if (pos >= kHeaderSize && pos < question_end) {
+      p = key.name().data() + pos - kHeaderSize;
+    } else if (pos >= answer.answers_offset && pos < records_end) {
+      p = answer.raw_answers.data() + pos - answer.answers_offset;
     } else {
-      base::log(INFO, "record expired");
+      return false;
     }
+    if ((*p & 0xc0) == 0xc0) {
+      // pointers only point backwards, the walk ends
+      size_t target = read_u16_from_net(p) & 0x3fff;
+      if (target >= pos) {
+        return false;
+      }
+      pos = target;
+      continue;
+    }
+    if (in_name >= entry.name_size) {
+      return false;
+    }
+    labels[in_name] = pos;
+    if (*p == 0) {
+      break;
+    }
+    in_name += 1 + *p;
+    pos += 1 + *p;
   }
 
-  return {};
+  size_t origin = kHeaderSize + entry.name_size + 4;
+  for (uint16_t offset : entry.pointer_offsets()) {
+    uint8_t *pointer = answer.raw_answers.data() + base + offset;
+    size_t target = read_u16_from_net(pointer) & 0x3fff;
+    size_t moved = 0;
+    if (target >= origin) {
+      moved = records_end + target - origin;
+    } else if (target >= kHeaderSize &&
+               target - kHeaderSize < entry.name_size) {
+      moved = labels[target - kHeaderSize];
+    }
+    if (moved == 0 || moved > 0x3fff) {
+      return false;
+    }
+    write_u16_to_net(pointer, 0xc000 | moved);
+  }
+  return true;
 }
 
-std::optional<std::pair<int, std::vector<uint8_t>>>
-DNSCache::query_or_register_callback(const Key &key,
-                                     std::function<void()> &&cb) {
-  std::lock_guard<std::mutex> lg(mutex_);
+void DNSCache::Touch(Entry &entry, TimePoint now, Answer &answer) {
+  entry.freq = std::min<uint8_t>(entry.freq + 1, kMaxFreq);
+  entry.hits++;
+  if (!entry.refreshing && entry.hits >= options_.prefetch_min_hits &&
+      entry.expire_time - now <
+          (entry.expire_time - entry.store_time) *
+              options_.prefetch_threshold) {
+    entry.refreshing = true;
+    answer.refresh = true;
+  }
+}
+
+void DNSCache::Touch(std::span<const Visit> visits, TimePoint now,
+                     Answer &answer) {
+  for (const Visit &visit : visits) {
+    std::lock_guard<std::mutex> lg(visit.shard->mutex);
+    // the entry may have been removed or replaced since it was copied
+    if (visit.index >= visit.shard->entries.size()) {
+      continue;
+    }
+    Entry &entry = visit.shard->entries[visit.index];
+    if (entry.hash == visit.hash && entry.store_time == visit.store_time &&
+        entry.expire_time >= now) {
+      Touch(entry, now, answer);
+    }
+  }
+}
 
-  if (auto iter = mp_.find(key);
-      iter != mp_.end() && std::get<3>(iter->second).empty()) {
-    auto expire_time = std::get<2>(iter->second);
-    if (!is_expired(expire_time)) {
-      return {{std::get<0>(iter->second), std::get<1>(iter->second)}};
+// static
+void DNSCache::AppendSnapshotRecord(std::vector<uint8_t> &out,
+                                    const Entry &entry) {
+  size_t question_size = entry.name_size + 4;
+  size_t begin = out.size();
+  out.resize(begin + kSnapshotRecordHeaderSize + question_size +
+             (entry.offset_count + entry.pointer_count) * 2 +
+             entry.target_size + entry.records_size);
+  uint8_t *p = out.data() + begin;
+  write_u64_to_net(p, to_unix_ms(entry.expire_time));
+  write_u64_to_net(p + 8, to_unix_ms(entry.store_time));
+  write_u16_to_net(p + 16, question_size);
+  write_u16_to_net(p + 18, entry.ancount);
+  write_u16_to_net(p + 20, entry.nscount);
+  p[22] = entry.rcode;
+  p[23] = entry.target_size;
+  write_u16_to_net(p + 24, entry.offset_count);
+  write_u16_to_net(p + 26, entry.pointer_count);
+  write_u16_to_net(p + 28, entry.target_offset);
+  write_u32_to_net(p + 30, entry.records_size);
+  p += kSnapshotRecordHeaderSize;
+  std::copy(entry.name().begin(), entry.name().end(), p);
+  p += entry.name_size;
+  write_u16_to_net(p, entry.qtype);
+  write_u16_to_net(p + 2, entry.qclass);
+  p += 4;
+  for (auto offsets : {entry.ttl_offsets(), entry.pointer_offsets()}) {
+    for (uint16_t offset : offsets) {
+      write_u16_to_net(p, offset);
+      p += 2;
+    }
+  }
+  p = std::copy(entry.target().begin(), entry.target().end(), p);
+  std::copy(entry.records().begin(), entry.records().end(), p);
+}
+
+std::optional<size_t> DNSCache::Shard::FindSlot(const Key &key) const {
+  if (slots.empty()) {
+    return {};
+  }
+  uint64_t hash = key.hash();
+  uint32_t tag = hash >> 32;
+  size_t mask = slots.size() - 1;
+  // the low bits of the hash picked the shard, start from other bits
+  for (size_t i = (hash >> 8) & mask;; i = (i + 1) & mask) {
+    const Slot &slot = slots[i];
+    if (slot.index == Slot::kEmpty) {
+      return {};
+    }
+    if (slot.tag == tag && entries[slot.index].Matches(key)) {
+      return i;
+    }
+  }
+}
+
+size_t DNSCache::Shard::SlotOf(uint32_t index) const {
+  size_t mask = slots.size() - 1;
+  size_t i = (entries[index].hash >> 8) & mask;
+  while (slots[i].index != index) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+DNSCache::Entry *DNSCache::Shard::Find(const Key &key) {
+  if (auto i = FindSlot(key)) {
+    return &entries[slots[*i].index];
+  }
+  return nullptr;
+}
+
+void DNSCache::Shard::Reserve(size_t n) {
+  entries.reserve(n);
+  expiry.reserve(n);
+  while (slots.size() * 3 < n * 4) {
+    Grow();
+  }
+}
+
+uint32_t DNSCache::Shard::Charge(const Entry &entry) {
+  return sizeof(Entry) + sizeof(Expiry) +
+         // slots are kept at most 3/4 full
+         sizeof(Slot) * 4 / 3 + base::SlabArena::SlotSize(entry.data_size());
+}
+
+void DNSCache::Shard::Store(uint32_t index, const Key &key,
+                            const Value &value) {
+  Entry &entry = entries[index];
+  if (entry.data) {
+    arena.Free(entry.data, entry.data_size());
+  }
+  entry.hash = key.hash();
+  entry.expire_time = value.expire_time;
+  entry.store_time = value.store_time;
+  entry.name_size = key.name().size();
+  entry.qtype = key.qtype();
+  entry.qclass = key.qclass();
+  entry.offset_count = value.ttl_offsets.size();
+  entry.pointer_count = value.pointer_offsets.size();
+  entry.target_size = value.target.size();
+  entry.target_offset = value.target_offset;
+  entry.records_size = value.records.size();
+  entry.ancount = value.ancount;
+  entry.nscount = value.nscount;
+  entry.rcode = value.rcode;
+  entry.data = arena.Allocate(entry.data_size());
+  uint8_t *p = entry.data;
+  memcpy(p, value.ttl_offsets.data(), entry.offset_count * sizeof(uint16_t));
+  p += entry.offset_count * sizeof(uint16_t);
+  memcpy(p, value.pointer_offsets.data(),
+         entry.pointer_count * sizeof(uint16_t));
+  p += entry.pointer_count * sizeof(uint16_t);
+  memcpy(p, key.name().data(), entry.name_size);
+  p += entry.name_size;
+  memcpy(p, value.target.data(), entry.target_size);
+  p += entry.target_size;
+  memcpy(p, value.records.data(), value.records.size());
+}
+
+void DNSCache::Shard::InsertOrAssign(const Key &key, const Value &value) {
+  TimePoint expire_at = value.expire_time;
+  if (Entry *found = Find(key)) {
+    Store(found - entries.data(), key, value);
+    found->refreshing = false;
+    found->hits = 0;
+    FifoQueue &fifo = GetQueue(found->queue);
+    fifo.bytes -= found->bytes;
+    found->bytes = Charge(*found);
+    fifo.bytes += found->bytes;
+    PushExpiry({expire_at, static_cast<uint32_t>(found - entries.data())});
+  } else {
+    if ((size + 1) * 4 > slots.size() * 3) {
+      Grow();
+    }
+    uint64_t hash = key.hash();
+    uint32_t tag = hash >> 32;
+    size_t mask = slots.size() - 1;
+    size_t i = (hash >> 8) & mask;
+    while (slots[i].index != Slot::kEmpty) {
+      i = (i + 1) & mask;
+    }
+
+    uint32_t index;
+    if (!free_entries.empty()) {
+      index = free_entries.back();
+      free_entries.pop_back();
     } else {
-      std::get<3>(iter->second).push_back(std::move(cb));
-      base::log(INFO, "record expired");
+      index = entries.size();
+      entries.emplace_back();
     }
+    Store(index, key, value);
+    Entry &entry = entries[index];
+    entry.bytes = Charge(entry);
+    entry.freq = 0;
+    entry.refreshing = false;
+    entry.hits = 0;
+    slots[i] = {tag, index};
+    size++;
+    PushExpiry({expire_at, index});
+
+    // a key evicted recently is not a one-hit wonder
+    if (ghost_set.erase(hash)) {
+      PushBack(index, Queue::kMain);
+    } else {
+      PushBack(index, Queue::kSmall);
+    }
+  }
+
+  while (small.bytes + main.bytes > budget && size > 0) {
+    Evict();
+  }
+}
+
+void DNSCache::Shard::PushExpiry(Expiry record) {
+  expiry.push_back(record);
+  std::push_heap(expiry.begin(), expiry.end(), std::greater<Expiry>());
+  // records of updated and evicted entries stay until they expire, drop
+  // them once they outnumber the live ones
+  if (expiry.size() > 2 * size + kInitialSlots) {
+    std::erase_if(expiry, [this](const Expiry &record) {
+      return entries[record.index].expire_time != record.expire_at;
+    });
+    std::make_heap(expiry.begin(), expiry.end(), std::greater<Expiry>());
+  }
+}
+
+void DNSCache::Shard::PushBack(uint32_t index, Queue queue) {
+  Entry &entry = entries[index];
+  FifoQueue &fifo = GetQueue(queue);
+  entry.queue = queue;
+  entry.prev = fifo.tail;
+  entry.next = Entry::kNil;
+  if (fifo.tail != Entry::kNil) {
+    entries[fifo.tail].next = index;
+  } else {
+    fifo.head = index;
+  }
+  fifo.tail = index;
+  fifo.bytes += entry.bytes;
+}
+
+void DNSCache::Shard::Unlink(uint32_t index) {
+  Entry &entry = entries[index];
+  FifoQueue &fifo = GetQueue(entry.queue);
+  if (entry.prev != Entry::kNil) {
+    entries[entry.prev].next = entry.next;
   } else {
-    Value value;
-    std::get<3>(value).push_back(std::move(cb));
-    mp_.insert({key, std::move(value)});
+    fifo.head = entry.next;
   }
+  if (entry.next != Entry::kNil) {
+    entries[entry.next].prev = entry.prev;
+  } else {
+    fifo.tail = entry.prev;
+  }
+  entry.prev = entry.next = Entry::kNil;
+  fifo.bytes -= entry.bytes;
+}
 
-  return {};
+void DNSCache::Shard::Evict() {
+  if (main.head == Entry::kNil ||
+      small.bytes * 100 > budget * kSmallQueuePercent) {
+    EvictSmall();
+  } else {
+    EvictMain();
+  }
 }
 
-void DNSCache::update(const DNSPacket &packet) {
-  std::lock_guard<std::mutex> lg(mutex_);
+void DNSCache::Shard::EvictSmall() {
+  uint32_t index = small.head;
+  Entry &entry = entries[index];
+  // hit while in the small queue, worth keeping
+  if (entry.freq > 0) {
+    Unlink(index);
+    entry.freq = 0;
+    PushBack(index, Queue::kMain);
+    return;
+  }
+  uint64_t hash = entry.hash;
+  EraseSlot(SlotOf(index));
+  RememberGhost(hash);
+}
 
-  if (packet.raw_answers.empty()) {
+void DNSCache::Shard::EvictMain() {
+  // every pass decrements the counters, so this ends within kMaxFreq + 1
+  // rounds of the queue
+  while (true) {
+    uint32_t index = main.head;
+    Entry &entry = entries[index];
+    if (entry.freq > 0) {
+      Unlink(index);
+      entry.freq--;
+      PushBack(index, Queue::kMain);
+      continue;
+    }
+    EraseSlot(SlotOf(index));
     return;
   }
+}
 
-  Key key = packet.raw_questions;
-  uint32_t min_ttl = 1e7;
-  for (const dns_answer &ans : packet.answers) {
-    min_ttl = std::min(min_ttl, ans.ttl);
+void DNSCache::Shard::RememberGhost(uint64_t hash) {
+  // as many ghosts as entries in the shard
+  while (!ghost.empty() && ghost.size() >= std::max<size_t>(size, 1)) {
+    ghost_set.erase(ghost.front());
+    ghost.pop();
+  }
+  if (ghost_set.insert(hash).second) {
+    ghost.push(hash);
   }
-  auto expire_at =
-      std::chrono::system_clock::now() + std::chrono::seconds(min_ttl);
-  Value value = {packet.get_ancount(), packet.raw_answers, expire_at, {}};
+}
+
+void DNSCache::Shard::EraseSlot(size_t i) {
+  uint32_t index = slots[i].index;
+  Unlink(index);
+  // the data of the entry goes back to the arena
+  arena.Free(entries[index].data, entries[index].data_size());
+  entries[index] = {};
+  free_entries.push_back(index);
+  size--;
 
-  if (auto iter = mp_.find(key); iter != mp_.end()) {
-    auto cbs = std::move(std::get<3>(iter->second));
-    iter->second = value;
-    for (auto &&cb : cbs) {
-      base::ThreadPool::GetInstance()->PostTask(std::move(cb));
+  // backward shift deletion: move up the following slots of the cluster
+  // which would not be reachable through the hole
+  size_t mask = slots.size() - 1;
+  for (size_t j = (i + 1) & mask; slots[j].index != Slot::kEmpty;
+       j = (j + 1) & mask) {
+    size_t home = (entries[slots[j].index].hash >> 8) & mask;
+    // the distance from home is kept if home lies cyclically in (i, j]
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slots[i] = slots[j];
+      i = j;
     }
-  } else {
-    mp_.insert({key, value});
+  }
+  slots[i] = {};
+}
+
+bool DNSCache::Shard::RemoveExpired(TimePoint now, size_t limit,
+                                    size_t *removed) {
+  for (size_t n = 0; n < limit; n++) {
+    if (expiry.empty() || expiry.front().expire_at >= now) {
+      return true;
+    }
+    Expiry top = expiry.front();
+    std::pop_heap(expiry.begin(), expiry.end(), std::greater<Expiry>());
+    expiry.pop_back();
+    // skip records outdated by an update or a removal
+    const Entry &entry = entries[top.index];
+    if (entry.expire_time != top.expire_at || !entry.data) {
+      continue;
+    }
+    EraseSlot(SlotOf(top.index));
+    (*removed)++;
+  }
+  return false;
+}
+
+void DNSCache::Shard::Grow() {
+  std::vector<Slot> old_slots(std::max(kInitialSlots, slots.size() * 2));
+  old_slots.swap(slots);
+  size_t mask = slots.size() - 1;
+  for (const Slot &slot : old_slots) {
+    if (slot.index == Slot::kEmpty) {
+      continue;
+    }
+    size_t i = (entries[slot.index].hash >> 8) & mask;
+    while (slots[i].index != Slot::kEmpty) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
   }
 }
 
-// TODO(lingsong.feng)
-void DNSCache::clean() {}
\ No newline at end of file
+bool DNSCache::Assemble(const Key &key, bool stale, Answer &answer) {
+  auto now = std::chrono::system_clock::now();
+  answer.Clear();
+  answer.answers_offset = kHeaderSize + key.name().size() + 4;
+  Key name = key;
+  // where `name` is in the reply
+  size_t name_offset = kHeaderSize;
+  // the records of the links after the first point to the names of the
+  // reply, not of their own question
+  auto append = [&](const Entry &entry) {
+    size_t base = answer.raw_answers.size();
+    return AppendAnswer(entry, now, stale, answer) &&
+           (name_offset == kHeaderSize ||
+            Relocate(entry, key, name_offset, base, answer));
+  };
+  // the CNAME entries of the chain
+  std::array<Visit, kMaxChainLength> visits;
+  size_t visit_count = 0;
+  auto visit = [&](Shard &shard, const Entry &entry) {
+    auto index = static_cast<uint32_t>(&entry - shard.entries.data());
+    visits[visit_count++] = {&shard, index, entry.hash, entry.store_time};
+  };
+  // every link of the chain is looked up under the lock of its own shard.
+  // the entry ending the chain completes it, so it is touched under the lock
+  // held already, and the CNAME entries under their locks taken again
+  for (int link = 0; link < kMaxChainLength; link++) {
+    bool complete = false;
+    {
+      Shard &shard = GetShard(name);
+      std::lock_guard<std::mutex> lg(shard.mutex);
+      // the records asked for, or a negative entry proving there are none
+      if (Entry *entry = shard.Find(name)) {
+        if (append(*entry)) {
+          if (!stale) {
+            Touch(*entry, now, answer);
+          }
+          complete = true;
+        }
+      }
+    }
+    if (complete) {
+      if (!stale) {
+        Touch(std::span(visits).first(visit_count), now, answer);
+      } else if (answer.stale_ttl) {
+        set_ttls(answer.raw_answers.data(), answer.ttl_offsets,
+                 *answer.stale_ttl);
+      }
+      return true;
+    }
+    if (key.qtype() == kTypeCNAME) {
+      return false;
+    }
+    auto alias = Key::FromName(name.name(), kTypeCNAME, name.qclass());
+    if (!alias) {
+      return false;
+    }
+    std::optional<Key> target;
+    {
+      Shard &shard = GetShard(*alias);
+      std::lock_guard<std::mutex> lg(shard.mutex);
+      Entry *entry = shard.Find(*alias);
+      size_t base = answer.raw_answers.size();
+      if (!entry || !append(*entry)) {
+        return false;
+      }
+      visit(shard, *entry);
+      if (entry->target_size > 0) {
+        target = Key::FromName(entry->target(), key.qtype(), key.qclass());
+        name_offset = answer.answers_offset + base + entry->target_offset;
+      }
+    }
+    if (!target) {
+      return false;
+    }
+    name = std::move(*target);
+  }
+  base::log(INFO, "CNAME chain too long");
+  return false;
+}
+
+bool DNSCache::query(const Key &key, Answer &answer) {
+  return Assemble(key, false, answer);
+}
+
+bool DNSCache::query_stale(const Key &key, Answer &answer) {
+  return Assemble(key, true, answer);
+}
+
+void DNSCache::Store(const RRset &rrset, uint8_t rcode, int nscount,
+                     TimePoint now) {
+  // compressed once here, after the question of a reply to the key, rather
+  // than on every hit
+  auto name = rrset.key.name();
+  size_t origin = kHeaderSize + name.size() + 4;
+  std::vector<uint8_t> message(origin + rrset.records.size());
+  std::copy(name.begin(), name.end(), message.begin() + kHeaderSize);
+  NameCompressor compressor(message);
+  compressor.Remember(kHeaderSize);
+  CompressedRecordsLayout layout;
+  auto size = write_compressed_records(compressor, origin, rrset.records,
+                                       nscount ? nscount : rrset.count,
+                                       &layout);
+  if (!size) {
+    return;
+  }
+  Value value = {.ancount = nscount ? 0 : rrset.count,
+                 .nscount = nscount,
+                 .rcode = rcode,
+                 .records = std::vector<uint8_t>(
+                     message.begin() + origin,
+                     message.begin() + origin + *size),
+                 .ttl_offsets = std::move(layout.ttl_offsets),
+                 .pointer_offsets = std::move(layout.pointer_offsets),
+                 .store_time = now,
+                 .expire_time = now + std::chrono::seconds(rrset.ttl)};
+  if (rrset.key.qtype() == kTypeCNAME) {
+    if (auto target = cname_target(rrset.records)) {
+      value.target.assign(target->begin(), target->end());
+      value.target_offset = first_rdata_offset(value.records);
+    }
+  }
+  Shard &shard = GetShard(rrset.key);
+  std::lock_guard<std::mutex> lg(shard.mutex);
+  shard.InsertOrAssign(rrset.key, std::move(value));
+}
+
+void DNSCache::update(const DNSPacket &packet,
+                      std::span<const uint8_t> message) {
+  auto key = CacheKey::FromQuestion(packet.raw_questions);
+  // the records of ANY answers are not all the records of the name
+  if (!key || key->qtype() == kTypeANY) {
+    return;
+  }
+  size_t pos = kHeaderSize + packet.raw_questions.size();
+  auto answers =
+      read_uncompressed_records(message, &pos, packet.get_ancount());
+  if (!answers) {
+    return;
+  }
+  std::vector<RRset> rrsets = group_rrsets(std::move(*answers));
+  auto find_rrset = [&rrsets](const Key &key) -> const RRset * {
+    for (const RRset &rrset : rrsets) {
+      if (rrset.key == key) {
+        return &rrset;
+      }
+    }
+    return nullptr;
+  };
+
+  // only the RRsets on the CNAME chain from the question are cached, records
+  // of other names are not ours to believe
+  auto now = std::chrono::system_clock::now();
+  Key name = *key;
+  bool answered = false;
+  int link = 0;
+  for (; link < kMaxChainLength; link++) {
+    if (const RRset *rrset = find_rrset(name)) {
+      Store(*rrset, 0, 0, now);
+      answered = true;
+      break;
+    }
+    if (key->qtype() == kTypeCNAME) {
+      break;
+    }
+    auto alias = Key::FromName(name.name(), kTypeCNAME, name.qclass());
+    const RRset *rrset = alias ? find_rrset(*alias) : nullptr;
+    if (!rrset) {
+      break;
+    }
+    Store(*rrset, 0, 0, now);
+    auto target_name = cname_target(rrset->records);
+    auto target = target_name ? Key::FromName(*target_name, key->qtype(),
+                                              key->qclass())
+                              : std::nullopt;
+    if (!target) {
+      return;
+    }
+    name = std::move(*target);
+  }
+
+  uint8_t rcode = packet.header.flag.rcode;
+  if (!answered && link < kMaxChainLength) {
+    // RFC 2308: the chain ends in a name without the records asked for, or
+    // in a name which does not exist. this is cached for the SOA's TTL, and
+    // replayed with the authority section which proves it
+    auto ttl = negative_ttl(packet);
+    size_t authority_pos = kHeaderSize + packet.raw_questions.size() +
+                           packet.raw_answers.size();
+    auto authority = read_uncompressed_records(message, &authority_pos,
+                                               packet.get_nscount());
+    if (!ttl || !authority) {
+      return;
+    }
+    RRset negative{std::move(name), {}, {}};
+    negative.ttl = std::min(*ttl, options_.max_negative_ttl);
+    for (const UncompressedRecord &record : *authority) {
+      negative.ttl_offsets.push_back(negative.records.size() +
+                                     record.ttl_offset);
+      negative.records.insert(negative.records.end(), record.wire.begin(),
+                              record.wire.end());
+    }
+    // the authority records count down to 0 with the entry
+    set_ttls(negative.records.data(), negative.ttl_offsets, negative.ttl);
+    Store(negative, rcode, authority->size(), now);
+  }
+  // read first, so that the cache line is not written on every update
+  if (!dirty_.load(std::memory_order_relaxed)) {
+    dirty_.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool DNSCache::save_snapshot(const std::string &path) {
+  std::lock_guard<std::mutex> snapshot_lg(snapshot_mutex_);
+  // written aside and renamed, readers never see a partial snapshot
+  std::string tmp_path = path + ".tmp";
+  FILE *file = fopen(tmp_path.c_str(), "wb");
+  if (!file) {
+    base::log(WARN, "can not open {}", tmp_path);
+    return false;
+  }
+  std::vector<uint8_t> buffer(kSnapshotHeaderSize);
+  std::copy(std::begin(kSnapshotMagic), std::end(kSnapshotMagic),
+            buffer.begin());
+  write_u32_to_net(buffer.data() + sizeof(kSnapshotMagic), kSnapshotVersion);
+  bool ok = true;
+  size_t saved = 0;
+  for (Shard &shard : shards_) {
+    // one shard is serialized under its lock, and written without it
+    {
+      std::lock_guard<std::mutex> lg(shard.mutex);
+      for (const FifoQueue *fifo : {&shard.main, &shard.small}) {
+        for (uint32_t i = fifo->head; i != Entry::kNil;
+             i = shard.entries[i].next) {
+          AppendSnapshotRecord(buffer, shard.entries[i]);
+        }
+      }
+      saved += shard.size;
+    }
+    ok = ok && fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    buffer.clear();
+  }
+  ok = fflush(file) == 0 && ok;
+  ok = fsync(fileno(file)) == 0 && ok;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    base::log(WARN, "failed to write snapshot {}", path);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  base::log(INFO, "{} record(s) saved to snapshot {}",
+            static_cast<int>(saved), path);
+  return true;
+}
+
+std::optional<size_t> DNSCache::load_snapshot(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    base::log(INFO, "no snapshot at {}", path);
+    return {};
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < kSnapshotHeaderSize) {
+    close(fd);
+    base::log(WARN, "invalid snapshot {}", path);
+    return {};
+  }
+  size_t size = st.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    base::log(WARN, "can not map snapshot {}", path);
+    return {};
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  const uint8_t *data = static_cast<const uint8_t *>(mapped);
+  if (!std::equal(std::begin(kSnapshotMagic), std::end(kSnapshotMagic),
+                  data) ||
+      read_u32_from_net(data + sizeof(kSnapshotMagic)) != kSnapshotVersion) {
+    munmap(mapped, size);
+    base::log(WARN, "not a snapshot of version {}: {}",
+              static_cast<int>(kSnapshotVersion), path);
+    return {};
+  }
+
+  // a first pass over the headers of the records counts them, so that the
+  // tables of the shards are sized once
+  size_t count = 0;
+  for (size_t pos = kSnapshotHeaderSize;
+       size - pos >= kSnapshotRecordHeaderSize; count++) {
+    const uint8_t *p = data + pos;
+    pos += kSnapshotRecordHeaderSize + read_u16_from_net(p + 16) + p[23] +
+           (read_u16_from_net(p + 24) + read_u16_from_net(p + 26)) * 2 +
+           read_u32_from_net(p + 30);
+    if (pos > size) {
+      break;
+    }
+  }
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    shard.Reserve(shard.size + count / kShardCount * 9 / 8);
+  }
+
+  auto min_expire = std::chrono::system_clock::now() - options_.stale_window;
+  size_t loaded = 0;
+  size_t pos = kSnapshotHeaderSize;
+  while (pos < size) {
+    if (size - pos < kSnapshotRecordHeaderSize) {
+      break;
+    }
+    const uint8_t *p = data + pos;
+    auto expire_at = from_unix_ms(read_u64_from_net(p));
+    auto store_time = from_unix_ms(read_u64_from_net(p + 8));
+    size_t question_size = read_u16_from_net(p + 16);
+    int ancount = read_u16_from_net(p + 18);
+    int nscount = read_u16_from_net(p + 20);
+    uint8_t rcode = p[22];
+    size_t target_size = p[23];
+    size_t offset_count = read_u16_from_net(p + 24);
+    size_t pointer_count = read_u16_from_net(p + 26);
+    uint16_t target_offset = read_u16_from_net(p + 28);
+    size_t records_size = read_u32_from_net(p + 30);
+    size_t record_size = kSnapshotRecordHeaderSize + question_size +
+                         (offset_count + pointer_count) * 2 + target_size +
+                         records_size;
+    if (size - pos < record_size) {
+      break;
+    }
+    pos += record_size;
+    if (expire_at < min_expire) {
+      continue;
+    }
+
+    p += kSnapshotRecordHeaderSize;
+    auto key = CacheKey::FromQuestion({p, question_size});
+    if (!key) {
+      break;
+    }
+    p += question_size;
+    std::vector<uint16_t> ttl_offsets(offset_count);
+    std::vector<uint16_t> pointer_offsets(pointer_count);
+    for (auto *offsets : {&ttl_offsets, &pointer_offsets}) {
+      for (uint16_t &offset : *offsets) {
+        offset = read_u16_from_net(p);
+        p += 2;
+      }
+    }
+    std::span<const uint8_t> target(p, target_size);
+    std::span<const uint8_t> records(p + target_size, records_size);
+    // the pointers point to the question, or backwards into the records
+    size_t origin = key->name().size() + 4 + kHeaderSize;
+    auto bad_pointer = [&](uint16_t offset) {
+      if (size_t(offset) + 2 > records_size ||
+          (records[offset] & 0xc0) != 0xc0) {
+        return true;
+      }
+      size_t to = read_u16_from_net(&records[offset]) & 0x3fff;
+      return to < kHeaderSize || to >= origin + offset ||
+             (to >= origin - 4 && to < origin);
+    };
+    if (std::any_of(ttl_offsets.begin(), ttl_offsets.end(),
+                    [&](uint16_t offset) {
+                      return size_t(offset) + 4 > records_size;
+                    }) ||
+        std::any_of(pointer_offsets.begin(), pointer_offsets.end(),
+                    bad_pointer) ||
+        (target_size > 0 && (wire_name_size(target) != target_size ||
+                             target_offset >= records_size))) {
+      break;
+    }
+    Value value = {.ancount = ancount,
+                   .nscount = nscount,
+                   .rcode = rcode,
+                   .records = std::vector<uint8_t>(records.begin(),
+                                                   records.end()),
+                   .ttl_offsets = std::move(ttl_offsets),
+                   .pointer_offsets = std::move(pointer_offsets),
+                   .target = std::vector<uint8_t>(target.begin(),
+                                                  target.end()),
+                   .target_offset = target_offset,
+                   .store_time = store_time,
+                   .expire_time = expire_at};
+    Shard &shard = GetShard(*key);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    shard.InsertOrAssign(std::move(*key), std::move(value));
+    loaded++;
+  }
+  if (pos < size) {
+    base::log(WARN, "snapshot {} is corrupted at byte {}", path,
+              static_cast<int64_t>(pos));
+  }
+  munmap(mapped, size);
+  return loaded;
+}
+
+void DNSCache::clean() {
+  // entries are kept for the stale window after expiring
+  auto now = std::chrono::system_clock::now() - options_.stale_window;
+  size_t removed = 0;
+  for (Shard &shard : shards_) {
+    // the lock is released between slices so that queries can get in
+    bool done = false;
+    while (!done) {
+      std::lock_guard<std::mutex> lg(shard.mutex);
+      done = shard.RemoveExpired(now, kCleanSliceSize, &removed);
+    }
+  }
+  if (removed > 0) {
+    base::log(INFO, "{} expired record(s) removed", static_cast<int>(removed));
+  }
+}
+
+size_t DNSCache::memory_usage() {
+  size_t bytes = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    bytes += shard.small.bytes + shard.main.bytes;
+  }
+  return bytes;
+}
+
+size_t DNSCache::size() {
+  size_t size = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    size += shard.size;
+  }
+  return size;
+}
+
+namespace {
+
+void append_u16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+void append_u32(std::vector<uint8_t> &out, uint32_t value) {
+  append_u16(out, value >> 16);
+  append_u16(out, value);
+}
+
+// appends `name` in wire format, "" is the root name
+void append_name(std::vector<uint8_t> &out, std::string_view name) {
+  while (!name.empty()) {
+    size_t dot = std::min(name.find('.'), name.size());
+    out.push_back(dot);
+    out.insert(out.end(), name.begin(), name.begin() + dot);
+    name.remove_prefix(std::min(dot + 1, name.size()));
+  }
+  out.push_back(0);
+}
+
+// a response with `rcode` to the question `name` `qtype` IN, to which the
+// records are appended with `append_record`
+std::vector<uint8_t> make_response(std::string_view name, uint16_t qtype,
+                                   uint8_t rcode = 0) {
+  std::vector<uint8_t> response;
+  append_u16(response, 0x1234);
+  append_u16(response, kStandardResponse | rcode);
+  append_u16(response, 1);
+  for (int i = 0; i < 3; i++) {
+    append_u16(response, 0);
+  }
+  append_name(response, name);
+  append_u16(response, qtype);
+  append_u16(response, 1);
+  return response;
+}
+
+// appends a record of `section` (1 answer, 2 authority), names uncompressed
+void append_record(std::vector<uint8_t> &response, int section,
+                   std::string_view owner, uint16_t type, uint32_t ttl,
+                   const std::vector<uint8_t> &rdata) {
+  append_name(response, owner);
+  append_u16(response, type);
+  append_u16(response, 1);
+  append_u32(response, ttl);
+  append_u16(response, rdata.size());
+  response.insert(response.end(), rdata.begin(), rdata.end());
+  uint8_t *count = response.data() + 4 + 2 * section;
+  write_u16_to_net(count, read_u16_from_net(count) + 1);
+}
+
+// the SOA record of `zone`, whose MINIMUM is `minimum`
+void append_soa(std::vector<uint8_t> &response, std::string_view zone,
+                uint32_t ttl, uint32_t minimum) {
+  std::vector<uint8_t> rdata;
+  append_name(rdata, std::string("ns.").append(zone));
+  append_name(rdata, std::string("admin.").append(zone));
+  // SERIAL, REFRESH, RETRY and EXPIRE
+  for (uint32_t field : {1u, 3600u, 600u, 86400u}) {
+    append_u32(rdata, field);
+  }
+  append_u32(rdata, minimum);
+  append_record(response, 2, zone, kTypeSOA, ttl, rdata);
+}
+
+// caches `response`, returns false if it does not parse
+bool update_cache(DNSCache &cache, const std::vector<uint8_t> &response) {
+  auto packet = ParseDNSRawPacket(response.data(), response.size());
+  if (!packet) {
+    return false;
+  }
+  cache.update(*packet, response);
+  return true;
+}
+
+// caches one A record of `name`
+bool cache_a(DNSCache &cache, std::string_view name) {
+  constexpr const uint16_t kTypeA = 1;
+  auto response = make_response(name, kTypeA);
+  append_record(response, 1, name, kTypeA, 300, {192, 0, 2, 1});
+  return update_cache(cache, response);
+}
+
+std::optional<CacheKey> make_key(std::string_view name, uint16_t qtype) {
+  std::vector<uint8_t> wire;
+  append_name(wire, name);
+  return CacheKey::FromName(wire, qtype, 1);
+}
+
+// replies to `question` with `answer` and returns the owner names of the
+// answers and the targets of the CNAMEs among them, read back uncompressed.
+// nullopt if the reply does not parse
+std::optional<std::vector<std::vector<uint8_t>>>
+reply_names(std::span<const uint8_t> question,
+            const DNSCache::Answer &answer) {
+  std::vector<uint8_t> reply(base::PacketBuffer::kCapacity);
+  dns_header header;
+  header.id = 0x1234;
+  header.flag.from_host(kStandardResponse);
+  ResponseWriter writer(reply);
+  writer.WriteHeader(header, 1, answer.ancount, answer.nscount);
+  writer.WriteQuestion(question);
+  writer.WriteCompressedRecords(answer.raw_answers, answer.answers_offset);
+  auto written = writer.Finish();
+  auto view = written ? DNSPacketView::Parse(*written) : std::nullopt;
+  if (!view) {
+    return {};
+  }
+  std::vector<std::vector<uint8_t>> names;
+  for (const DNSPacketView::Record &record : view->answers()) {
+    record.name.AppendTo(names.emplace_back());
+    if (record.type == kTypeCNAME) {
+      DNSNameView(written->data(), record.rdata.data())
+          .AppendTo(names.emplace_back());
+    }
+  }
+  return names;
+}
+
+} // namespace
+
+bool TestChainHits() {
+  // www.a.test CNAME b.test, then b.test A 192.0.2.1
+  std::vector<uint8_t> alias_response{
+      0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+      0x03, 'w',  'w',  'w',  0x01, 'a',  0x04, 't',  'e',  's',  't',  0x00,
+      0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00,
+      0x01, 0x2c, 0x00, 0x08, 0x01, 'b',  0x04, 't',  'e',  's',  't',  0x00};
+  std::vector<uint8_t> target_response{
+      0x12, 0x35, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+      0x00, 0x00, 0x01, 'b',  0x04, 't',  'e',  's',  't',  0x00,
+      0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+      0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 192,  0,    2,    1};
+  auto key = CacheKey::FromQuestion(
+      std::span(alias_response).subspan(kHeaderSize, 16));
+  auto target = CacheKey::FromQuestion(
+      std::span(target_response).subspan(kHeaderSize, 12));
+  auto alias =
+      key ? CacheKey::FromName(key->name(), kTypeCNAME, 1) : std::nullopt;
+  if (!key || !target || !alias) {
+    printf("bad questions\n");
+    return false;
+  }
+
+  DNSCache cache(std::weak_ptr<Gateway>{});
+  auto hits = [&cache](const CacheKey &key) -> std::optional<uint32_t> {
+    DNSCache::Shard &shard = cache.GetShard(key);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    if (DNSCache::Entry *entry = shard.Find(key)) {
+      return entry->hits;
+    }
+    return {};
+  };
+  auto update = [&cache](const std::vector<uint8_t> &response) {
+    if (auto packet = ParseDNSRawPacket(response.data(), response.size())) {
+      cache.update(*packet, response);
+    }
+  };
+
+  // the chain is broken at b.test A, its CNAME counts no hit
+  update(alias_response);
+  DNSCache::Answer answer;
+  if (cache.query(*key, answer) || hits(*alias) != 0) {
+    printf("broken chain answered or counted\n");
+    return false;
+  }
+  update(target_response);
+  if (!cache.query(*key, answer) || answer.ancount != 2 ||
+      hits(*alias) != 1 || hits(*target) != 1) {
+    printf("complete chain not answered or not counted\n");
+    return false;
+  }
+  // the records of b.test were compressed after a question of b.test, and
+  // point to the target of the CNAME in the reply
+  std::vector<std::vector<uint8_t>> chain_names(3);
+  append_name(chain_names[0], "www.a.test");
+  append_name(chain_names[1], "b.test");
+  append_name(chain_names[2], "b.test");
+  if (reply_names(std::span(alias_response).subspan(kHeaderSize, 16),
+                  answer) != chain_names) {
+    printf("wrong names in the reply\n");
+    return false;
+  }
+  // stale answers count no hit either
+  if (!cache.query_stale(*key, answer) || hits(*alias) != 1 ||
+      hits(*target) != 1) {
+    printf("stale answer counted\n");
+    return false;
+  }
+
+  // the TTLs of both records are 300, and count down from the time their
+  // entries were stored
+  auto entry_of = [&cache](const CacheKey &key) -> DNSCache::Entry & {
+    return *cache.GetShard(key).Find(key);
+  };
+  auto ttls = [&answer]() {
+    std::vector<uint32_t> ttls;
+    for (uint16_t offset : answer.ttl_offsets) {
+      ttls.push_back(read_u32_from_net(answer.raw_answers.data() + offset));
+    }
+    return ttls;
+  };
+  entry_of(*alias).store_time -= std::chrono::seconds(100);
+  entry_of(*target).store_time -= std::chrono::seconds(50);
+  if (!cache.query(*key, answer) ||
+      ttls() != std::vector<uint32_t>{200, 250}) {
+    printf("TTLs not decremented\n");
+    return false;
+  }
+  // one expired link makes the whole answer stale
+  entry_of(*target).expire_time =
+      std::chrono::system_clock::now() - std::chrono::seconds(10);
+  uint32_t stale_ttl = cache.options_.stale_ttl;
+  if (cache.query(*key, answer) || !cache.query_stale(*key, answer) ||
+      answer.stale_ttl != stale_ttl ||
+      ttls() != std::vector<uint32_t>{stale_ttl, stale_ttl}) {
+    printf("stale TTLs not replaced\n");
+    return false;
+  }
+  return true;
+}
+
+bool TestNegativeAnswers() {
+  constexpr const uint16_t kTypeA = 1;
+  constexpr const uint16_t kTypeAAAA = 28;
+  DNSCacheOptions options;
+  options.max_negative_ttl = 600;
+  DNSCache cache(std::weak_ptr<Gateway>{}, options);
+  // the TTL an entry was cached with
+  auto cached_ttl = [&cache](const CacheKey &key) -> std::optional<int64_t> {
+    DNSCache::Shard &shard = cache.GetShard(key);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    if (DNSCache::Entry *entry = shard.Find(key)) {
+      return std::chrono::duration_cast<std::chrono::seconds>(
+                 entry->expire_time - entry->store_time)
+          .count();
+    }
+    return {};
+  };
+  // the TTL of the first record of `answer`
+  auto first_ttl = [](const DNSCache::Answer &answer) {
+    return read_u32_from_net(answer.raw_answers.data() +
+                             answer.ttl_offsets[0]);
+  };
+
+  // nx.test does not exist. the SOA's TTL is below its MINIMUM and above
+  // the cap
+  auto nxdomain = make_response("nx.test", kTypeA, kRcodeNxDomain);
+  append_soa(nxdomain, "test", 3600, 86400);
+  // exists.test has no AAAA record, MINIMUM is below the SOA's TTL and the
+  // cap
+  auto nodata = make_response("exists.test", kTypeAAAA);
+  append_soa(nodata, "test", 300, 60);
+  // NXDOMAIN without the SOA record which would prove it
+  auto unproven = make_response("unproven.test", kTypeA, kRcodeNxDomain);
+  if (!update_cache(cache, nxdomain) || !update_cache(cache, nodata) ||
+      !update_cache(cache, unproven)) {
+    printf("bad responses\n");
+    return false;
+  }
+
+  struct Case {
+    const char *name;
+    std::optional<CacheKey> key;
+    uint8_t rcode;
+    int64_t ttl;
+  };
+  const Case cases[] = {
+      {"NXDOMAIN capped", make_key("nx.test", kTypeA), kRcodeNxDomain, 600},
+      // the name exists, so no other type of it is known not to
+      {"NODATA at MINIMUM", make_key("exists.test", kTypeAAAA), 0, 60},
+  };
+  DNSCache::Answer answer;
+  for (const Case &c : cases) {
+    if (!c.key || !cache.query(*c.key, answer)) {
+      printf("%s: not cached\n", c.name);
+      return false;
+    }
+    if (answer.ancount != 0 || answer.nscount != 1 || answer.rcode != c.rcode ||
+        cached_ttl(*c.key) != c.ttl || first_ttl(answer) != c.ttl) {
+      printf("%s: ancount %d, nscount %d, rcode %d, TTL %u\n", c.name,
+             answer.ancount, answer.nscount, answer.rcode, first_ttl(answer));
+      return false;
+    }
+  }
+  auto other_type = make_key("exists.test", kTypeA);
+  auto unproven_key = make_key("unproven.test", kTypeA);
+  if (!other_type || cache.query(*other_type, answer) || !unproven_key ||
+      cache.query(*unproven_key, answer)) {
+    printf("negative answer without its SOA, or of another type\n");
+    return false;
+  }
+  return true;
+}
+
+bool TestClean() {
+  constexpr const uint16_t kTypeA = 1;
+  constexpr const size_t kExpired = 300;
+  constexpr const size_t kLive = 10;
+  DNSCacheOptions options;
+  options.stale_window = std::chrono::hours(1);
+  DNSCache cache(std::weak_ptr<Gateway>{}, options);
+  auto now = std::chrono::system_clock::now();
+  // stores `key` with no records, expiring at `expire_time`
+  auto store = [&cache, now](const CacheKey &key,
+                             DNSCache::TimePoint expire_time) {
+    DNSCache::Shard &shard = cache.GetShard(key);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    shard.InsertOrAssign(key, {.ancount = 0,
+                               .store_time = now - std::chrono::hours(3),
+                               .expire_time = expire_time});
+  };
+  auto cached = [&cache](const CacheKey &key) {
+    DNSCache::Shard &shard = cache.GetShard(key);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    return shard.Find(key) != nullptr;
+  };
+
+  // the expired entries of a shard are removed `kCleanSliceSize` at a
+  // time, the live ones stay
+  DNSCache::Shard &shard = cache.shards_[0];
+  std::vector<CacheKey> keys;
+  for (int i = 0; keys.size() < kExpired + kLive; i++) {
+    if (auto key = make_key("n" + std::to_string(i) + ".test", kTypeA);
+        key && &cache.GetShard(*key) == &shard) {
+      store(*key, keys.size() < kExpired ? now - std::chrono::minutes(1)
+                                         : now + std::chrono::hours(1));
+      keys.push_back(std::move(*key));
+    }
+  }
+  size_t removed = 0;
+  std::vector<std::pair<bool, size_t>> slices;
+  for (bool done = false; !done;) {
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    done = shard.RemoveExpired(now, kCleanSliceSize, &removed);
+    slices.emplace_back(done, removed);
+  }
+  const std::vector<std::pair<bool, size_t>> expected_slices = {
+      {false, kCleanSliceSize},
+      {false, 2 * kCleanSliceSize},
+      {true, kExpired}};
+  if (slices != expected_slices || shard.size != kLive ||
+      !std::all_of(keys.begin() + kExpired, keys.end(), cached)) {
+    printf("wrong slices, or live entries removed\n");
+    return false;
+  }
+
+  // the records of the heap left by an update, which moved the expiration
+  // time, are skipped
+  auto updated = make_key("updated.test", kTypeA);
+  auto stale = make_key("stale.test", kTypeA);
+  auto expired = make_key("expired.test", kTypeA);
+  if (!updated || !stale || !expired) {
+    printf("bad keys\n");
+    return false;
+  }
+  store(*updated, now - std::chrono::hours(2));
+  store(*updated, now + std::chrono::hours(1));
+  // entries are kept for the stale window after expiring
+  store(*stale, now - std::chrono::minutes(30));
+  store(*expired, now - std::chrono::hours(2));
+  cache.clean();
+  if (!cached(*updated) || !cached(*stale) || cached(*expired)) {
+    printf("updated or stale entry removed, or expired entry kept\n");
+    return false;
+  }
+  return true;
+}
+
+bool TestPrefetch() {
+  constexpr const uint16_t kTypeA = 1;
+  DNSCacheOptions options;
+  options.prefetch_threshold = 0.1;
+  options.prefetch_min_hits = 3;
+  DNSCache cache(std::weak_ptr<Gateway>{}, options);
+  // stores `name` with a TTL of 300 seconds, `age` seconds ago
+  auto store = [&cache](const std::string &name, int age) {
+    auto key = make_key(name, kTypeA);
+    if (!key || !cache_a(cache, name)) {
+      return key;
+    }
+    DNSCache::Entry &entry = *cache.GetShard(*key).Find(*key);
+    entry.store_time -= std::chrono::seconds(age);
+    entry.expire_time -= std::chrono::seconds(age);
+    return key;
+  };
+  // the `refresh` of `count` queries of `key`
+  auto refreshes = [&cache](const std::optional<CacheKey> &key, int count) {
+    std::vector<bool> refreshes;
+    DNSCache::Answer answer;
+    for (int i = 0; i < count; i++) {
+      refreshes.push_back(key && cache.query(*key, answer) && answer.refresh);
+    }
+    return refreshes;
+  };
+
+  struct Case {
+    const char *name;
+    // of the 300 seconds of the TTL
+    int age;
+    std::vector<bool> refreshes;
+  };
+  const Case cases[] = {
+      // the third hit asks for the refresh, the next ones do not ask again
+      {"last 20 s", 280, {false, false, true, false, false}},
+      // above the threshold of 30 seconds
+      {"last 40 s", 260, {false, false, false, false, false}},
+      {"fresh", 0, {false, false, false, false, false}},
+  };
+  for (const Case &c : cases) {
+    if (refreshes(store(std::string(c.name) + ".test", c.age),
+                  c.refreshes.size()) != c.refreshes) {
+      printf("%s: wrong refreshes\n", c.name);
+      return false;
+    }
+  }
+  // updated, the entry counts its hits from 0 and may ask again
+  auto refreshed = store("refreshed.test", 280);
+  if (refreshes(refreshed, 3) != std::vector<bool>{false, false, true} ||
+      refreshes(store("refreshed.test", 280), 3) !=
+          std::vector<bool>{false, false, true}) {
+    printf("refresh not asked again after an update\n");
+    return false;
+  }
+  return true;
+}
+
+bool TestEviction() {
+  constexpr const uint16_t kTypeA = 1;
+  constexpr const int kHotEntries = 8;
+  constexpr const int kScanEntries = 200;
+  // names of the same size, so that their entries are charged the same
+  auto name_of = [](const char *prefix, int i) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s%05d.test", prefix, i);
+    return std::string(name);
+  };
+
+  size_t charge = 0;
+  {
+    DNSCache cache(std::weak_ptr<Gateway>{});
+    cache_a(cache, name_of("h", 0));
+    charge = cache.memory_usage();
+  }
+  // every shard has room for 20 entries
+  DNSCacheOptions options;
+  options.memory_budget = DNSCache::kShardCount * 20 * charge;
+  DNSCache cache(std::weak_ptr<Gateway>{}, options);
+  DNSCache::Shard &shard = cache.shards_[0];
+  // the names of the next `count` keys of the first shard
+  auto shard_names = [&](const char *prefix, int count) {
+    std::vector<std::pair<std::string, CacheKey>> names;
+    for (int i = 0; names.size() < size_t(count); i++) {
+      std::string name = name_of(prefix, i);
+      if (auto key = make_key(name, kTypeA);
+          key && &cache.GetShard(*key) == &shard) {
+        names.emplace_back(std::move(name), std::move(*key));
+      }
+    }
+    return names;
+  };
+  auto queue_of = [&](const CacheKey &key) -> std::optional<DNSCache::Queue> {
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    if (DNSCache::Entry *entry = shard.Find(key)) {
+      return entry->queue;
+    }
+    return {};
+  };
+
+  // hit once while in the small queue, the hot entries are moved to the
+  // main queue by the scan, which then only evicts entries of the small
+  // queue
+  auto hot = shard_names("h", kHotEntries);
+  DNSCache::Answer answer;
+  for (const auto &[name, key] : hot) {
+    if (!cache_a(cache, name) || !cache.query(key, answer)) {
+      printf("hot entry not cached\n");
+      return false;
+    }
+  }
+  auto scan = shard_names("s", kScanEntries);
+  for (const auto &[name, key] : scan) {
+    cache_a(cache, name);
+    std::lock_guard<std::mutex> lg(shard.mutex);
+    if (shard.small.bytes + shard.main.bytes > shard.budget) {
+      printf("%zu bytes used, over the budget of %zu\n",
+             shard.small.bytes + shard.main.bytes, shard.budget);
+      return false;
+    }
+  }
+  for (const auto &[name, key] : hot) {
+    if (queue_of(key) != DNSCache::Queue::kMain) {
+      printf("hot entry %s evicted by a scan\n", name.c_str());
+      return false;
+    }
+  }
+  // the entries of the scan evicted last are remembered, as many as the
+  // entries of the shard. cached again, they go straight to the main queue,
+  // new keys to the small one
+  auto evicted = std::find_if(scan.rbegin(), scan.rend(), [&](const auto &s) {
+    return !queue_of(s.second);
+  });
+  auto fresh = shard_names("f", 1);
+  if (evicted == scan.rend() || !cache_a(cache, evicted->first) ||
+      queue_of(evicted->second) != DNSCache::Queue::kMain ||
+      !cache_a(cache, fresh[0].first) ||
+      queue_of(fresh[0].second) != DNSCache::Queue::kSmall) {
+    printf("ghost hit not admitted to the main queue\n");
+    return false;
+  }
+
+  // a budget of one entry and a half per shard holds
+  options.memory_budget = DNSCache::kShardCount * charge * 3 / 2;
+  DNSCache tiny(std::weak_ptr<Gateway>{}, options);
+  for (int i = 0; i < 1000; i++) {
+    cache_a(tiny, name_of("t", i));
+  }
+  if (tiny.memory_usage() > options.memory_budget || tiny.size() == 0) {
+    printf("tiny budget: %zu bytes, %zu entries\n", tiny.memory_usage(),
+           tiny.size());
+    return false;
+  }
+  return true;
+}
+
+bool TestSnapshot() {
+  constexpr const uint16_t kTypeA = 1;
+  std::string path = "/tmp/dns_cache_snapshot_test." + std::to_string(getpid());
+  auto read_file = [](const std::string &path) {
+    std::vector<uint8_t> bytes;
+    if (FILE *file = fopen(path.c_str(), "rb")) {
+      uint8_t buffer[4096];
+      for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+        bytes.insert(bytes.end(), buffer, buffer + n);
+      }
+      fclose(file);
+    }
+    return bytes;
+  };
+  auto write_file = [](const std::string &path,
+                       std::span<const uint8_t> bytes) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+  };
+  auto ms = [](DNSCache::TimePoint t) { return to_unix_ms(t); };
+  // the entry of `key`, nullptr if there is none. the shard is not locked,
+  // nothing else uses the caches
+  auto find = [](DNSCache &cache, const CacheKey &key) {
+    return cache.GetShard(key).Find(key);
+  };
+
+  // a CNAME chain, a negative answer and A records, one of them expired
+  // within the stale window and one beyond it
+  DNSCache cache(std::weak_ptr<Gateway>{});
+  auto chain = make_response("www.a.test", kTypeA);
+  std::vector<uint8_t> target;
+  append_name(target, "b.test");
+  append_record(chain, 1, "www.a.test", kTypeCNAME, 300, target);
+  append_record(chain, 1, "b.test", kTypeA, 60, {192, 0, 2, 1});
+  auto nxdomain = make_response("nx.test", kTypeA, kRcodeNxDomain);
+  append_soa(nxdomain, "test", 300, 300);
+  std::vector<std::optional<CacheKey>> keys = {
+      make_key("www.a.test", kTypeCNAME), make_key("b.test", kTypeA),
+      make_key("nx.test", kTypeA), make_key("stale.test", kTypeA)};
+  bool cached = update_cache(cache, chain) && update_cache(cache, nxdomain) &&
+                cache_a(cache, "stale.test") && cache_a(cache, "gone.test");
+  for (int i = 0; i < 20; i++) {
+    std::string name = "n" + std::to_string(i) + ".test";
+    cached = cached && cache_a(cache, name);
+    keys.push_back(make_key(name, kTypeA));
+  }
+  auto gone = make_key("gone.test", kTypeA);
+  auto now = std::chrono::system_clock::now();
+  DNSCache::Entry *stale = keys[3] ? find(cache, *keys[3]) : nullptr;
+  DNSCache::Entry *expired = gone ? find(cache, *gone) : nullptr;
+  if (!cached || !stale || !expired ||
+      std::any_of(keys.begin(), keys.end(), [&](const auto &key) {
+        return !key || !find(cache, *key);
+      })) {
+    printf("entries not cached\n");
+    return false;
+  }
+  stale->expire_time = now - std::chrono::hours(1);
+  expired->expire_time =
+      now - cache.options_.stale_window - std::chrono::hours(1);
+
+  // saved and loaded, every entry is the same but the one expired beyond
+  // the stale window, the times kept to the millisecond
+  if (!cache.save_snapshot(path)) {
+    printf("snapshot not saved\n");
+    return false;
+  }
+  DNSCache loaded(std::weak_ptr<Gateway>{});
+  if (loaded.load_snapshot(path) != keys.size()) {
+    printf("wrong number of entries loaded\n");
+    unlink(path.c_str());
+    return false;
+  }
+  for (const auto &key : keys) {
+    const DNSCache::Entry *a = find(cache, *key);
+    const DNSCache::Entry *b = find(loaded, *key);
+    if (!b || ms(a->expire_time) != ms(b->expire_time) ||
+        ms(a->store_time) != ms(b->store_time) || a->ancount != b->ancount ||
+        a->nscount != b->nscount || a->rcode != b->rcode ||
+        a->data_size() != b->data_size() ||
+        a->offset_count != b->offset_count ||
+        a->pointer_count != b->pointer_count ||
+        a->target_size != b->target_size ||
+        a->target_offset != b->target_offset ||
+        memcmp(a->data, b->data, a->data_size()) != 0) {
+      printf("entry loaded differs\n");
+      unlink(path.c_str());
+      return false;
+    }
+  }
+  std::vector<std::vector<uint8_t>> chain_names(3);
+  append_name(chain_names[0], "www.a.test");
+  append_name(chain_names[1], "b.test");
+  append_name(chain_names[2], "b.test");
+  DNSCache::Answer answer;
+  auto chain_key = make_key("www.a.test", kTypeA);
+  if (find(loaded, *gone) || !loaded.query(*chain_key, answer) ||
+      reply_names(std::span(chain).subspan(kHeaderSize, 16), answer) !=
+          chain_names) {
+    printf("expired entry loaded, or chain not answered\n");
+    unlink(path.c_str());
+    return false;
+  }
+
+  // truncated files load the entries before the cut, every file loads or
+  // is rejected without reading out of bounds
+  std::vector<uint8_t> snapshot = read_file(path);
+  std::optional<size_t> last = 0;
+  for (size_t size = 0; size < snapshot.size(); size++) {
+    write_file(path, std::span(snapshot).first(size));
+    DNSCache truncated(std::weak_ptr<Gateway>{});
+    auto count = truncated.load_snapshot(path);
+    if (count.has_value() != (size >= kSnapshotHeaderSize) ||
+        count.value_or(0) < last.value_or(0) || count > keys.size()) {
+      printf("%zu bytes of %zu: wrong number of entries loaded\n", size,
+             snapshot.size());
+      unlink(path.c_str());
+      return false;
+    }
+    last = count;
+  }
+  std::mt19937 rng(20240625);
+  for (int round = 0; round < 500; round++) {
+    std::vector<uint8_t> corrupted = snapshot;
+    for (int flips = 1 + rng() % 3; flips > 0; flips--) {
+      corrupted[kSnapshotHeaderSize +
+                rng() % (corrupted.size() - kSnapshotHeaderSize)] = rng();
+    }
+    write_file(path, corrupted);
+    DNSCache corrupt(std::weak_ptr<Gateway>{});
+    if (!corrupt.load_snapshot(path)) {
+      printf("corrupted records rejected with the file\n");
+      unlink(path.c_str());
+      return false;
+    }
+    for (const auto &key : keys) {
+      corrupt.query_stale(*key, answer);
+    }
+    corrupt.query_stale(*chain_key, answer);
+  }
+  // another magic or version, no file at all
+  for (size_t at : {size_t(0), sizeof(kSnapshotMagic) + 3}) {
+    std::vector<uint8_t> foreign = snapshot;
+    foreign[at] ^= 1;
+    write_file(path, foreign);
+    if (DNSCache(std::weak_ptr<Gateway>{}).load_snapshot(path)) {
+      printf("foreign file loaded\n");
+      unlink(path.c_str());
+      return false;
+    }
+  }
+  unlink(path.c_str());
+  if (DNSCache(std::weak_ptr<Gateway>{}).load_snapshot(path)) {
+    printf("missing file loaded\n");
+    return false;
+  }
+  return true;
+}
+
+void BenchCacheLookup() {
+  constexpr const int kNames = 10000;
+  constexpr const int kLookupsPerThread = 50000;
+  // name<i>.bench.test A, answered by one A record
+  std::vector<CacheKey> keys;
+  std::vector<std::vector<uint8_t>> questions;
+  DNSCache cache(std::weak_ptr<Gateway>{});
+  // the one locked map the sharded tables replaced, for comparison: keyed
+  // by the raw question, an expiration time checked and the records copied
+  // out on every hit
+  using Clock = std::chrono::system_clock;
+  using Records = std::pair<std::vector<uint8_t>, Clock::time_point>;
+  std::map<std::vector<uint8_t>, Records> map;
+  std::mutex map_mutex;
+  auto expire_time = Clock::now() + std::chrono::hours(1);
+  for (int i = 0; i < kNames; i++) {
+    std::string label = "name" + std::to_string(i);
+    std::vector<uint8_t> response{0x12, 0x34, 0x81, 0x80, 0x00, 0x01,
+                                  0x00, 0x01, 0x00, 0x00, 0x00, 0x00};
+    response.push_back(label.size());
+    response.insert(response.end(), label.begin(), label.end());
+    for (std::string_view part : {"bench", "test"}) {
+      response.push_back(part.size());
+      response.insert(response.end(), part.begin(), part.end());
+    }
+    response.push_back(0);
+    size_t question_size = response.size() + 4 - kHeaderSize;
+    const uint8_t rest[] = {0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00,
+                            0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10,
+                            0x00, 0x04, 192,  0,    2,    1};
+    response.insert(response.end(), std::begin(rest), std::end(rest));
+    auto key = CacheKey::FromQuestion(
+        std::span(response).subspan(kHeaderSize, question_size));
+    auto packet = ParseDNSRawPacket(response.data(), response.size());
+    if (!key || !packet) {
+      printf("bad response\n");
+      return;
+    }
+    cache.update(*packet, response);
+    std::vector<uint8_t> question = packet->raw_questions;
+    map.emplace(question, std::make_pair(packet->raw_answers, expire_time));
+    questions.push_back(std::move(question));
+    keys.push_back(std::move(*key));
+  }
+
+  // every thread looks up random names, all of them hits
+  auto measure = [&](int threads, auto lookup) {
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t]() {
+        std::mt19937 rng(t);
+        DNSCache::Answer answer;
+        for (int i = 0; i < kLookupsPerThread; i++) {
+          lookup(rng() % keys.size(), answer);
+        }
+      });
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return threads * kLookupsPerThread / elapsed.count() / 1e6;
+  };
+  auto sharded = [&](size_t i, DNSCache::Answer &answer) {
+    cache.query(keys[i], answer);
+  };
+  auto locked_map = [&](size_t i, DNSCache::Answer &answer) {
+    std::lock_guard<std::mutex> lg(map_mutex);
+    auto iter = map.find(questions[i]);
+    if (iter != map.end() && iter->second.second > Clock::now()) {
+      std::vector<uint8_t> records = iter->second.first;
+      answer.raw_answers.swap(records);
+    }
+  };
+
+  // warms up the CPU caches and the allocator
+  measure(1, locked_map);
+  measure(1, sharded);
+  printf("cache lookups, %d names, %d random hits per thread, %u CPU(s)\n",
+         kNames, kLookupsPerThread, std::thread::hardware_concurrency());
+  printf("  %-8s %10s %10s   (Mops/s)\n", "threads", "map+mutex", "sharded");
+  for (int threads : {1, 8, 32}) {
+    printf("  %-8d %10.2f %10.2f\n", threads, measure(threads, locked_map),
+           measure(threads, sharded));
+  }
+}
+
+void BenchReplyEncode() {
+  constexpr const int kIterations = 200000;
+  constexpr const uint16_t kTypeA = 1;
+  // answers of www.example.test A, of 1 to 16 records, and a CNAME to
+  // another zone followed by 4 records
+  std::vector<std::pair<std::string, std::vector<uint8_t>>> responses;
+  for (int count : {1, 4, 16}) {
+    auto response = make_response("www.example.test", kTypeA);
+    for (int i = 0; i < count; i++) {
+      append_record(response, 1, "www.example.test", kTypeA, 300,
+                    {192, 0, 2, static_cast<uint8_t>(i)});
+    }
+    responses.emplace_back(std::to_string(count) + " A", std::move(response));
+  }
+  {
+    auto response = make_response("www.example.test", kTypeA);
+    std::vector<uint8_t> target;
+    append_name(target, "edge.cdn.example.net");
+    append_record(response, 1, "www.example.test", kTypeCNAME, 300, target);
+    for (int i = 0; i < 4; i++) {
+      append_record(response, 1, "edge.cdn.example.net", kTypeA, 60,
+                    {192, 0, 2, static_cast<uint8_t>(i)});
+    }
+    responses.emplace_back("CNAME + 4 A", std::move(response));
+  }
+
+  // keeps the replies alive, so that writing them is not optimized out
+  volatile size_t sink = 0;
+  auto measure = [&](auto write) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; i++) {
+      sink = sink + write();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / kIterations;
+  };
+
+  printf("cached replies, %d iterations each\n", kIterations);
+  printf("  %-12s %6s %6s %10s %10s %10s %10s\n", "answers", "plain",
+         "packed", "copy", "compress", "lookup", "cache hit");
+  dns_header header;
+  header.id = 0x1234;
+  header.flag.from_host(kStandardResponse);
+  std::vector<uint8_t> reply(base::PacketBuffer::kCapacity);
+  for (const auto &[what, response] : responses) {
+    DNSCache cache(std::weak_ptr<Gateway>{});
+    auto packet = ParseDNSRawPacket(response.data(), response.size());
+    auto key = packet ? CacheKey::FromQuestion(packet->raw_questions)
+                      : std::nullopt;
+    size_t pos = kHeaderSize + (packet ? packet->raw_questions.size() : 0);
+    auto records = packet ? read_uncompressed_records(response, &pos,
+                                                      packet->get_ancount())
+                          : std::nullopt;
+    DNSCache::Answer answer;
+    if (!key || !records || !update_cache(cache, response) ||
+        !cache.query(*key, answer)) {
+      printf("bad response\n");
+      return;
+    }
+    std::span<const uint8_t> question = packet->raw_questions;
+    int count = records->size();
+    std::vector<uint8_t> uncompressed;
+    for (const UncompressedRecord &record : *records) {
+      uncompressed.insert(uncompressed.end(), record.wire.begin(),
+                          record.wire.end());
+    }
+    size_t records_offset = kHeaderSize + question.size();
+
+    // the records copied as they are, uncompressed
+    double copy = measure([&]() {
+      ResponseWriter writer(reply);
+      writer.WriteHeader(header, 1, count, 0);
+      writer.WriteQuestion(question);
+      writer.WriteCompressedRecords(uncompressed, records_offset);
+      return writer.size();
+    });
+    // the records compressed into every reply, as hits used to
+    double compress = measure([&]() {
+      ResponseWriter writer(reply);
+      writer.WriteHeader(header, 1, count, 0);
+      writer.WriteQuestion(question);
+      NameCompressor compressor(reply);
+      compressor.Remember(kHeaderSize);
+      return *write_compressed_records(compressor, records_offset,
+                                       uncompressed, count, nullptr);
+    });
+    double lookup = measure([&]() {
+      cache.query(*key, answer);
+      return answer.raw_answers.size();
+    });
+    // the lookup, and the records compressed when cached copied
+    double hit = measure([&]() {
+      cache.query(*key, answer);
+      ResponseWriter writer(reply);
+      writer.WriteHeader(header, 1, answer.ancount, answer.nscount);
+      writer.WriteQuestion(question);
+      writer.WriteCompressedRecords(answer.raw_answers, answer.answers_offset);
+      return writer.size();
+    });
+    printf("  %-12s %6zu %6zu %7.0f ns %7.0f ns %7.0f ns %7.0f ns\n",
+           what.c_str(), records_offset + uncompressed.size(),
+           answer.answers_offset + answer.raw_answers.size(), copy, compress,
+           lookup, hit);
+  }
+}
+
+void BenchCacheEviction() {
+  constexpr const uint16_t kTypeA = 1;
+  constexpr const int kNames = 200000;
+  constexpr const int kQueries = 1000000;
+  constexpr const double kZipfExponent = 0.9;
+  // the popularity of the names follows a Zipf law, rank i is queried in
+  // proportion to 1 / (i + 1)^kZipfExponent
+  std::vector<double> cdf(kNames);
+  double sum = 0;
+  for (int i = 0; i < kNames; i++) {
+    sum += 1 / std::pow(i + 1, kZipfExponent);
+    cdf[i] = sum;
+  }
+  for (double &p : cdf) {
+    p /= sum;
+  }
+
+  printf("cache eviction, %d names queried by a Zipf law of exponent %.1f, "
+         "%d queries\n",
+         kNames, kZipfExponent, kQueries);
+  printf("  %-8s %8s %10s %10s %10s %10s\n", "random", "budget", "entries",
+         "memory", "S3-FIFO", "LRU");
+  for (int random_percent : {0, 30}) {
+    // ids below kNames are the names of the Zipf law, the others are random
+    // subdomains, each queried once
+    std::mt19937_64 rng(20240620);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<uint64_t> ids(kQueries);
+    uint64_t next_random = kNames;
+    for (uint64_t &id : ids) {
+      id = int(rng() % 100) < random_percent
+               ? next_random++
+               : std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+                     cdf.begin();
+    }
+    for (size_t budget_mb : {2, 8}) {
+      DNSCacheOptions options;
+      options.memory_budget = budget_mb << 20;
+      DNSCache cache(std::weak_ptr<Gateway>{}, options);
+      DNSCache::Answer answer;
+      int hits = 0;
+      for (uint64_t id : ids) {
+        std::string name = (id < kNames ? "z" : "r") + std::to_string(id) +
+                           ".bench.test";
+        auto key = make_key(name, kTypeA);
+        if (cache.query(*key, answer)) {
+          hits++;
+        } else {
+          cache_a(cache, name);
+        }
+      }
+      size_t entries = cache.size();
+
+      // an LRU list holding as many entries, for comparison
+      std::list<uint64_t> lru;
+      std::unordered_map<uint64_t, std::list<uint64_t>::iterator> positions;
+      int lru_hits = 0;
+      for (uint64_t id : ids) {
+        if (auto found = positions.find(id); found != positions.end()) {
+          lru.splice(lru.begin(), lru, found->second);
+          lru_hits++;
+          continue;
+        }
+        lru.push_front(id);
+        positions[id] = lru.begin();
+        if (lru.size() > entries) {
+          positions.erase(lru.back());
+          lru.pop_back();
+        }
+      }
+      printf("  %6d%% %5zu MiB %10zu %6.2f MiB %9.1f%% %9.1f%%\n",
+             random_percent, budget_mb, entries,
+             cache.memory_usage() / double(1 << 20), 100.0 * hits / kQueries,
+             100.0 * lru_hits / kQueries);
+    }
+  }
+}
+
+void BenchSnapshot() {
+  constexpr const int kEntries = 1000000;
+  std::string path =
+      "/tmp/dns_cache_snapshot_bench." + std::to_string(getpid());
+  DNSCache cache(std::weak_ptr<Gateway>{});
+  for (int i = 0; i < kEntries; i++) {
+    cache_a(cache, "name" + std::to_string(i) + ".bench.test");
+  }
+  auto measure = [](auto run) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = run();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return std::make_pair(result, elapsed.count());
+  };
+  auto [saved, save_ms] = measure([&]() { return cache.save_snapshot(path); });
+  struct stat st;
+  size_t file_size = stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+  DNSCache loaded(std::weak_ptr<Gateway>{});
+  auto [count, load_ms] =
+      measure([&]() { return loaded.load_snapshot(path); });
+  unlink(path.c_str());
+  if (!saved || count != size_t(kEntries)) {
+    printf("snapshot not saved or loaded\n");
+    return;
+  }
+  printf("snapshot of %d A entries, %.1f MiB\n", kEntries,
+         file_size / double(1 << 20));
+  printf("  save %8.0f ms\n  load %8.0f ms\n", save_ms, load_ms);
+}
@@ -1,49 +1,397 @@
 #ifndef DNS_CACHE_H_
 #define DNS_CACHE_H_
 
+#include "base/memory/slab_arena.h"
 #include "base/threading/thread_pool.h"
 #include "base/threading/timer.h"
+#include "dns/cache_key.h"
 #include "dns/dns_packet.h"
+#include "dns/rrset.h"
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <queue>
+#include <span>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 class Gateway;
 
+// the tunables of a `DNSCache`
+struct DNSCacheOptions {
+  // bounds the bytes used by the entries, overhead included
+  size_t memory_budget = 256 << 20;
+  // a hit on an entry with less than this fraction of its TTL left asks for
+  // a refresh of the entry
+  double prefetch_threshold = 0.1;
+  // ... if the entry has been hit at least this many times
+  uint32_t prefetch_min_hits = 3;
+  // expired answers are kept this long to be served when the upstreams fail
+  // to answer (RFC 8767), 0 disables serve-stale
+  std::chrono::seconds stale_window = std::chrono::hours(24);
+  // TTL of the records of a stale answer
+  uint32_t stale_ttl = 30;
+  // caps the TTL of negative answers, 3 hours as suggested by RFC 2308
+  uint32_t max_negative_ttl = 3 * 60 * 60;
+  // the entries are saved to this file periodically and loaded from it by
+  // `Initialize`, so a restart does not begin with an empty cache. empty
+  // disables snapshots
+  std::string snapshot_path;
+  std::chrono::seconds snapshot_interval = std::chrono::minutes(5);
+};
+
+/*
+  `DNSCache` maps questions to answers, names are compared ignoring case.
+
+  Answers are cached as RRsets keyed by their owner name, type and class,
+  and are assembled back by following the cached CNAME chain from the name
+  asked for, so the names of a chain are cached once for all the names
+  aliased to them and for every type asked. A name known to have no records
+  of a type, or not to exist, is cached as a negative entry holding the
+  authority records which prove it.
+
+  Entries are spread over `kShardCount` shards by the hash of their key, and
+  every shard has its own lock, so worker threads looking up different
+  names rarely contend. A shard is an open-addressing table with linear
+  probing whose slots hold the index of the entry and a tag of its hash, so
+  keys are compared only when the tags match.
+
+  Every shard also keeps a min-heap of expiration times. `clean` pops
+  expired entries from the heaps a slice at a time, so the lock of a shard
+  is never held for long.
+
+  The records of an entry are compressed once, when stored, as they would
+  follow the question of a reply to its key. The question of a client has
+  the size of the name of the key, so a hit copies the records into the
+  reply as they are and only decrements their TTLs. The records of the
+  other links of a CNAME chain follow those of the link before them, so
+  their compression pointers are moved to where the names they point to
+  are in the reply.
+
+  An entry is a fixed-size header. The name of its key, its records and
+  the offsets of their TTLs and pointers are packed into one slot of the
+  slab arena of the shard, so an entry takes no heap allocation of its
+  own, and the slots of removed entries are reused by the next ones of
+  similar size.
+
+  The memory of the entries is bounded by a byte budget, split evenly among
+  the shards. A shard over its budget evicts with S3-FIFO: new entries go
+  to a small FIFO queue, and only those hit while in it are promoted to the
+  main FIFO queue, so a scan of one-hit names only churns the small queue.
+  Entries of the main queue hit since their last pass are reinserted
+  instead of evicted. Keys evicted from the small queue are remembered in a
+  ghost queue and go straight to the main queue when inserted again. A hit
+  only bumps a counter of the entry.
+
+  thread safe
+*/
 class DNSCache : public std::enable_shared_from_this<DNSCache> {
 public:
-  DNSCache(std::weak_ptr<Gateway> gateway);
+  DNSCache(std::weak_ptr<Gateway> gateway, DNSCacheOptions options = {});
+  // loads the snapshot, if any, and starts the periodic `clean` and
+  // `save_snapshot`
+  void Initialize();
+
+  using Key = CacheKey;
 
-  // raw dns questions(bytes)
-  using Key = std::vector<uint8_t>;
+  // the answers of a key. a negative entry has no answers but `nscount`
+  // authority records. entries are stored packed, see `Entry`
+  struct Value {
+    int ancount = 0;
+    int nscount = 0;
+    uint8_t rcode = 0;
+    // the records of an RRset, compressed as if they followed the question
+    // of the key at the start of a message
+    std::vector<uint8_t> records;
+    // of the TTL fields and of the compression pointers in `records`
+    std::vector<uint16_t> ttl_offsets;
+    std::vector<uint16_t> pointer_offsets;
+    // of CNAME entries: the name aliased to, uncompressed, and where it is
+    // in `records`
+    std::vector<uint8_t> target;
+    uint16_t target_offset = 0;
+    std::chrono::time_point<std::chrono::system_clock> store_time;
+    std::chrono::time_point<std::chrono::system_clock> expire_time;
+  };
 
-  // <ancount, raw dns answers(bytes), expire_time, callbacks>
-  using Value = std::tuple<int, std::vector<uint8_t>,
-                           std::chrono::time_point<std::chrono::system_clock>,
-                           std::vector<std::function<void()>>>;
+  // a copy of cached answers. reusing one `Answer` for many queries keeps
+  // the capacity of `raw_answers`, so a hit does not allocate
+  struct Answer {
+    int ancount = 0;
+    // followed by `nscount` authority records, compressed for a reply to
+    // the question asked, in which they start at `answers_offset`. the TTLs
+    // are already decremented by the time the records have been cached
+    std::vector<uint8_t> raw_answers;
+    // of the TTL fields in `raw_answers`
+    std::vector<uint16_t> ttl_offsets;
+    // the size of the header and of the question of the reply
+    size_t answers_offset = 0;
+    // the caller should query the upstream to refresh the entry
+    bool refresh = false;
+    // set for stale answers, the TTL of every record
+    std::optional<uint32_t> stale_ttl;
+    // non zero for negative answers, with the SOA record
+    int nscount = 0;
+    // NXDOMAIN for negative answers of names which do not exist
+    uint8_t rcode = 0;
 
-  // <ancount, raw dns answers(bytes)>
-  std::optional<std::pair<int, std::vector<uint8_t>>> query(const Key &key);
+    // empties the answer, keeping the capacity of its vectors
+    void Clear();
+  };
 
-  // <ancount, raw dns answers(bytes)>
-  std::optional<std::pair<int, std::vector<uint8_t>>>
-  query_or_register_callback(
-      const Key &key, std::function<void()> &&cb = []() {});
+  // replaces `answer` by the answers of `key`. returns false, leaving
+  // `answer` unspecified, if they are not cached
+  bool query(const Key &key, Answer &answer);
 
+  // like `query`, but also finds answers expired for less than the stale
+  // window. to be used when the upstreams fail to answer in time
+  bool query_stale(const Key &key, Answer &answer);
+
+  // removes the entries expired for longer than the stale window
   void clean();
 
-  void update(const DNSPacket &packet);
+  size_t size();
+  // bytes charged to the entries
+  size_t memory_usage();
+
+  // caches the RRsets of the CNAME chain answering `packet`, or the lack of
+  // records at its end (NXDOMAIN or NODATA) if the authority section has a
+  // SOA record. `message` is the raw `packet`, to uncompress its names
+  void update(const DNSPacket &packet, std::span<const uint8_t> message);
+
+  // writes the entries to `path`, replacing the file atomically.
+  // returns false on I/O errors
+  bool save_snapshot(const std::string &path);
+  // inserts the entries saved to `path` by `save_snapshot`, except those
+  // `clean` would remove. returns the number of entries loaded, or nullopt
+  // if the file can not be read or is not a snapshot
+  std::optional<size_t> load_snapshot(const std::string &path);
+
+  friend bool TestChainHits();
+  friend bool TestNegativeAnswers();
+  friend bool TestClean();
+  friend bool TestPrefetch();
+  friend bool TestEviction();
+  friend bool TestSnapshot();
+
+private:
+  static constexpr const size_t kShardCount = 64;
+
+  using TimePoint = std::chrono::time_point<std::chrono::system_clock>;
+
+  enum class Queue : uint8_t { kSmall, kMain };
+
+  struct Entry {
+    static constexpr const uint32_t kNil = UINT32_MAX;
+    // of the key
+    uint64_t hash = 0;
+    TimePoint expire_time;
+    TimePoint store_time;
+    // the TTL offsets and the pointer offsets (u16 each, host byte order),
+    // the name of the key and the target of a CNAME entry in wire format,
+    // and the records, in a slot of `Shard::arena`. slots are aligned to 16
+    // bytes, so the offsets are read in place
+    uint8_t *data = nullptr;
+    uint32_t records_size = 0;
+    uint16_t name_size = 0;
+    uint16_t qtype = 0;
+    uint16_t qclass = 0;
+    uint16_t offset_count = 0;
+    uint16_t pointer_count = 0;
+    // where the target is in the records
+    uint16_t target_offset = 0;
+    uint8_t target_size = 0;
+    uint16_t ancount = 0;
+    uint16_t nscount = 0;
+    uint8_t rcode = 0;
+    // charged to the budget of the shard
+    uint32_t bytes = 0;
+    // neighbors in the FIFO queue of the entry
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    Queue queue = Queue::kSmall;
+    // hits since inserted or last passed in the main queue, saturated
+    uint8_t freq = 0;
+    // a refresh has been asked for
+    bool refreshing = false;
+    // hits since stored
+    uint32_t hits = 0;
+
+    size_t data_size() const {
+      return (offset_count + pointer_count) * sizeof(uint16_t) + name_size +
+             target_size + records_size;
+    }
+    std::span<const uint16_t> ttl_offsets() const {
+      return {reinterpret_cast<const uint16_t *>(data), offset_count};
+    }
+    std::span<const uint16_t> pointer_offsets() const {
+      return {reinterpret_cast<const uint16_t *>(data) + offset_count,
+              pointer_count};
+    }
+    std::span<const uint8_t> name() const {
+      return {data + (offset_count + pointer_count) * sizeof(uint16_t),
+              name_size};
+    }
+    std::span<const uint8_t> target() const {
+      return {name().data() + name_size, target_size};
+    }
+    std::span<const uint8_t> records() const {
+      return {target().data() + target_size, records_size};
+    }
+    bool Matches(const Key &key) const;
+  };
+
+  // a FIFO queue linked through the entries
+  struct FifoQueue {
+    uint32_t head = Entry::kNil;
+    uint32_t tail = Entry::kNil;
+    size_t bytes = 0;
+  };
+
+  struct Slot {
+    static constexpr const uint32_t kEmpty = UINT32_MAX;
+    // high half of the key's hash
+    uint32_t tag = 0;
+    // index into `Shard::entries`
+    uint32_t index = kEmpty;
+  };
+
+  struct Expiry {
+    TimePoint expire_at;
+    uint32_t index;
+    bool operator>(const Expiry &other) const {
+      return expire_at > other.expire_at;
+    }
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // indices of removed entries are reused through `free_entries`
+    std::vector<Entry> entries;
+    // holds the data of the entries
+    base::SlabArena arena;
+    std::vector<uint32_t> free_entries;
+    // the number of slots is a power of two, kept at most 3/4 full
+    std::vector<Slot> slots;
+    size_t size = 0;
+    size_t budget = 0;
+    FifoQueue small;
+    FifoQueue main;
+    // hashes of the keys recently evicted from the small queue
+    std::queue<uint64_t> ghost;
+    std::unordered_set<uint64_t> ghost_set;
+    // a min-heap. an entry may have several records, only the one matching
+    // its current expiration time counts
+    std::vector<Expiry> expiry;
+
+    Entry *Find(const Key &key);
+    // makes room for `n` entries without growing the tables
+    void Reserve(size_t n);
+    // evicts entries if the shard goes over its budget
+    void InsertOrAssign(const Key &key, const Value &value);
+    // pops at most `limit` expired records and removes their entries.
+    // returns false if expired records are left
+    bool RemoveExpired(TimePoint now, size_t limit, size_t *removed);
+
+  private:
+    std::optional<size_t> FindSlot(const Key &key) const;
+    // the slot of the entry at `index`, which must be in the table
+    size_t SlotOf(uint32_t index) const;
+    void EraseSlot(size_t i);
+    // copies the key and `value` into the entry at `index`
+    void Store(uint32_t index, const Key &key, const Value &value);
+    void Grow();
+
+    // bytes of the entry and of its share of the shard's tables
+    static uint32_t Charge(const Entry &entry);
+    FifoQueue &GetQueue(Queue queue) {
+      return queue == Queue::kSmall ? small : main;
+    }
+    void PushExpiry(Expiry record);
+    void PushBack(uint32_t index, Queue queue);
+    void Unlink(uint32_t index);
+    void Evict();
+    void EvictSmall();
+    void EvictMain();
+    void RememberGhost(uint64_t hash);
+  };
+
+  // an entry copied into an answer being assembled
+  struct Visit {
+    Shard *shard;
+    uint32_t index;
+    // tell the entry from one stored at `index` since
+    uint64_t hash;
+    TimePoint store_time;
+  };
+
+  // follows the CNAME chain from `key` into `answer`, returns false if a
+  // link is missing. the entries of the chain count a hit only once it is
+  // complete
+  bool Assemble(const Key &key, bool stale, Answer &answer);
+  // appends a copy of the records of `entry` at `now` to `answer`. returns
+  // false if `entry` is expired, or expired beyond the stale window if
+  // `stale`
+  bool AppendAnswer(const Entry &entry, TimePoint now, bool stale,
+                    Answer &answer);
+  // moves the pointers of the records of `entry`, appended to `answer` at
+  // `base`, to the names they point to in a reply to `key`, in which the
+  // name of `entry` is at `name_offset`. returns false if a name is out of
+  // the reach of pointers
+  static bool Relocate(const Entry &entry, const Key &key, size_t name_offset,
+                       size_t base, Answer &answer);
+  // counts a hit on `entry`, and sets `answer.refresh` if it is to be
+  // refreshed
+  void Touch(Entry &entry, TimePoint now, Answer &answer);
+  // touches the entries of `visits` still cached
+  void Touch(std::span<const Visit> visits, TimePoint now, Answer &answer);
+  // negative entries have `nscount` authority records
+  void Store(const RRset &rrset, uint8_t rcode, int nscount, TimePoint now);
+  static void AppendSnapshotRecord(std::vector<uint8_t> &out,
+                                   const Entry &entry);
+
+  Shard &GetShard(const Key &key) {
+    return shards_[key.hash() % kShardCount];
+  }
 
 private:
-  std::map<Key, Value> mp_;
-  std::mutex mutex_;
+  DNSCacheOptions options_;
+  std::array<Shard, kShardCount> shards_;
   std::weak_ptr<Gateway> gateway_;
-  base::Timer clean_timer_;
+  std::optional<base::Timer> clean_timer_;
+  std::optional<base::Timer> snapshot_timer_;
+  // set by `update`, a snapshot is only saved if the cache changed
+  std::atomic<bool> dirty_ = false;
+  // serializes the writers of the snapshot file
+  std::mutex snapshot_mutex_;
 };
 
+bool TestChainHits();
+bool TestNegativeAnswers();
+bool TestClean();
+bool TestPrefetch();
+bool TestEviction();
+bool TestSnapshot();
+
+// looks up cached names from several threads, in the cache and in the one
+// locked map it replaced, and prints the lookups per second of both
+void BenchCacheLookup();
+// writes replies of several sizes by copying records uncompressed, by
+// compressing them, and from the cache, and prints the time of each and
+// of the lookup alone
+void BenchReplyEncode();
+// replays Zipfian queries, mixed with random subdomains or not, against
+// caches of small budgets, and prints their hit ratio and memory use next
+// to the hit ratio of an LRU list of as many entries
+void BenchCacheEviction();
+// saves a cache of a million entries and loads it back, and prints the
+// time of both
+void BenchSnapshot();
+
 #endif
\ No newline at end of file
@@ -1,25 +1,119 @@
 #include "gateway.h"
 #include "base/logging.h"
+#include "base/memory/allocation_counter.h"
+#include "base/memory/packet_buffer.h"
+#include "base/net/io_engine.h"
 #include "base/net/udp_socket.h"
 #include "base/threading/thread_pool.h"
+#include "dns/cache_key.h"
 #include "dns/dns_packet.h"
+#include "dns/dns_packet_view.h"
+#include "dns/query_classifier.h"
+#include "dns/response_writer.h"
 #include "dns_cache.h"
+#include "transaction_table.h"
+#include "upstream_pool.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <span>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <thread>
 #include <vector>
 
 using namespace base::log_level;
 
+namespace {
+
+// max number of datagrams pulled by one `IOEngine::Recv`
+constexpr const int kRecvBatchSize = 32;
+// longer datagrams are dropped, they would not fit in a `PacketBuffer`
+constexpr const int kMaxPacketSize = base::PacketBuffer::kCapacity;
+// granularity of hedge and timeout deadlines
+constexpr const std::chrono::milliseconds kTimerTick(5);
+// one revolution of the wheel covers the longest timeout
+constexpr const size_t kTimerWheelSlots = 2048;
+// deadline of the first attempt, doubled on every retry
+constexpr const std::chrono::milliseconds kUpstreamTimeout(500);
+// a query is answered with SERVFAIL after this many retries timed out
+constexpr const int kMaxRetries = 2;
+
+// the answers looked up by the calling thread. reused for every lookup, so
+// that a cache hit does not allocate
+DNSCache::Answer &thread_answer() {
+  thread_local DNSCache::Answer answer;
+  return answer;
+}
+
+} // namespace
+
+void PacketBatch::Add(base::PacketBuffer buffer, base::SocketAddr addr) {
+  packets_.emplace_back(std::move(buffer), addr);
+}
+
+void PacketBatch::Flush(base::IOEngine &engine) {
+  if (packets_.empty()) {
+    return;
+  }
+  // both vectors keep their capacity, a long-lived batch does not allocate
+  datagrams_.clear();
+  for (auto &[buffer, addr] : packets_) {
+    datagrams_.push_back({buffer.span(), buffer.size(), addr});
+  }
+  auto sent = engine.Send(datagrams_);
+  if (!sent || *sent != static_cast<int>(datagrams_.size())) {
+    base::log(WARN, "send failed, {} of {} packet(s) sent",
+              sent.value_or(0), static_cast<int>(datagrams_.size()));
+  }
+  packets_.clear();
+}
+
 // TODO(lingsong.feng): consider unwrap null optional
-Gateway::Gateway()
-    : udp_socket_(*base::UDPSocket::Bind(base::SocketAddr("0.0.0.0:53"))) {}
+Gateway::Gateway(GatewayOptions options)
+    : options_(options), transactions_(options.max_waiters),
+      upstreams_(options.upstreams), timers_(kTimerTick, kTimerWheelSlots) {
+  base::IOEngineOptions engine_options;
+  engine_options.type = options_.io_engine;
+  engine_options.batch_size = kRecvBatchSize;
+  engine_options.max_packet_size = kMaxPacketSize;
+
+  bool reuse_port = options_.reuse_port_listeners > 0;
+  engine_ = base::CreateIOEngine(
+      *base::UDPSocket::Bind(options_.listen_addr, reuse_port),
+      engine_options);
+  for (int i = 1; i < options_.reuse_port_listeners; i++) {
+    listeners_.push_back(base::CreateIOEngine(
+        *base::UDPSocket::Bind(options_.listen_addr, true),
+        engine_options));
+  }
+  base::log(INFO, "io engine: {}",
+            std::string(base::to_cstr(engine_->type())));
+}
 
 void Gateway::Initialize() {
   initialized_ = true;
-  dns_cache_ = dns_cache_ = std::make_shared<DNSCache>(weak_from_this());
+  dns_cache_ = dns_cache_ = std::make_shared<DNSCache>(
+      weak_from_this(), options_.cache);
+  dns_cache_->Initialize();
+  timer_.emplace(
+      [gateway_weak = weak_from_this()]() {
+        if (auto gateway = gateway_weak.lock()) {
+          gateway->OnTimerTick();
+        }
+      },
+      kTimerTick);
+  timer_->Start();
+}
+
+void Gateway::Shutdown() {
+  if (dns_cache_ && !options_.cache.snapshot_path.empty()) {
+    dns_cache_->save_snapshot(options_.cache.snapshot_path);
+  }
 }
 
 void Gateway::Send(const DNSPacket &dns_packet) {
@@ -27,74 +121,436 @@ void Gateway::Send(const DNSPacket &dns_packet) {
     base::log(ERROR, "gateway not initialized");
   }
   auto raw_packet = GenerateDNSRawPacket(dns_packet);
-  udp_socket_.SendTo(std::span(raw_packet.begin(), raw_packet.size()),
-                     base::SocketAddr("114.114.114.114:53"));
+  SendOrBatch(base::PacketBuffer::CopyFrom(raw_packet),
+              upstreams_.GetAddr(upstreams_.Pick()), nullptr);
+}
+
+void Gateway::SendOrBatch(base::PacketBuffer buffer, base::SocketAddr addr,
+                          PacketBatch *batch) {
+  if (batch) {
+    batch->Add(std::move(buffer), addr);
+  } else {
+    base::Datagram datagram{buffer.span(), buffer.size(), addr};
+    engine_->Send(std::span(&datagram, 1));
+  }
+}
+
+void Gateway::ReplyFromCache(uint16_t id, std::span<const uint8_t> question,
+                             uint16_t udp_payload_size,
+                             const DNSCache::Answer &ans,
+                             base::SocketAddr addr, PacketBatch *batch) {
+  dns_header reply_header;
+  reply_header.id = id;
+  reply_header.flag.from_host(kStandardResponse | ans.rcode);
+  // written in place, the records were compressed for the question when
+  // they were cached
+  auto reply = base::PacketBuffer::Allocate();
+  std::span<uint8_t> capacity(
+      reply.data(), std::min<size_t>(udp_payload_size,
+                                     base::PacketBuffer::kCapacity));
+  // a cache key is made of exactly one question
+  ResponseWriter writer(capacity);
+  writer.WriteHeader(reply_header, 1, ans.ancount, ans.nscount);
+  writer.WriteQuestion(question);
+  writer.WriteCompressedRecords(ans.raw_answers, ans.answers_offset);
+  auto written = writer.Finish();
+  if (!written) {
+    // common without EDNS, so not a warning
+    base::log(DEBUG, "cached answers larger than the client accepts, "
+                     "truncated");
+    ReplyTruncated(id, question, udp_payload_size, ans.rcode, addr, batch);
+    return;
+  }
+  reply.resize(written->size());
+  SendOrBatch(std::move(reply), addr, batch);
+}
+
+void Gateway::ReplyTruncated(uint16_t id, std::span<const uint8_t> question,
+                             uint16_t udp_payload_size, uint8_t rcode,
+                             base::SocketAddr addr, PacketBatch *batch) {
+  dns_header reply_header;
+  reply_header.id = id;
+  reply_header.flag.from_host(kStandardResponse | rcode);
+  reply_header.flag.tc = 1;
+  auto reply = base::PacketBuffer::Allocate();
+  ResponseWriter writer(std::span<uint8_t>(
+      reply.data(), std::min<size_t>(udp_payload_size,
+                                     base::PacketBuffer::kCapacity)));
+  writer.WriteHeader(reply_header, 1, 0, 0);
+  writer.WriteQuestion(question);
+  auto written = writer.Finish();
+  if (!written) {
+    return;
+  }
+  reply.resize(written->size());
+  SendOrBatch(std::move(reply), addr, batch);
 }
 
-void Gateway::ProcessRawPacket(std::vector<uint8_t> buffer,
-                               base::SocketAddr addr) {
+bool Gateway::ReplyStale(const Transaction &transaction, PacketBatch *batch) {
+  DNSCache::Answer &ans = thread_answer();
+  if (!dns_cache_->query_stale(transaction.key, ans)) {
+    return false;
+  }
+  for (const Waiter &waiter : transaction.waiters) {
+    ReplyFromCache(waiter.id, waiter.question, waiter.udp_payload_size, ans,
+                   waiter.addr, batch);
+  }
+  return true;
+}
+
+void Gateway::Prefetch(const CacheKey &key, const base::PacketBuffer &query,
+                       PacketBatch *batch) {
+  auto buffer = base::PacketBuffer::CopyFrom(query.span());
+  size_t upstream = upstreams_.Pick();
+  auto sent_at = std::chrono::steady_clock::now();
+  bool joined = false;
+  // nobody waits for the response, it only updates the cache
+  if (auto id = transactions_.Begin(key, std::nullopt, buffer, upstream,
+                                    sent_at, &joined);
+      id && !joined) {
+    base::log(DEBUG, "prefetch query {}", *id);
+    if (upstreams_.size() > 1) {
+      ScheduleHedge(*id, sent_at, upstream);
+    }
+    ScheduleTimeout(*id, sent_at, upstream, 0);
+    SendOrBatch(std::move(buffer), upstreams_.GetAddr(upstream), batch);
+  }
+}
+
+bool Gateway::TryReplyFromCache(const base::PacketBuffer &buffer,
+                                base::SocketAddr addr, PacketBatch *batch) {
+  auto query = classify_query(buffer.span());
+  // anything unusual is left to `ProcessRawPacket`
+  if (!query || query->header.flag.to_host() != kStandardQuery) {
+    return false;
+  }
+  if (DNSCache::Answer &ans = thread_answer();
+      dns_cache_->query(query->key, ans)) {
+    base::log(DEBUG, "cache hit");
+    ReplyFromCache(query->header.id, query->question(buffer.span()),
+                   query->udp_payload_size, ans, addr, batch);
+    if (ans.refresh) {
+      Prefetch(query->key, buffer, batch);
+    }
+    return true;
+  }
+  return false;
+}
+
+void Gateway::ProcessRawPacket(base::PacketBuffer buffer, base::SocketAddr addr,
+                               PacketBatch *batch) {
   if (!initialized_) {
     base::log(ERROR, "gateway not initialized");
   }
   using namespace std::chrono_literals;
-  DNSPacket packet;
-  if (auto packet_opt = ParseDNSRawPacket(&buffer[0], buffer.size())) {
-    packet = std::move(*packet_opt);
-  } else {
+  // queries are read in place, only responses are parsed into a `DNSPacket`
+  auto view = DNSPacketView::Parse(buffer.span());
+  if (!view) {
     base::log(ERROR, "parse packet failed");
     return;
   }
-  if (packet.header.flag.qr == 0) {
-    if (packet.questions.empty()) {
+  dns_header header = view->header();
+  if (header.flag.qr == 0) {
+    if (view->questions().empty()) {
       base::log(WARN, "empty question");
       return;
     }
-    if (packet.header.flag.to_host() != kStandardQuery) {
+    if (header.flag.to_host() != kStandardQuery) {
       base::log(WARN, "not a standard query");
-      PrintDNSPacket(packet);
+      if (auto packet = ParseDNSRawPacket(buffer.data(), buffer.size())) {
+        PrintDNSPacket(*packet);
+      }
     }
 
-    DNSCache::Key key = packet.raw_questions;
+    auto key = CacheKey::FromQuestion(view->raw_questions());
+    if (!key) {
+      base::log(WARN, "unsupported question");
+      return;
+    }
 
-    auto cb = [addr, key, packet, gateway_weak = weak_from_this()]() {
-      base::log(INFO, "callback called");
-      if (auto gateway = gateway_weak.lock()) {
-        base::log(INFO, "cache hit");
-        if (auto ans = gateway->dns_cache_->query(key)) {
-          auto reply_header = packet.header;
-          reply_header.flag.from_host(kStandardResponse);
-          auto raw_reply_bufer = generate_dns_raw_from_raw_parts(
-              reply_header, key, ans->second, packet.get_qdcount(), ans->first);
-          gateway->udp_socket_.SendTo(raw_reply_bufer, addr);
-        } else {
-          base::log(WARN, "cache missed in callback");
-        }
-      } else {
-        base::log(WARN, "gateway released");
+    DNSCache::Answer &ans = thread_answer();
+    if (dns_cache_->query(*key, ans)) {
+      base::log(DEBUG, "cache hit");
+      ReplyFromCache(header.id, view->raw_questions(),
+                     view->udp_payload_size(), ans, addr, batch);
+      if (ans.refresh) {
+        Prefetch(*key, buffer, batch);
       }
-    };
+      return;
+    }
 
-    if (auto ans = dns_cache_->query_or_register_callback(key, cb)) {
-      base::log(INFO, "cache hit");
-      auto reply_header = packet.header;
-      reply_header.flag.from_host(kStandardResponse);
-      auto raw_reply_bufer = generate_dns_raw_from_raw_parts(
-          reply_header, key, ans->second, packet.get_qdcount(), ans->first);
-      udp_socket_.SendTo(raw_reply_bufer, addr);
+    base::log(DEBUG, "cache missed");
+    bool joined = false;
+    size_t upstream = upstreams_.Pick();
+    auto sent_at = std::chrono::steady_clock::now();
+    std::span<const uint8_t> question = view->raw_questions();
+    // the client's buffer is forwarded with the gateway-assigned id, the
+    // view is not to be used past `Begin`
+    uint16_t udp_payload_size = view->udp_payload_size();
+    Waiter waiter{addr, header.id, {question.begin(), question.end()},
+                  udp_payload_size};
+    auto id = transactions_.Begin(*key, std::move(waiter), buffer, upstream,
+                                  sent_at, &joined);
+    if (!id && joined) {
+      // a burst for one slow name, the clients will retry
+      base::log(WARN, "too many clients waiting for the same query");
+      if (dns_cache_->query_stale(*key, ans)) {
+        // `buffer` is left untouched when joining
+        ReplyFromCache(header.id, question, udp_payload_size, ans, addr,
+                       batch);
+      }
       return;
+    }
+    if (!id) {
+      base::log(WARN, "no free upstream transaction id");
+      return;
+    }
+    if (joined) {
+      base::log(DEBUG, "joined in-flight upstream query");
     } else {
-      base::log(INFO, "cache missed");
-      udp_socket_.SendTo(buffer, base::SocketAddr("114.114.114.114:53"));
+      if (upstreams_.size() > 1) {
+        ScheduleHedge(*id, sent_at, upstream);
+      }
+      ScheduleTimeout(*id, sent_at, upstream, 0);
+      SendOrBatch(std::move(buffer), upstreams_.GetAddr(upstream), batch);
+    }
+    // a client not answered in time gets the expired answers, if any
+    if (options_.cache.stale_window.count() > 0 &&
+        dns_cache_->query_stale(*key, ans)) {
+      ScheduleStaleDeadline(*id, *key, addr, header.id);
     }
 
   } else {
     // response
-    if (packet.header.flag.to_host() != kStandardResponse) {
+    DNSPacket packet;
+    if (auto packet_opt = ParseDNSRawPacket(buffer.data(), buffer.size())) {
+      packet = std::move(*packet_opt);
+    } else {
+      base::log(ERROR, "parse packet failed");
+      return;
+    }
+    auto key = CacheKey::FromQuestion(packet.raw_questions);
+    auto responder = upstreams_.Find(addr);
+    auto transaction =
+        key ? transactions_.Complete(packet.header.id, *key, responder)
+            : std::nullopt;
+    if (!transaction) {
+      base::log(WARN,
+                "unexpected, duplicate or foreign upstream response, id:{} "
+                "from {}",
+                packet.header.id, base::to_string(addr));
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - transaction->sent_at);
+    base::log(DEBUG, "upstream answered in {} us, {} waiter(s)",
+              static_cast<int64_t>(latency.count()),
+              static_cast<int>(transaction->waiters.size()));
+    // an attempt beaten by another upstream has not answered yet, the time
+    // elapsed so far is recorded as a lower bound of its RTT. timed out
+    // attempts have been counted as errors already
+    for (const Attempt &attempt : transaction->attempts) {
+      if (attempt.timed_out) {
+        continue;
+      }
+      upstreams_.OnResponse(
+          attempt.upstream,
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              now - attempt.sent_at));
+      if (attempt.upstream == *responder) {
+        break;
+      }
+    }
+
+    // NXDOMAIN is cached like any other answer
+    uint16_t rcode = packet.header.flag.rcode;
+    if (packet.header.flag.to_host() != (kStandardResponse | rcode) ||
+        (rcode != 0 && rcode != kRcodeNxDomain)) {
       base::log(WARN, "not a standard response");
       PrintDNSPacket(packet);
+      // stale answers are better than a failure
+      if (packet.header.flag.rcode == kRcodeServFail &&
+          ReplyStale(*transaction, batch)) {
+        base::log(INFO, "upstream failed, stale answers served");
+        return;
+      }
+    } else {
+      dns_cache_->update(packet, buffer.span());
+    }
+
+    // every waiter gets the upstream response as is, with its own id and
+    // question. the questions only differ in case, so have the same size.
+    // a waiter accepting less gets the cached answers, compressed, or a
+    // truncated reply
+    DNSCache::Answer &ans = thread_answer();
+    std::optional<bool> cached;
+    for (const Waiter &waiter : transaction->waiters) {
+      if (buffer.size() > waiter.udp_payload_size) {
+        if (!cached) {
+          cached = dns_cache_->query(transaction->key, ans);
+        }
+        if (*cached) {
+          ReplyFromCache(waiter.id, waiter.question, waiter.udp_payload_size,
+                         ans, waiter.addr, batch);
+        } else {
+          ReplyTruncated(waiter.id, waiter.question, waiter.udp_payload_size,
+                         packet.header.flag.rcode, waiter.addr, batch);
+        }
+        continue;
+      }
+      auto reply = base::PacketBuffer::CopyFrom(buffer.span());
+      write_u16_to_net(reply.data(), waiter.id);
+      if (waiter.question.size() == packet.raw_questions.size()) {
+        std::copy(waiter.question.begin(), waiter.question.end(),
+                  reply.data() + kHeaderSize);
+      }
+      SendOrBatch(std::move(reply), waiter.addr, batch);
+    }
+  }
+}
+
+void Gateway::ScheduleHedge(uint16_t id,
+                            std::chrono::steady_clock::time_point sent_at,
+                            size_t upstream) {
+  std::lock_guard<std::mutex> lg(timers_mutex_);
+  timers_.Add(sent_at + upstreams_.GetHedgeDelay(upstream),
+              {PendingTimer::Kind::kHedge, sent_at, id, upstream, 0});
+}
+
+void Gateway::ScheduleTimeout(uint16_t id,
+                              std::chrono::steady_clock::time_point sent_at,
+                              size_t upstream, int retries) {
+  auto deadline =
+      std::chrono::steady_clock::now() + kUpstreamTimeout * (1 << retries);
+  std::lock_guard<std::mutex> lg(timers_mutex_);
+  timers_.Add(deadline,
+              {PendingTimer::Kind::kTimeout, sent_at, id, upstream, retries});
+}
+
+void Gateway::ScheduleStaleDeadline(uint16_t id, const CacheKey &key,
+                                    base::SocketAddr client_addr,
+                                    uint16_t client_id) {
+  auto deadline =
+      std::chrono::steady_clock::now() + options_.stale_answer_deadline;
+  PendingTimer timer{PendingTimer::Kind::kStale, {}, id, 0, 0, key,
+                     client_addr, client_id};
+  std::lock_guard<std::mutex> lg(timers_mutex_);
+  timers_.Add(deadline, std::move(timer));
+}
+
+void Gateway::OnStaleDeadline(const PendingTimer &timer, PacketBatch &batch) {
+  // the query goes on in the background, its response refreshes the cache
+  if (DNSCache::Answer &ans = thread_answer();
+      dns_cache_->query_stale(timer.key, ans)) {
+    if (auto waiter = transactions_.RemoveWaiter(
+            timer.id, timer.key, timer.client_addr, timer.client_id)) {
+      base::log(INFO, "upstream too slow, stale answers served");
+      ReplyFromCache(waiter->id, waiter->question, waiter->udp_payload_size,
+                     ans, waiter->addr, &batch);
+    }
+  }
+}
+
+void Gateway::OnTimerTick() {
+  std::vector<PendingTimer> due;
+  {
+    std::lock_guard<std::mutex> lg(timers_mutex_);
+    due = timers_.Advance(std::chrono::steady_clock::now());
+  }
+
+  PacketBatch batch;
+  for (const PendingTimer &timer : due) {
+    if (timer.kind == PendingTimer::Kind::kTimeout) {
+      OnTimeout(timer.id, timer.sent_at, timer.upstream, timer.retries, batch);
+      continue;
+    }
+    if (timer.kind == PendingTimer::Kind::kStale) {
+      OnStaleDeadline(timer, batch);
+      continue;
+    }
+    size_t upstream = upstreams_.Pick(timer.upstream);
+    // nothing to do if the query has been answered meanwhile
+    if (auto query = transactions_.AddAttempt(timer.id, timer.sent_at,
+                                              upstream)) {
+      if (base::log_enabled(DEBUG)) {
+        base::log(DEBUG, "hedge query {} to upstream {}", timer.id,
+                  base::to_string(upstreams_.GetAddr(upstream)));
+      }
+      batch.Add(std::move(*query), upstreams_.GetAddr(upstream));
+    }
+  }
+  batch.Flush(*engine_);
+}
+
+void Gateway::OnTimeout(uint16_t id,
+                        std::chrono::steady_clock::time_point sent_at,
+                        size_t upstream, int retries, PacketBatch &batch) {
+  if (retries < kMaxRetries) {
+    size_t next = upstreams_.Pick(upstream);
+    // nothing to do if the query has been answered meanwhile
+    auto query = transactions_.Retry(id, sent_at, upstream, next);
+    if (!query) {
       return;
     }
-    dns_cache_->update(packet);
+    upstreams_.OnError(upstream);
+    base::log(WARN, "upstream {} timed out, retry query {} on {}",
+              base::to_string(upstreams_.GetAddr(upstream)), id,
+              base::to_string(upstreams_.GetAddr(next)));
+    batch.Add(std::move(*query), upstreams_.GetAddr(next));
+    ScheduleTimeout(id, sent_at, next, retries + 1);
+    return;
+  }
+
+  auto transaction = transactions_.Abort(id, sent_at);
+  if (!transaction) {
+    return;
+  }
+  upstreams_.OnError(upstream);
+  base::log(WARN, "query {} timed out after {} retries, {} waiter(s)", id,
+            retries, static_cast<int>(transaction->waiters.size()));
+  if (!ReplyStale(*transaction, &batch)) {
+    ReplyServFail(*transaction, batch);
+  }
+}
+
+void Gateway::ReplyServFail(const Transaction &transaction,
+                            PacketBatch &batch) {
+  dns_header header;
+  header.flag.from_host(kStandardResponse | kRcodeServFail);
+  uint16_t qdcount = read_u16_from_net(transaction.query.data() + 4);
+  for (const Waiter &waiter : transaction.waiters) {
+    header.id = waiter.id;
+    auto reply = base::PacketBuffer::Allocate();
+    ResponseWriter writer({reply.data(), base::PacketBuffer::kCapacity});
+    writer.WriteHeader(header, qdcount, 0, 0);
+    writer.WriteQuestion(waiter.question);
+    if (auto written = writer.Finish()) {
+      reply.resize(written->size());
+      batch.Add(std::move(reply), waiter.addr);
+    }
+  }
+}
+
+void Gateway::RunListener(base::IOEngine &engine) {
+  PacketBatch batch;
+  while (true) {
+    auto datagrams = engine.Recv();
+    if (!datagrams) {
+      base::log(WARN, "io engine recv failed");
+      continue;
+    }
+
+    for (const auto &datagram : *datagrams) {
+      if (base::log_enabled(DEBUG)) {
+        base::log(DEBUG, "recv {} byte(s) from {}", datagram.length,
+                  base::to_string(datagram.addr));
+      }
+      ProcessRawPacket(base::PacketBuffer::CopyFrom(
+                           datagram.buffer.first(datagram.length)),
+                       datagram.addr, &batch);
+    }
+    batch.Flush(engine);
   }
 }
 
@@ -103,22 +559,529 @@ void Gateway::Run() {
     base::log(ERROR, "gateway not initialized");
   }
 
+  if (options_.reuse_port_listeners > 0) {
+    base::log(INFO, "running {} SO_REUSEPORT listener(s)",
+              options_.reuse_port_listeners);
+    std::vector<std::thread> threads;
+    for (auto &listener : listeners_) {
+      threads.emplace_back([this, &listener]() { RunListener(*listener); });
+    }
+    RunListener(*engine_);
+    for (auto &t : threads) {
+      t.join();
+    }
+    return;
+  }
+
+  // replies of the hits answered on this thread
+  PacketBatch inline_batch;
   while (true) {
-    // TODO(lingsong.feng): specify with a constant
-    std::vector<uint8_t> buffer(1000);
-    if (auto opt =
-            udp_socket_.RecvFrom(std::span(buffer.begin(), buffer.size()))) {
-      auto [cnt, addr] = *opt;
-      base::log(INFO, "recv {} byte(s) from {}", cnt, base::to_string(addr));
-      buffer.resize(cnt);
-
-      base::ThreadPool::GetInstance()->PostTask(
-          [this, buffer = std::move(buffer), addr]() {
-            ProcessRawPacket(std::move(buffer), addr);
-          });
+    auto datagrams = engine_->Recv();
+    if (!datagrams) {
+      base::log(WARN, "io engine recv failed");
+      continue;
+    }
 
-    } else {
-      base::log(WARN, "udp socket recvfrom failed");
+    // received buffers are reused by the next `Recv`, copy them out before
+    // handing them over to the pool
+    ReceivedBatch *received = TakeReceivedBatch();
+    for (const auto &datagram : *datagrams) {
+      if (base::log_enabled(DEBUG)) {
+        base::log(DEBUG, "recv {} byte(s) from {}", datagram.length,
+                  base::to_string(datagram.addr));
+      }
+      auto buffer =
+          base::PacketBuffer::CopyFrom(datagram.buffer.first(datagram.length));
+      if (options_.inline_cache_hits &&
+          TryReplyFromCache(buffer, datagram.addr, &inline_batch)) {
+        continue;
+      }
+      received->packets.emplace_back(std::move(buffer), datagram.addr);
+    }
+    inline_batch.Flush(*engine_);
+    if (received->packets.empty()) {
+      // nothing to process, only given back
+      ProcessReceivedBatch(received);
+      continue;
+    }
+
+    // one task per received batch, replies of the whole batch are flushed
+    // together. the task only holds two pointers, which `std::function`
+    // stores without allocating
+    base::ThreadPool::GetInstance()->PostTask(
+        [this, received]() { ProcessReceivedBatch(received); });
+  }
+}
+
+Gateway::ReceivedBatch *Gateway::TakeReceivedBatch() {
+  std::lock_guard<std::mutex> lg(received_batches_mutex_);
+  if (free_received_batches_.empty()) {
+    received_batches_.push_back(std::make_unique<ReceivedBatch>());
+    // giving every batch back never allocates
+    free_received_batches_.reserve(received_batches_.size());
+    return received_batches_.back().get();
+  }
+  ReceivedBatch *received = free_received_batches_.back();
+  free_received_batches_.pop_back();
+  return received;
+}
+
+void Gateway::ProcessReceivedBatch(ReceivedBatch *received) {
+  for (auto &[buffer, addr] : received->packets) {
+    ProcessRawPacket(std::move(buffer), addr, &received->replies);
+  }
+  received->replies.Flush(*engine_);
+  // both vectors keep their capacity
+  received->packets.clear();
+  std::lock_guard<std::mutex> lg(received_batches_mutex_);
+  free_received_batches_.push_back(received);
+}
+
+bool TestCacheHitAllocations() {
+  // a response for www.sohu.com A, three CNAMEs then an A record
+  std::vector<uint8_t> response{
+      0x77, 0x92, 0x81, 0x80, 0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00,
+      0x03, 0x77, 0x77, 0x77, 0x04, 0x73, 0x6f, 0x68, 0x75, 0x03, 0x63, 0x6f,
+      0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01,
+      0x00, 0x00, 0x02, 0xed, 0x00, 0x19, 0x03, 0x77, 0x77, 0x77, 0x04, 0x73,
+      0x6f, 0x68, 0x75, 0x03, 0x63, 0x6f, 0x6d, 0x03, 0x64, 0x73, 0x61, 0x05,
+      0x64, 0x6e, 0x73, 0x76, 0x31, 0xc0, 0x15, 0xc0, 0x2a, 0x00, 0x05, 0x00,
+      0x01, 0x00, 0x00, 0x00, 0x65, 0x00, 0x1d, 0x04, 0x62, 0x65, 0x73, 0x74,
+      0x05, 0x73, 0x63, 0x68, 0x65, 0x64, 0x05, 0x64, 0x30, 0x2d, 0x64, 0x6b,
+      0x07, 0x74, 0x64, 0x6e, 0x73, 0x64, 0x70, 0x31, 0x02, 0x63, 0x6e, 0x00,
+      0xc0, 0x4f, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x00, 0x21, 0x00, 0x28,
+      0x04, 0x62, 0x65, 0x73, 0x74, 0x05, 0x35, 0x31, 0x2d, 0x36, 0x35, 0x03,
+      0x63, 0x6a, 0x74, 0x08, 0x73, 0x64, 0x79, 0x74, 0x75, 0x6e, 0x74, 0x78,
+      0x0a, 0x64, 0x69, 0x61, 0x6e, 0x73, 0x75, 0x2d, 0x63, 0x64, 0x6e, 0x03,
+      0x6e, 0x65, 0x74, 0x00, 0xc0, 0x78, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+      0x00, 0x2d, 0x00, 0x04, 0x7b, 0x7d, 0xf4, 0x6b};
+  // the header and the question of the response, as a query
+  std::vector<uint8_t> query(response.begin(), response.begin() + 30);
+  write_u16_to_net(&query[2], kStandardQuery);
+  write_u16_to_net(&query[6], 0);
+
+  GatewayOptions options;
+  options.listen_addr = base::SocketAddr("127.0.0.1:0");
+  // nothing is to be sent upstream, a miss goes nowhere
+  options.upstreams = {base::SocketAddr("127.0.0.1:9")};
+  auto gateway = std::make_shared<Gateway>(options);
+  // the timers started by `Initialize` are not needed to answer hits
+  gateway->initialized_ = true;
+  gateway->dns_cache_ = std::make_shared<DNSCache>(gateway, options.cache);
+  auto packet = ParseDNSRawPacket(response.data(), response.size());
+  if (!packet) {
+    std::cerr << "parse response failed" << std::endl;
+    return false;
+  }
+  gateway->dns_cache_->update(*packet, response);
+
+  base::SocketAddr client("127.0.0.1:9");
+  PacketBatch batch;
+  uint64_t allocations = 0;
+  // the first rounds warm up the packet buffers, the batch and the answer
+  // of the thread
+  constexpr const int kWarmUpRounds = 100;
+  for (int i = 0; i < kWarmUpRounds + 1000; i++) {
+    uint64_t before = base::GetThreadAllocationCount();
+    // the inline path, the dispatched one
+    auto buffer = base::PacketBuffer::CopyFrom(query);
+    if (!gateway->TryReplyFromCache(buffer, client, &batch)) {
+      std::cerr << "cache missed" << std::endl;
+      return false;
+    }
+    gateway->ProcessRawPacket(std::move(buffer), client, &batch);
+    batch.Flush(*gateway->engine_);
+    // and a batch handed over to the pool in the single socket mode, by a
+    // task of the same captures as the one posted by `Run`
+    Gateway::ReceivedBatch *received = gateway->TakeReceivedBatch();
+    received->packets.emplace_back(base::PacketBuffer::CopyFrom(query),
+                                   client);
+    std::function<void()> task([gateway = gateway.get(), received]() {
+      gateway->ProcessReceivedBatch(received);
+    });
+    task();
+    if (i >= kWarmUpRounds) {
+      allocations += base::GetThreadAllocationCount() - before;
+    }
+  }
+  if (allocations != 0) {
+    std::cerr << allocations << " allocation(s) in 3000 cache hits"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TestTruncatedReplies() {
+  // a response for many.test A with 40 A records, larger than 512 bytes
+  constexpr const int kRecords = 40;
+  std::vector<uint8_t> query{0x42, 0x42, 0x01, 0x00, 0x00, 0x01, 0x00,
+                             0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 'm',
+                             'a',  'n',  'y',  0x04, 't',  'e',  's',
+                             't',  0x00, 0x00, 0x01, 0x00, 0x01};
+  std::vector<uint8_t> response = query;
+  write_u16_to_net(&response[2], kStandardResponse);
+  write_u16_to_net(&response[6], kRecords);
+  for (int i = 0; i < kRecords; i++) {
+    const uint8_t record[] = {0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+                              0x00, 0x00, 0x01, 0x2c, 0x00, 0x04,
+                              192,  0,    2,    uint8_t(i)};
+    response.insert(response.end(), std::begin(record), std::end(record));
+  }
+  // the query with an OPT record advertising `payload_size`
+  auto with_opt = [&](uint16_t payload_size) {
+    std::vector<uint8_t> edns_query = query;
+    write_u16_to_net(&edns_query[10], 1);
+    const uint8_t opt[] = {0x00, 0x00, 0x29, uint8_t(payload_size >> 8),
+                           uint8_t(payload_size), 0x00, 0x00, 0x00, 0x00,
+                           0x00, 0x00};
+    edns_query.insert(edns_query.end(), std::begin(opt), std::end(opt));
+    return edns_query;
+  };
+
+  base::SocketAddr client_addr("127.0.0.1:5304");
+  auto client = base::UDPSocket::Bind(client_addr);
+  if (!client) {
+    std::cerr << "bind client failed" << std::endl;
+    return false;
+  }
+  GatewayOptions options;
+  options.listen_addr = base::SocketAddr("127.0.0.1:0");
+  options.upstreams = {base::SocketAddr("127.0.0.1:9")};
+  auto gateway = std::make_shared<Gateway>(options);
+  gateway->initialized_ = true;
+  gateway->dns_cache_ = std::make_shared<DNSCache>(gateway, options.cache);
+  auto packet = ParseDNSRawPacket(response.data(), response.size());
+  if (!packet) {
+    std::cerr << "parse response failed" << std::endl;
+    return false;
+  }
+  gateway->dns_cache_->update(*packet, response);
+
+  struct Case {
+    const char *name;
+    std::vector<uint8_t> query;
+    bool truncated;
+  };
+  const Case cases[] = {
+      {"without EDNS", query, true},
+      {"EDNS 256", with_opt(256), true},
+      {"EDNS 512", with_opt(512), true},
+      {"EDNS 4096", with_opt(4096), false},
+  };
+  std::vector<uint8_t> reply(base::PacketBuffer::kCapacity);
+  // returns the size of the reply received by the client, -1 for none
+  auto receive = [&]() {
+    ssize_t n = -1;
+    for (int i = 0; i < 100 && n < 0; i++) {
+      n = recv(client->fd(), reply.data(), reply.size(), MSG_DONTWAIT);
+      if (n < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    return n;
+  };
+  for (const Case &c : cases) {
+    // both the inline path and the dispatched one
+    for (bool inline_path : {true, false}) {
+      PacketBatch batch;
+      auto buffer = base::PacketBuffer::CopyFrom(c.query);
+      if (inline_path) {
+        if (!gateway->TryReplyFromCache(buffer, client_addr, &batch)) {
+          std::cerr << c.name << ": cache missed" << std::endl;
+          return false;
+        }
+      } else {
+        gateway->ProcessRawPacket(std::move(buffer), client_addr, &batch);
+      }
+      batch.Flush(*gateway->engine_);
+      ssize_t n = receive();
+      auto view = DNSPacketView::Parse(
+          std::span(reply).first(std::max<ssize_t>(n, 0)));
+      if (!view) {
+        std::cerr << c.name << ": no reply" << std::endl;
+        return false;
+      }
+      bool truncated = view->header().flag.tc == 1;
+      uint16_t ancount = view->get_ancount();
+      if (truncated != c.truncated ||
+          ancount != (c.truncated ? 0 : kRecords) ||
+          (c.truncated && n > kMinUDPPayloadSize)) {
+        std::cerr << c.name << ": " << n << " bytes, TC " << truncated
+                  << ", " << ancount << " answer(s)" << std::endl;
+        return false;
+      }
+    }
+  }
+
+  // a client without EDNS joined on a query in flight. the response of
+  // wide.test has uncompressed owner names, and is larger than 512 bytes
+  // as received but not once compressed
+  constexpr const int kWideRecords = 24;
+  std::vector<uint8_t> wide_query{0x42, 0x43, 0x01, 0x00, 0x00, 0x01, 0x00,
+                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 'w',
+                                  'i',  'd',  'e',  0x04, 't',  'e',  's',
+                                  't',  0x00, 0x00, 0x01, 0x00, 0x01};
+  std::vector<uint8_t> wide_response = wide_query;
+  write_u16_to_net(&wide_response[2], kStandardResponse);
+  write_u16_to_net(&wide_response[6], kWideRecords);
+  for (int i = 0; i < kWideRecords; i++) {
+    const uint8_t record[] = {0x04, 'w',  'i',  'd',  'e',  0x04, 't',
+                              'e',  's',  't',  0x00, 0x00, 0x01, 0x00,
+                              0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04,
+                              192,  0,    2,    uint8_t(i)};
+    wide_response.insert(wide_response.end(), std::begin(record),
+                         std::end(record));
+  }
+  struct JoinedCase {
+    const char *name;
+    const std::vector<uint8_t> &query;
+    const std::vector<uint8_t> &response;
+    bool truncated;
+    int ancount;
+  };
+  const JoinedCase joined_cases[] = {
+      {"joined, fits compressed", wide_query, wide_response, false,
+       kWideRecords},
+      {"joined, too large", query, response, true, 0},
+  };
+  for (const JoinedCase &c : joined_cases) {
+    auto question = std::span(c.query).subspan(kHeaderSize);
+    auto key = CacheKey::FromQuestion(question);
+    auto forwarded = base::PacketBuffer::CopyFrom(c.query);
+    Waiter waiter{client_addr, 0x5151,
+                  std::vector<uint8_t>(question.begin(), question.end()),
+                  kMinUDPPayloadSize};
+    auto id = key ? gateway->transactions_.Begin(
+                        *key, waiter, forwarded, 0,
+                        std::chrono::steady_clock::now())
+                  : std::nullopt;
+    if (!id) {
+      std::cerr << c.name << ": no transaction" << std::endl;
+      return false;
+    }
+    auto upstream_response = base::PacketBuffer::CopyFrom(c.response);
+    write_u16_to_net(upstream_response.data(), *id);
+    PacketBatch batch;
+    gateway->ProcessRawPacket(std::move(upstream_response),
+                              options.upstreams[0], &batch);
+    batch.Flush(*gateway->engine_);
+    ssize_t n = receive();
+    auto view = DNSPacketView::Parse(
+        std::span(reply).first(std::max<ssize_t>(n, 0)));
+    if (!view || view->id() != waiter.id || n > kMinUDPPayloadSize ||
+        (view->header().flag.tc == 1) != c.truncated ||
+        view->get_ancount() != c.ancount) {
+      std::cerr << c.name << ": " << n << " bytes" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestUpstreamFailover() {
+  // two stub upstreams: `a` never answers, `b` answers its second query
+  base::SocketAddr a_addr("127.0.0.1:5301");
+  base::SocketAddr b_addr("127.0.0.1:5302");
+  base::SocketAddr client_addr("127.0.0.1:5303");
+  auto a = base::UDPSocket::Bind(a_addr);
+  auto b = base::UDPSocket::Bind(b_addr);
+  auto client = base::UDPSocket::Bind(client_addr);
+  if (!a || !b || !client) {
+    std::cerr << "bind stubs failed" << std::endl;
+    return false;
+  }
+
+  GatewayOptions options;
+  options.listen_addr = base::SocketAddr("127.0.0.1:0");
+  options.upstreams = {a_addr, b_addr};
+  auto gateway = std::make_shared<Gateway>(options);
+  // the timers are ticked by the test
+  gateway->initialized_ = true;
+  gateway->dns_cache_ = std::make_shared<DNSCache>(gateway, options.cache);
+  // `a` looks faster, so it gets the first attempt
+  gateway->upstreams_.OnResponse(1, std::chrono::milliseconds(50));
+
+  auto try_recv = [](base::UDPSocket &socket, std::vector<uint8_t> &buffer) {
+    buffer.resize(base::PacketBuffer::kCapacity);
+    ssize_t n = recv(socket.fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+    buffer.resize(std::max<ssize_t>(n, 0));
+    return n > 0;
+  };
+  // runs the timers until `socket` receives a datagram
+  auto tick_until_recv = [&](base::UDPSocket &socket,
+                             std::vector<uint8_t> &buffer,
+                             std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (try_recv(socket, buffer)) {
+        return true;
+      }
+      std::this_thread::sleep_for(kTimerTick);
+      gateway->OnTimerTick();
+    }
+    return false;
+  };
+
+  // failover.test A
+  std::vector<uint8_t> query{0x42, 0x42, 0x01, 0x00, 0x00, 0x01, 0x00,
+                             0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 'f',
+                             'a',  'i',  'l',  'o',  'v',  'e',  'r',
+                             0x04, 't',  'e',  's',  't',  0x00, 0x00,
+                             0x01, 0x00, 0x01};
+  PacketBatch batch;
+  gateway->ProcessRawPacket(base::PacketBuffer::CopyFrom(query), client_addr,
+                            &batch);
+  batch.Flush(*gateway->engine_);
+
+  std::vector<uint8_t> received;
+  if (!tick_until_recv(*a, received, std::chrono::milliseconds(100))) {
+    std::cerr << "first attempt not sent to the faster upstream" << std::endl;
+    return false;
+  }
+  // hedged after the default hedge delay, then retried on the same
+  // upstream once the first attempt times out
+  if (!tick_until_recv(*b, received, kUpstreamTimeout)) {
+    std::cerr << "query not hedged" << std::endl;
+    return false;
+  }
+  std::vector<uint8_t> response;
+  if (!tick_until_recv(*b, response, kUpstreamTimeout * 2)) {
+    std::cerr << "query not retried" << std::endl;
+    return false;
+  }
+  if (try_recv(*a, received)) {
+    std::cerr << "query retried on the upstream which timed out"
+              << std::endl;
+    return false;
+  }
+
+  // `b` answers 127.0.0.1 with the id the gateway assigned
+  write_u16_to_net(&response[2], kStandardResponse);
+  write_u16_to_net(&response[6], 1);
+  response.insert(response.end(), {0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00,
+                                   0x00, 0x00, 0x3c, 0x00, 0x04, 0x7f, 0x00,
+                                   0x00, 0x01});
+  gateway->ProcessRawPacket(base::PacketBuffer::CopyFrom(response), b_addr,
+                            &batch);
+  batch.Flush(*gateway->engine_);
+  if (!tick_until_recv(*client, received, std::chrono::milliseconds(100)) ||
+      received.size() != response.size() ||
+      read_u16_from_net(received.data()) != 0x4242 ||
+      read_u16_from_net(received.data() + 6) != 1) {
+    std::cerr << "client not answered" << std::endl;
+    return false;
+  }
+
+  // the answer is cached, no upstream is asked again
+  gateway->ProcessRawPacket(base::PacketBuffer::CopyFrom(query), client_addr,
+                            &batch);
+  batch.Flush(*gateway->engine_);
+  if (!tick_until_recv(*client, received, std::chrono::milliseconds(100)) ||
+      try_recv(*a, received) || try_recv(*b, received)) {
+    std::cerr << "answer not cached" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void BenchListeners() {
+  constexpr const int kClients = 4;
+  constexpr const int kInFlight = 16;
+  constexpr const auto kDuration = std::chrono::seconds(1);
+  // www.example.test A, and its answer of one A record
+  const std::vector<uint8_t> query{
+      0x42, 0x42, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x03, 'w',  'w',  'w',  0x07, 'e',  'x',  'a',  'm',  'p',
+      'l',  'e',  0x04, 't',  'e',  's',  't',  0x00, 0x00, 0x01, 0x00,
+      0x01};
+  std::vector<uint8_t> response = query;
+  write_u16_to_net(&response[2], kStandardResponse);
+  write_u16_to_net(&response[6], 1);
+  response.insert(response.end(), {0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00,
+                                   0x00, 0x0e, 0x10, 0x00, 0x04, 192, 0, 2,
+                                   1});
+  auto packet = ParseDNSRawPacket(response.data(), response.size());
+  if (!packet) {
+    printf("parse response failed\n");
+    return;
+  }
+
+  // each client keeps `kInFlight` queries in flight until the deadline,
+  // and returns the number of replies it received
+  auto run_client = [&](base::SocketAddr gateway_addr,
+                        std::chrono::steady_clock::time_point deadline) {
+    auto client = base::UDPSocket::Bind(base::SocketAddr("127.0.0.1:0"));
+    if (!client) {
+      return uint64_t(0);
+    }
+    // a lost datagram ends the round instead of blocking the client
+    timeval timeout{0, 100000};
+    setsockopt(client->fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    std::vector<uint8_t> payload = query;
+    std::vector<std::vector<uint8_t>> buffers(
+        kInFlight, std::vector<uint8_t>(base::PacketBuffer::kCapacity));
+    std::vector<base::Datagram> to_send(kInFlight);
+    std::vector<base::Datagram> to_receive(kInFlight);
+    for (int i = 0; i < kInFlight; i++) {
+      to_send[i] = {payload, payload.size(), gateway_addr};
+      to_receive[i].buffer = buffers[i];
+    }
+    uint64_t replies = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+      client->SendMany(to_send);
+      for (int received = 0; received < kInFlight;) {
+        auto n = client->RecvMany(std::span(to_receive).subspan(received));
+        if (!n) {
+          break;
+        }
+        received += *n;
+        replies += *n;
+      }
+    }
+    return replies;
+  };
+
+  printf("cache hits over loopback, %d clients with %d queries in flight "
+         "each, %lld s per row\n",
+         kClients, kInFlight, static_cast<long long>(kDuration.count()));
+  printf("  %-32s %8s\n", "listeners", "kqps");
+  // 0 is the single socket, with the hits answered on the receiving thread
+  for (int listeners : {0, 1, 2, 4}) {
+    GatewayOptions options;
+    options.listen_addr =
+        base::SocketAddr("127.0.0.1:" + std::to_string(5330 + listeners));
+    options.upstreams = {base::SocketAddr("127.0.0.1:9")};
+    options.reuse_port_listeners = listeners;
+    options.inline_cache_hits = true;
+    auto gateway = std::make_shared<Gateway>(options);
+    gateway->initialized_ = true;
+    gateway->dns_cache_ = std::make_shared<DNSCache>(gateway, options.cache);
+    gateway->dns_cache_->update(*packet, response);
+    // `Run` never returns, the gateway is left running when the benchmark
+    // moves on
+    std::thread([gateway]() { gateway->Run(); }).detach();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> replies(kClients);
+    for (int i = 0; i < kClients; i++) {
+      threads.emplace_back([&, i]() {
+        replies[i] = run_client(options.listen_addr, start + kDuration);
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    uint64_t total = 0;
+    for (uint64_t n : replies) {
+      total += n;
     }
+    std::string name = listeners == 0 ? "0 (single socket, inline hits)"
+                                      : std::to_string(listeners);
+    printf("  %-32s %8.1f\n", name.c_str(), total / elapsed.count() / 1e3);
   }
 }
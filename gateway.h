@@ -1,15 +1,22 @@
 #ifndef GATEWAY_H_
 #define GATEWAY_H_
 
+#include "base/memory/packet_buffer.h"
+#include "base/net/io_engine.h"
 #include "base/net/udp_socket.h"
 #include "base/threading/thread_pool.h"
+#include "base/threading/timer.h"
+#include "base/threading/timer_wheel.h"
 #include "dns/dns_packet.h"
 #include "dns_cache.h"
+#include "transaction_table.h"
+#include "upstream_pool.h"
 #include <arpa/inet.h>
 #include <coroutine>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <netinet/in.h>
 #include <optional>
 #include <span>
@@ -19,22 +26,185 @@
 #include <utility>
 #include <vector>
 
+// outgoing packets collected while a batch of incoming packets is processed,
+// so that they can be flushed with a single `SendMany`
+class PacketBatch {
+public:
+  void Add(base::PacketBuffer buffer, base::SocketAddr addr);
+
+  void Flush(base::IOEngine &engine);
+
+  bool empty() const { return packets_.empty(); }
+
+private:
+  std::vector<std::pair<base::PacketBuffer, base::SocketAddr>> packets_;
+  std::vector<base::Datagram> datagrams_;
+};
+
+struct GatewayOptions {
+  // the address queries are received on
+  base::SocketAddr listen_addr = base::SocketAddr("0.0.0.0:53");
+  // 0: a single socket is read by `Gateway::Run` and every received batch is
+  //    processed on the shared `ThreadPool`.
+  // n > 0: n sockets are bound to the same address with SO_REUSEPORT, each
+  //    one owned by a dedicated thread which receives, parses and replies
+  //    inline, without handing packets over to other threads.
+  int reuse_port_listeners = 0;
+  // only for the single socket mode: standard queries which hit the cache
+  // are answered on the receiving thread, only misses and upstream responses
+  // are dispatched to the `ThreadPool`
+  bool inline_cache_hits = false;
+  // falls back to `kBlocking` if the kernel does not support it
+  base::IOEngineType io_engine = base::IOEngineType::kBlocking;
+  DNSCacheOptions cache;
+  // a client whose query is not answered by the upstreams within this delay
+  // gets the stale answers of the cache, if any
+  std::chrono::milliseconds stale_answer_deadline{1800};
+  // clients waiting for the same upstream query, more are turned away
+  size_t max_waiters = 64;
+  // resolvers queried on cache misses
+  std::vector<base::SocketAddr> upstreams = {
+      base::SocketAddr("114.114.114.114:53")};
+};
+
 // a uniform module for receiving and sending DNS packets
 class Gateway : public std::enable_shared_from_this<Gateway> {
 public:
-  Gateway();
+  Gateway(GatewayOptions options = {});
   void Initialize();
 
   [[deprecated("deprecated")]] void Send(const DNSPacket &dns_packet);
 
-  void ProcessRawPacket(std::vector<uint8_t> buffer, base::SocketAddr addr);
+  // packets to be sent are appended to `batch` if it is not null,
+  // otherwise they are sent immediately
+  void ProcessRawPacket(base::PacketBuffer buffer, base::SocketAddr addr,
+                        PacketBatch *batch = nullptr);
 
   void Run();
 
+  // saves the snapshot of the cache, if enabled. to be called before the
+  // process exits
+  void Shutdown();
+
 private:
+  // packets received by `Run` in the single socket mode, processed by a
+  // worker of the `ThreadPool`, and the replies to them. the storage of a
+  // batch is reused once it has been processed
+  struct ReceivedBatch {
+    std::vector<std::pair<base::PacketBuffer, base::SocketAddr>> packets;
+    PacketBatch replies;
+  };
+
+  // receive loop of one SO_REUSEPORT listener
+  void RunListener(base::IOEngine &engine);
+
+  // a processed batch, or a new one if all of them are in flight
+  ReceivedBatch *TakeReceivedBatch();
+  // processes and replies to the packets of `received`, then gives it back
+  // to be taken again
+  void ProcessReceivedBatch(ReceivedBatch *received);
+
+  void SendOrBatch(base::PacketBuffer buffer, base::SocketAddr addr,
+                   PacketBatch *batch);
+
+  // `id`, `question` and `udp_payload_size` are the ones of the client's
+  // query. answers larger than `udp_payload_size` are replied to with TC
+  // set
+  void ReplyFromCache(uint16_t id, std::span<const uint8_t> question,
+                      uint16_t udp_payload_size, const DNSCache::Answer &ans,
+                      base::SocketAddr addr, PacketBatch *batch);
+  // replies with `rcode`, the question and no records, with TC set so that
+  // the client retries over TCP
+  void ReplyTruncated(uint16_t id, std::span<const uint8_t> question,
+                      uint16_t udp_payload_size, uint8_t rcode,
+                      base::SocketAddr addr, PacketBatch *batch);
+
+  // answers the waiters of `transaction` with the stale answers of its key.
+  // returns false if there are none
+  bool ReplyStale(const Transaction &transaction, PacketBatch *batch);
+
+  // queries the upstream in the background so that the answers of `key`
+  // are refreshed before expiring. `query` is the client's query for it
+  void Prefetch(const CacheKey &key, const base::PacketBuffer &query,
+                PacketBatch *batch);
+
+  // returns true if `buffer` is a standard query answered from the cache
+  bool TryReplyFromCache(const base::PacketBuffer &buffer,
+                         base::SocketAddr addr, PacketBatch *batch);
+
+  // a query still in flight when its upstream's recent p95 RTT elapses is
+  // sent to a second upstream as well
+  void ScheduleHedge(uint16_t id,
+                     std::chrono::steady_clock::time_point sent_at,
+                     size_t upstream);
+  // a query not answered by `upstream` within the deadline of its `retries`th
+  // retry is resent to another upstream, or answered with SERVFAIL when it
+  // runs out of retries
+  void ScheduleTimeout(uint16_t id,
+                       std::chrono::steady_clock::time_point sent_at,
+                       size_t upstream, int retries);
+  // a client still waiting when `stale_answer_deadline` elapses is answered
+  // with the stale answers of `key`
+  void ScheduleStaleDeadline(uint16_t id, const CacheKey &key,
+                             base::SocketAddr client_addr, uint16_t client_id);
+  void OnTimerTick();
+  void OnTimeout(uint16_t id, std::chrono::steady_clock::time_point sent_at,
+                 size_t upstream, int retries, PacketBatch &batch);
+
+  friend bool TestCacheHitAllocations();
+  friend bool TestTruncatedReplies();
+  friend bool TestUpstreamFailover();
+  friend void BenchListeners();
+
+  struct PendingTimer;
+  void OnStaleDeadline(const PendingTimer &timer, PacketBatch &batch);
+
+  void ReplyServFail(const Transaction &transaction, PacketBatch &batch);
+
+  struct PendingTimer {
+    enum class Kind { kHedge, kTimeout, kStale };
+    Kind kind;
+    // identifies the transaction together with `id`
+    std::chrono::steady_clock::time_point sent_at;
+    uint16_t id;
+    // upstream of the attempt the timer belongs to
+    size_t upstream;
+    // number of retries already made, for `kTimeout`
+    int retries;
+    // the client waiting for the answers of `key`, for `kStale`
+    CacheKey key = {};
+    base::SocketAddr client_addr = {};
+    uint16_t client_id = 0;
+  };
+
   bool initialized_ = false;
-  base::UDPSocket udp_socket_;
+  GatewayOptions options_;
+  // the only socket, or the first listener in SO_REUSEPORT mode
+  std::unique_ptr<base::IOEngine> engine_;
+  // the other listeners in SO_REUSEPORT mode
+  std::vector<std::unique_ptr<base::IOEngine>> listeners_;
   std::shared_ptr<DNSCache> dns_cache_;
+  TransactionTable transactions_;
+  UpstreamPool upstreams_;
+
+  // deadlines of hedges and upstream timeouts
+  std::mutex timers_mutex_;
+  base::TimerWheel<PendingTimer> timers_;
+  std::optional<base::Timer> timer_;
+
+  std::mutex received_batches_mutex_;
+  // every batch ever taken, the processed ones are also in
+  // `free_received_batches_`
+  std::vector<std::unique_ptr<ReceivedBatch>> received_batches_;
+  std::vector<ReceivedBatch *> free_received_batches_;
 };
 
+bool TestCacheHitAllocations();
+bool TestTruncatedReplies();
+bool TestUpstreamFailover();
+
+// answers cache hits to clients over loopback, with a single socket and
+// with 1, 2 and 4 SO_REUSEPORT listeners, and prints the replies per second
+void BenchListeners();
+
 #endif
\ No newline at end of file
@@ -1,28 +1,266 @@
+#include "base/logging.h"
+#include "base/net/io_engine.h"
+#include "base/net/io_uring_engine.h"
 #include "base/net/udp_socket.h"
 #include "base/threading/thread_pool.h"
 #include "base/threading/timer.h"
 #include "dns/dns_packet.h"
+#include "dns/dns_packet_view.h"
+#include "dns/name_compressor.h"
+#include "dns/name_kernels.h"
+#include "dns/query_classifier.h"
+#include "dns/response_writer.h"
 #include <arpa/inet.h>
+#include <charconv>
 #include <coroutine>
+#include <csignal>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <netinet/in.h>
 #include <optional>
+#include <pthread.h>
 #include <span>
+#include <sstream>
+#include <string>
 #include <sys/socket.h>
+#include <system_error>
 #include <thread>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 #include "gateway.h"
 
-int main() {
+namespace {
+
+// returns the value of `--name=value` if it is present in `argv`
+std::optional<std::string> get_flag(int argc, char *argv[],
+                                    const std::string &name) {
+  std::string prefix = "--" + name + "=";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.starts_with(prefix)) {
+      return arg.substr(prefix.size());
+    }
+  }
+  return {};
+}
+
+// parses the whole of `value` as a number in [min, max], nullopt if it is
+// not one
+template <class T>
+std::optional<T> parse_number(const std::string &value, T min, T max) {
+  T number{};
+  const char *end = value.data() + value.size();
+  auto [ptr, ec] = std::from_chars(value.data(), end, number);
+  // written so that NaN is out of range too
+  if (ec != std::errc() || ptr != end || !(number >= min && number <= max)) {
+    return {};
+  }
+  return number;
+}
+
+// run by `--self-test=<name>`, or all of them by `--self-test=all`
+const std::vector<std::pair<std::string, bool (*)()>> kSelfTests = {
+    {"CacheHitAllocations", TestCacheHitAllocations},
+    {"TruncatedReplies", TestTruncatedReplies},
+    {"ForeignResponses", TestForeignResponses},
+    {"SocketAddrFromString", base::TestSocketAddrFromString},
+    {"IoUringLoopback", base::TestIoUringLoopback},
+    {"UpstreamPool", TestUpstreamPool},
+    {"UpstreamFailover", TestUpstreamFailover},
+    {"NameKernels", TestNameKernels},
+    {"QueryClassifier", TestQueryClassifier},
+    {"MalformedPackets", TestMalformedPackets},
+    {"ChainHits", TestChainHits},
+    {"NegativeAnswers", TestNegativeAnswers},
+    {"Clean", TestClean},
+    {"Prefetch", TestPrefetch},
+    {"Eviction", TestEviction},
+    {"Snapshot", TestSnapshot},
+    {"CompressedRecords", TestCompressedRecords},
+    {"ResponseWriterCapacity", TestResponseWriterCapacity},
+};
+
+// run by `--bench=<name>`, or all of them by `--bench=all`. they print
+// their own results, which only mean something in a build without the
+// debug flags, see CMakeLists.txt
+const std::vector<std::pair<std::string, void (*)()>> kBenchmarks = {
+    {"DatagramIO", base::BenchDatagramIO},
+    {"Listeners", BenchListeners},
+    {"CacheLookup", BenchCacheLookup},
+    {"CacheEviction", BenchCacheEviction},
+    {"Snapshot", BenchSnapshot},
+    {"PacketParse", BenchPacketParse},
+    {"ReplyEncode", BenchReplyEncode},
+    {"NameKernels", BenchNameKernels},
+};
+
+// returns the exit code, non zero if a test failed or none matched `name`
+int RunSelfTests(const std::string &name) {
+  int run = 0;
+  int failed = 0;
+  for (const auto &[test_name, test] : kSelfTests) {
+    if (name != "all" && name != test_name) {
+      continue;
+    }
+    run++;
+    bool passed = test();
+    failed += !passed;
+    std::cout << (passed ? "[PASS] " : "[FAIL] ") << test_name << std::endl;
+  }
+  if (run == 0) {
+    std::cerr << "unknown test: " << name << std::endl;
+    return 1;
+  }
+  return failed > 0 ? 1 : 0;
+}
+
+// returns the exit code, non zero if no benchmark matched `name`
+int RunBenchmarks(const std::string &name) {
+  int run = 0;
+  for (const auto &[bench_name, bench] : kBenchmarks) {
+    if (name != "all" && name != bench_name) {
+      continue;
+    }
+    run++;
+    bench();
+  }
+  if (run == 0) {
+    std::cerr << "unknown benchmark: " << name << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (auto log_level = get_flag(argc, argv, "log-level")) {
+    if (auto level = base::log_level_from_string(*log_level)) {
+      base::set_log_level(*level);
+    } else {
+      std::cerr << "unknown log level: " << *log_level << std::endl;
+      return 1;
+    }
+  }
+  if (auto self_test = get_flag(argc, argv, "self-test")) {
+    return RunSelfTests(*self_test);
+  }
+  if (auto bench = get_flag(argc, argv, "bench")) {
+    return RunBenchmarks(*bench);
+  }
+
+  // SIGINT and SIGTERM are blocked in every thread, and waited for by a
+  // dedicated one which shuts the gateway down
+  sigset_t exit_signals;
+  sigemptyset(&exit_signals);
+  sigaddset(&exit_signals, SIGINT);
+  sigaddset(&exit_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &exit_signals, nullptr);
 
   base::ThreadPool::GetInstance()->Initialize(10);
-  
-  auto gateway = std::make_shared<Gateway>();
+
+  GatewayOptions options;
+  if (auto listeners = get_flag(argc, argv, "listeners")) {
+    // without the flag, a single socket is read, see `GatewayOptions`
+    auto count = parse_number(*listeners, 1, 1024);
+    if (!count) {
+      std::cerr << "bad listeners, expected a count in [1, 1024]: "
+                << *listeners << std::endl;
+      return 1;
+    }
+    options.reuse_port_listeners = *count;
+  }
+  if (auto inline_cache_hits = get_flag(argc, argv, "inline-cache-hits")) {
+    options.inline_cache_hits = *inline_cache_hits == "1";
+  }
+  if (auto cache_memory_mb = get_flag(argc, argv, "cache-memory-mb")) {
+    auto mb = parse_number(*cache_memory_mb, size_t(1),
+                           std::numeric_limits<size_t>::max() >> 20);
+    if (!mb) {
+      std::cerr << "bad cache memory, expected a positive number of MiB: "
+                << *cache_memory_mb << std::endl;
+      return 1;
+    }
+    options.cache.memory_budget = *mb << 20;
+  }
+  if (auto prefetch_threshold = get_flag(argc, argv, "prefetch-threshold")) {
+    // a fraction of the TTL, 0 disables prefetching
+    auto threshold = parse_number(*prefetch_threshold, 0.0, 1.0);
+    if (!threshold) {
+      std::cerr << "bad prefetch threshold, expected a fraction in [0, 1]: "
+                << *prefetch_threshold << std::endl;
+      return 1;
+    }
+    options.cache.prefetch_threshold = *threshold;
+  }
+  if (auto stale_window = get_flag(argc, argv, "stale-window")) {
+    // in seconds, 0 disables serve-stale. up to a year, far from
+    // overflowing the time points it is added to
+    auto seconds = parse_number(*stale_window, int64_t(0),
+                                int64_t(365 * 24 * 3600));
+    if (!seconds) {
+      std::cerr << "bad stale window, expected seconds in [0, 31536000]: "
+                << *stale_window << std::endl;
+      return 1;
+    }
+    options.cache.stale_window = std::chrono::seconds(*seconds);
+  }
+  if (auto snapshot = get_flag(argc, argv, "snapshot")) {
+    options.cache.snapshot_path = *snapshot;
+  }
+  if (auto snapshot_interval = get_flag(argc, argv, "snapshot-interval")) {
+    // in seconds, the snapshots are disabled by leaving out `--snapshot`
+    auto seconds = parse_number(*snapshot_interval, int64_t(1),
+                                int64_t(365 * 24 * 3600));
+    if (!seconds) {
+      std::cerr << "bad snapshot interval, expected seconds in "
+                << "[1, 31536000]: " << *snapshot_interval << std::endl;
+      return 1;
+    }
+    options.cache.snapshot_interval = std::chrono::seconds(*seconds);
+  }
+  if (auto upstreams = get_flag(argc, argv, "upstreams")) {
+    // comma separated, e.g. --upstreams=1.1.1.1:53,8.8.8.8:53
+    options.upstreams.clear();
+    std::stringstream ss(*upstreams);
+    std::string upstream;
+    while (std::getline(ss, upstream, ',')) {
+      auto addr = base::socket_addr_from_string(upstream);
+      if (!addr) {
+        std::cerr << "bad upstream, expected ip:port: " << upstream
+                  << std::endl;
+        return 1;
+      }
+      options.upstreams.push_back(*addr);
+    }
+    if (options.upstreams.empty()) {
+      std::cerr << "no upstream given" << std::endl;
+      return 1;
+    }
+  }
+  if (auto io_engine = get_flag(argc, argv, "io-engine")) {
+    if (auto type = base::io_engine_type_from_string(*io_engine)) {
+      options.io_engine = *type;
+    } else {
+      std::cerr << "unknown io engine: " << *io_engine << std::endl;
+      return 1;
+    }
+  }
+
+  auto gateway = std::make_shared<Gateway>(options);
   gateway->Initialize();
+  std::thread([gateway, exit_signals]() {
+    int signal = 0;
+    sigwait(&exit_signals, &signal);
+    base::log(base::log_level::INFO, "signal {} received, exiting", signal);
+    gateway->Shutdown();
+    // the other threads never return, skip the destructors
+    _exit(0);
+  }).detach();
   gateway->Run();
 
   return 0;
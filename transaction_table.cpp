@@ -0,0 +1,205 @@
+#include "transaction_table.h"
+#include "dns_cache.h"
+#include "dns/dns_packet.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+TransactionTable::TransactionTable(size_t max_waiters)
+    : max_waiters_(max_waiters), by_id_(kIdSpace),
+      rng_(std::random_device{}()) {}
+
+std::optional<uint16_t>
+TransactionTable::Begin(const DNSCache::Key &key,
+                        std::optional<Waiter> waiter,
+                        base::PacketBuffer &query, size_t upstream,
+                        std::chrono::steady_clock::time_point sent_at,
+                        bool *joined) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (joined) {
+    *joined = false;
+  }
+
+  if (auto iter = by_key_.find(key); iter != by_key_.end()) {
+    if (joined) {
+      *joined = true;
+    }
+    if (!waiter) {
+      return iter->second;
+    }
+    auto &waiters = by_id_[iter->second]->waiters;
+    // a retransmission of a query already waiting gets a single reply
+    for (const Waiter &other : waiters) {
+      if (other.id == waiter->id && other.addr == waiter->addr) {
+        return iter->second;
+      }
+    }
+    if (waiters.size() >= max_waiters_) {
+      return {};
+    }
+    waiters.push_back(std::move(*waiter));
+    return iter->second;
+  }
+
+  std::uniform_int_distribution<uint32_t> dist(0, kIdSpace - 1);
+  for (int i = 0; i < kMaxIdProbes; i++) {
+    uint16_t id = dist(rng_);
+    if (by_id_[id]) {
+      continue;
+    }
+    write_u16_to_net(query.data(), id);
+    auto transaction = std::make_unique<Transaction>();
+    transaction->id = id;
+    transaction->key = key;
+    transaction->sent_at = sent_at;
+    if (waiter) {
+      transaction->waiters.push_back(std::move(*waiter));
+    }
+    transaction->query = base::PacketBuffer::CopyFrom(query.span());
+    transaction->attempts.push_back({upstream, transaction->sent_at});
+    by_id_[id] = std::move(transaction);
+    by_key_.insert({key, id});
+    return id;
+  }
+  return {};
+}
+
+std::optional<base::PacketBuffer>
+TransactionTable::AddAttempt(uint16_t id,
+                             std::chrono::steady_clock::time_point sent_at,
+                             size_t upstream) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto &slot = by_id_[id];
+  // the id may have been reused by a newer transaction
+  if (!slot || slot->sent_at != sent_at) {
+    return {};
+  }
+  slot->attempts.push_back({upstream, std::chrono::steady_clock::now()});
+  return base::PacketBuffer::CopyFrom(slot->query.span());
+}
+
+std::optional<base::PacketBuffer>
+TransactionTable::Retry(uint16_t id,
+                        std::chrono::steady_clock::time_point sent_at,
+                        size_t timed_out_upstream, size_t upstream) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto &slot = by_id_[id];
+  if (!slot || slot->sent_at != sent_at) {
+    return {};
+  }
+  for (Attempt &attempt : slot->attempts) {
+    if (attempt.upstream == timed_out_upstream) {
+      attempt.timed_out = true;
+    }
+  }
+  slot->attempts.push_back({upstream, std::chrono::steady_clock::now()});
+  return base::PacketBuffer::CopyFrom(slot->query.span());
+}
+
+std::optional<Transaction>
+TransactionTable::Abort(uint16_t id,
+                        std::chrono::steady_clock::time_point sent_at) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto &slot = by_id_[id];
+  if (!slot || slot->sent_at != sent_at) {
+    return {};
+  }
+  Transaction transaction = std::move(*slot);
+  slot.reset();
+  by_key_.erase(transaction.key);
+  return transaction;
+}
+
+std::optional<Waiter>
+TransactionTable::RemoveWaiter(uint16_t id, const DNSCache::Key &key,
+                               const base::SocketAddr &addr,
+                               uint16_t client_id) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto &slot = by_id_[id];
+  if (!slot || slot->key != key) {
+    return {};
+  }
+  auto &waiters = slot->waiters;
+  for (auto iter = waiters.begin(); iter != waiters.end(); iter++) {
+    if (iter->addr == addr && iter->id == client_id) {
+      Waiter waiter = std::move(*iter);
+      waiters.erase(iter);
+      return waiter;
+    }
+  }
+  return {};
+}
+
+std::optional<Transaction>
+TransactionTable::Complete(uint16_t id, const DNSCache::Key &key,
+                           std::optional<size_t> upstream) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto &slot = by_id_[id];
+  if (!slot || slot->key != key) {
+    return {};
+  }
+  // a forged response has to guess the id and the question, but not the
+  // source address. the answer of the real upstream is still awaited
+  bool sent_to_upstream =
+      upstream && std::any_of(slot->attempts.begin(), slot->attempts.end(),
+                              [&](const Attempt &attempt) {
+                                return attempt.upstream == *upstream;
+                              });
+  if (!sent_to_upstream) {
+    foreign_responses_++;
+    return {};
+  }
+  Transaction transaction = std::move(*slot);
+  slot.reset();
+  by_key_.erase(transaction.key);
+  return transaction;
+}
+
+size_t TransactionTable::size() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return by_key_.size();
+}
+
+uint64_t TransactionTable::foreign_response_count() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return foreign_responses_;
+}
+
+bool TestForeignResponses() {
+  // www.example.com A, with room for the id
+  std::vector<uint8_t> question{0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a',
+                                'm',  'p', 'l', 'e', 0x03, 'c', 'o', 'm',
+                                0x00, 0x00, 0x01, 0x00, 0x01};
+  auto key = DNSCache::Key::FromQuestion(question);
+  if (!key) {
+    std::cerr << "bad question" << std::endl;
+    return false;
+  }
+  auto query = base::PacketBuffer::Allocate();
+  query.resize(kHeaderSize);
+  TransactionTable table;
+  auto sent_at = std::chrono::steady_clock::now();
+  auto id = table.Begin(*key, std::nullopt, query, 0, sent_at);
+  if (!id) {
+    std::cerr << "begin failed" << std::endl;
+    return false;
+  }
+  // neither an upstream, nor the upstream queried
+  if (table.Complete(*id, *key, std::nullopt) || table.Complete(*id, *key, 1) ||
+      table.foreign_response_count() != 2 || table.size() != 1) {
+    std::cerr << "foreign response accepted" << std::endl;
+    return false;
+  }
+  // hedged to upstream 1, which may answer first
+  if (!table.AddAttempt(*id, sent_at, 1) || !table.Complete(*id, *key, 1) ||
+      table.foreign_response_count() != 2 || table.size() != 0) {
+    std::cerr << "response of a hedged upstream rejected" << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,142 @@
+#ifndef TRANSACTION_TABLE_H_
+#define TRANSACTION_TABLE_H_
+
+#include "base/memory/packet_buffer.h"
+#include "base/net/udp_socket.h"
+#include "dns_cache.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// a client waiting for the answer of an upstream query
+struct Waiter {
+  base::SocketAddr addr;
+  // id of the client's query, restored in the reply
+  uint16_t id;
+  // question of the client's query, restored in the reply since it may
+  // differ in case from the forwarded one
+  std::vector<uint8_t> question;
+  // the largest reply the client accepts over UDP
+  uint16_t udp_payload_size;
+};
+
+// one send of a query to an upstream
+struct Attempt {
+  size_t upstream;
+  std::chrono::steady_clock::time_point sent_at;
+  // no answer within the deadline, a late answer is not an RTT sample
+  bool timed_out = false;
+};
+
+// an in-flight upstream query
+struct Transaction {
+  // id assigned by the gateway, written into the forwarded query
+  uint16_t id;
+  DNSCache::Key key;
+  // time of the first attempt
+  std::chrono::steady_clock::time_point sent_at;
+  std::vector<Waiter> waiters;
+  // the forwarded query, kept to be resent to other upstreams
+  base::PacketBuffer query;
+  std::vector<Attempt> attempts;
+};
+
+/*
+  `TransactionTable` tracks the queries sent upstream.
+
+  Every upstream query gets a random id which is not used by any other
+  in-flight query, so that ids picked by different clients never collide.
+  Responses are matched by id in O(1), must carry the same question as
+  the query and must come from an upstream the query was sent to. A
+  transaction is removed by the first matching response, so duplicate
+  responses are dropped. Queries for a key already in flight join the
+  existing transaction instead of being forwarded again, up to
+  `max_waiters` clients per transaction. A client resending its query while
+  waiting is only counted once. Waiters live as long as their transaction,
+  which is bounded by the upstream timeouts.
+
+  thread safe
+*/
+class TransactionTable {
+public:
+  explicit TransactionTable(size_t max_waiters = 64);
+
+  // if no query for `key` is in flight, starts a new transaction: the new id
+  // is written into `query`, a copy of it is kept, and the first attempt is
+  // recorded against `upstream` at `sent_at`. the caller is responsible for
+  // sending `query` to that upstream, unless `*joined` is set: `waiter`
+  // joined the transaction already in flight for `key`. a transaction without
+  // waiter only refreshes the cache.
+  // returns the id of the transaction, or nullopt if the id space is
+  // exhausted, or if `*joined` is set, because the transaction in flight has
+  // `max_waiters` waiters already
+  std::optional<uint16_t> Begin(const DNSCache::Key &key,
+                                std::optional<Waiter> waiter,
+                                base::PacketBuffer &query, size_t upstream,
+                                std::chrono::steady_clock::time_point sent_at,
+                                bool *joined = nullptr);
+
+  // records another attempt of the transaction `id` started at `sent_at`.
+  // returns a copy of the query to be sent to `upstream`, or nullopt if the
+  // transaction is no longer in flight
+  std::optional<base::PacketBuffer>
+  AddAttempt(uint16_t id, std::chrono::steady_clock::time_point sent_at,
+             size_t upstream);
+
+  // marks the attempts sent to `timed_out_upstream` as timed out and records
+  // a retry. returns a copy of the query to be sent to `upstream`, or nullopt
+  // if the transaction is no longer in flight
+  std::optional<base::PacketBuffer>
+  Retry(uint16_t id, std::chrono::steady_clock::time_point sent_at,
+        size_t timed_out_upstream, size_t upstream);
+
+  // removes the transaction `id` started at `sent_at` when it runs out of
+  // retries. returns nullopt if it is no longer in flight
+  std::optional<Transaction>
+  Abort(uint16_t id, std::chrono::steady_clock::time_point sent_at);
+
+  // removes the waiter of the client `addr` with query id `client_id` from
+  // the transaction `id` of `key`, which stays in flight.
+  // returns nullopt if the waiter is not found
+  std::optional<Waiter> RemoveWaiter(uint16_t id, const DNSCache::Key &key,
+                                     const base::SocketAddr &addr,
+                                     uint16_t client_id);
+
+  // removes the transaction answered by a response from `upstream`, the
+  // index of its source address in the pool, nullopt if the source is not
+  // an upstream.
+  // returns nullopt for unknown ids, mismatched questions and duplicate
+  // responses, and for responses from an upstream the query was not sent
+  // to, which leave the transaction in flight and are counted by
+  // `foreign_response_count`
+  std::optional<Transaction> Complete(uint16_t id, const DNSCache::Key &key,
+                                      std::optional<size_t> upstream);
+
+  size_t size();
+
+  // responses matching a transaction but not coming from any upstream it
+  // was sent to, likely spoofed
+  uint64_t foreign_response_count();
+
+private:
+  static constexpr const size_t kIdSpace = 1 << 16;
+  // give up finding a free id after this many random probes
+  static constexpr const int kMaxIdProbes = 64;
+
+  const size_t max_waiters_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Transaction>> by_id_;
+  std::unordered_map<DNSCache::Key, uint16_t, DNSCache::Key::Hash> by_key_;
+  std::mt19937 rng_;
+  uint64_t foreign_responses_ = 0;
+};
+
+bool TestForeignResponses();
+
+#endif
@@ -0,0 +1,211 @@
+#include "upstream_pool.h"
+#include "base/net/udp_socket.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+namespace {
+
+// weight of the newest sample in the EWMAs
+constexpr const double kEwmaAlpha = 0.2;
+// expected latency added per unit of error rate
+constexpr const double kErrorPenaltyUs = 1000 * 1000;
+// used until an upstream has samples, optimistic so that every upstream is
+// tried
+constexpr const int64_t kInitialRttUs = 0;
+// used as hedge delay until an upstream has enough samples
+constexpr const int64_t kDefaultHedgeDelayUs = 100 * 1000;
+constexpr const int64_t kMinHedgeDelayUs = 1000;
+
+} // namespace
+
+UpstreamPool::UpstreamPool(std::vector<base::SocketAddr> addrs)
+    : addrs_(std::move(addrs)), stats_(addrs_.size()),
+      rng_(std::random_device{}()) {
+  for (Stats &stats : stats_) {
+    stats.ewma_rtt_us = kInitialRttUs;
+    stats.rtt_samples.reserve(kRttSamples);
+  }
+}
+
+double UpstreamPool::ExpectedLatency(const Stats &stats) const {
+  return stats.ewma_rtt_us + stats.ewma_error_rate * kErrorPenaltyUs;
+}
+
+size_t UpstreamPool::Pick(std::optional<size_t> exclude) {
+  size_t n = addrs_.size();
+  if (n <= 1) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lg(mutex_);
+  // candidates are drawn from the upstreams other than `exclude`
+  size_t candidates = exclude ? n - 1 : n;
+  auto nth_candidate = [&](size_t i) {
+    return exclude && i >= *exclude ? i + 1 : i;
+  };
+  if (candidates == 1) {
+    return nth_candidate(0);
+  }
+
+  std::uniform_int_distribution<size_t> dist(0, candidates - 1);
+  size_t a = dist(rng_);
+  size_t b = dist(rng_);
+  if (a == b) {
+    b = (b + 1) % candidates;
+  }
+  a = nth_candidate(a);
+  b = nth_candidate(b);
+  return ExpectedLatency(stats_[a]) <= ExpectedLatency(stats_[b]) ? a : b;
+}
+
+void UpstreamPool::OnResponse(size_t idx, std::chrono::microseconds rtt) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  Stats &stats = stats_[idx];
+  int64_t rtt_us = rtt.count();
+  if (stats.rtt_samples.empty()) {
+    stats.ewma_rtt_us = rtt_us;
+  } else {
+    stats.ewma_rtt_us += kEwmaAlpha * (rtt_us - stats.ewma_rtt_us);
+  }
+  stats.ewma_error_rate -= kEwmaAlpha * stats.ewma_error_rate;
+
+  if (stats.rtt_samples.size() < kRttSamples) {
+    stats.rtt_samples.push_back(rtt_us);
+  } else {
+    stats.rtt_samples[stats.next_sample] = rtt_us;
+    stats.next_sample = (stats.next_sample + 1) % kRttSamples;
+  }
+  std::array<int64_t, kRttSamples> sorted;
+  size_t cnt = stats.rtt_samples.size();
+  std::copy(stats.rtt_samples.begin(), stats.rtt_samples.end(), sorted.begin());
+  size_t p95_idx = cnt * 95 / 100;
+  std::nth_element(sorted.begin(), sorted.begin() + p95_idx,
+                   sorted.begin() + cnt);
+  stats.p95_rtt_us = sorted[p95_idx];
+}
+
+void UpstreamPool::OnError(size_t idx) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  Stats &stats = stats_[idx];
+  stats.ewma_error_rate += kEwmaAlpha * (1 - stats.ewma_error_rate);
+}
+
+std::chrono::microseconds UpstreamPool::GetHedgeDelay(size_t idx) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  const Stats &stats = stats_[idx];
+  if (stats.rtt_samples.size() < kRttSamples / 4) {
+    return std::chrono::microseconds(kDefaultHedgeDelayUs);
+  }
+  return std::chrono::microseconds(
+      std::max(stats.p95_rtt_us, kMinHedgeDelayUs));
+}
+
+std::optional<size_t> UpstreamPool::Find(const base::SocketAddr &addr) const {
+  for (size_t i = 0; i < addrs_.size(); i++) {
+    if (addrs_[i] == addr) {
+      return i;
+    }
+  }
+  return {};
+}
+
+bool TestUpstreamPool() {
+  using std::chrono::milliseconds;
+  std::vector<base::SocketAddr> addrs = {base::SocketAddr("127.0.0.1:5301"),
+                                         base::SocketAddr("127.0.0.1:5302"),
+                                         base::SocketAddr("127.0.0.1:5303")};
+  {
+    // two choices: the slowest of three upstreams is never picked, the
+    // fastest one is picked whenever it is drawn
+    UpstreamPool pool(addrs);
+    pool.OnResponse(0, milliseconds(1));
+    pool.OnResponse(1, milliseconds(2));
+    pool.OnResponse(2, milliseconds(30));
+    std::array<int, 3> picks = {};
+    for (int i = 0; i < 3000; i++) {
+      picks[pool.Pick()]++;
+    }
+    if (picks[2] != 0 || picks[0] <= picks[1] || picks[1] == 0) {
+      std::cerr << "picks " << picks[0] << " " << picks[1] << " " << picks[2]
+                << std::endl;
+      return false;
+    }
+    for (int i = 0; i < 100; i++) {
+      if (pool.Pick(0) != 1) {
+        std::cerr << "excluded or slower upstream picked" << std::endl;
+        return false;
+      }
+    }
+  }
+  {
+    // the EWMA weighs the newest RTT by a fifth
+    UpstreamPool pool({addrs[0], addrs[1]});
+    pool.OnResponse(0, milliseconds(10));
+    pool.OnResponse(1, milliseconds(25));
+    pool.OnResponse(0, milliseconds(60)); // 20 ms
+    if (pool.Pick() != 0) {
+      std::cerr << "EWMA moved too fast" << std::endl;
+      return false;
+    }
+    pool.OnResponse(0, milliseconds(60)); // 28 ms
+    if (pool.Pick() != 1) {
+      std::cerr << "EWMA moved too slow" << std::endl;
+      return false;
+    }
+    // an error costs 200 ms of expected latency, forgotten as responses
+    // come back
+    pool.OnResponse(1, milliseconds(100));
+    for (int i = 0; i < 20; i++) {
+      pool.OnResponse(0, milliseconds(1));
+    }
+    pool.OnError(0);
+    if (pool.Pick() != 1) {
+      std::cerr << "erring upstream picked" << std::endl;
+      return false;
+    }
+    for (int i = 0; i < 8; i++) {
+      pool.OnResponse(0, milliseconds(1));
+    }
+    if (pool.Pick() != 0) {
+      std::cerr << "recovered upstream not picked" << std::endl;
+      return false;
+    }
+  }
+  {
+    UpstreamPool pool(addrs);
+    // a default until a quarter of the samples are in
+    constexpr const int kRttSamples = UpstreamPool::kRttSamples;
+    for (int i = 1; i < kRttSamples / 4; i++) {
+      pool.OnResponse(0, milliseconds(i));
+    }
+    if (pool.GetHedgeDelay(0) != milliseconds(100)) {
+      std::cerr << "hedge delay without enough samples" << std::endl;
+      return false;
+    }
+    // the p95 of 1, 2, ..., 64 ms
+    for (int i = kRttSamples / 4; i <= kRttSamples; i++) {
+      pool.OnResponse(0, milliseconds(i));
+    }
+    if (pool.GetHedgeDelay(0) != milliseconds(61)) {
+      std::cerr << "hedge delay "
+                << static_cast<int64_t>(pool.GetHedgeDelay(0).count())
+                << " us, expected the p95" << std::endl;
+      return false;
+    }
+    // older samples are overwritten, and the delay has a floor
+    for (int i = 0; i < kRttSamples; i++) {
+      pool.OnResponse(0, std::chrono::microseconds(100));
+    }
+    if (pool.GetHedgeDelay(0) != milliseconds(1)) {
+      std::cerr << "hedge delay below the floor" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
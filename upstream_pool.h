@@ -0,0 +1,70 @@
+#ifndef UPSTREAM_POOL_H_
+#define UPSTREAM_POOL_H_
+
+#include "base/net/udp_socket.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+/*
+  `UpstreamPool` keeps latency and error statistics of every upstream
+  resolver and picks the one to query.
+
+  The expected latency of an upstream is its EWMA RTT plus a penalty
+  proportional to its EWMA error rate. `Pick` samples two upstreams at
+  random and returns the one with the lower expected latency
+  (power-of-two-choices), which follows the fastest upstreams without
+  stampeding onto a single one.
+
+  thread safe
+*/
+class UpstreamPool {
+public:
+  UpstreamPool(std::vector<base::SocketAddr> addrs);
+
+  // returns the index of the chosen upstream, `exclude` is skipped unless it
+  // is the only upstream
+  size_t Pick(std::optional<size_t> exclude = {});
+
+  void OnResponse(size_t idx, std::chrono::microseconds rtt);
+  void OnError(size_t idx);
+
+  // p95 of the recent RTTs of the upstream, a query not answered within this
+  // delay is hedged to another upstream
+  std::chrono::microseconds GetHedgeDelay(size_t idx);
+
+  const base::SocketAddr &GetAddr(size_t idx) const { return addrs_[idx]; }
+
+  std::optional<size_t> Find(const base::SocketAddr &addr) const;
+
+  size_t size() const { return addrs_.size(); }
+
+private:
+  static constexpr const int kRttSamples = 64;
+
+  struct Stats {
+    double ewma_rtt_us = 0;
+    double ewma_error_rate = 0;
+    // ring of the recent RTTs for the p95
+    std::vector<int64_t> rtt_samples;
+    size_t next_sample = 0;
+    int64_t p95_rtt_us = 0;
+  };
+
+  double ExpectedLatency(const Stats &stats) const;
+
+private:
+  const std::vector<base::SocketAddr> addrs_;
+  std::mutex mutex_;
+  std::vector<Stats> stats_;
+  std::mt19937 rng_;
+
+  friend bool TestUpstreamPool();
+};
+
+bool TestUpstreamPool();
+
+#endif